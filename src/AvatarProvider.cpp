@@ -28,18 +28,14 @@ namespace AvatarProvider {
 void
 resolve(const QString &room_id, const QString &user_id, QObject *receiver, AvatarCallback callback)
 {
-        const auto key       = QString("%1 %2").arg(room_id).arg(user_id);
         const auto avatarUrl = Cache::avatarUrl(room_id, user_id);
 
-        if (!Cache::AvatarUrls.contains(key) || !cache::client())
+        if (avatarUrl.isEmpty() || !cache::client())
                 return;
 
-        if (avatarUrl.isEmpty())
-                return;
-
-        auto data = cache::client()->image(avatarUrl);
-        if (!data.isNull()) {
-                callback(QImage::fromData(data));
+        auto img = cache::client()->decodeImage(avatarUrl);
+        if (!img.isNull()) {
+                callback(img);
                 return;
         }
 
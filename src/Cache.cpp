@@ -15,6 +15,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <iterator>
 #include <limits>
 #include <stdexcept>
 
@@ -28,18 +31,66 @@
 #include <variant.hpp>
 
 #include "Cache.h"
+#include "CacheCodec.h"
 #include "Utils.h"
 
 //! Should be changed when a breaking change occurs in the cache format.
 //! This will reset client's data.
-static const std::string CURRENT_CACHE_FORMAT_VERSION("2018.06.10");
+static const std::string CURRENT_CACHE_FORMAT_VERSION("2018.08.05");
+//! Last format version that stored the cache records as JSON.
+static const std::string JSON_CACHE_FORMAT_VERSION("2018.06.10");
+//! Last format version that keyed the timeline messages by their timestamp as a string.
+static const std::string STRING_MESSAGE_KEYS_FORMAT_VERSION("2018.07.05");
+//! Last format version that stored the media files along with the sync state.
+static const std::string MEDIA_IN_STATE_FORMAT_VERSION("2018.07.12");
+//! Last format version that keyed the read receipts by a JSON object.
+static const std::string JSON_RECEIPT_KEYS_FORMAT_VERSION("2018.07.20");
+//! Last format version without the full-text index of the messages.
+static const std::string UNINDEXED_MESSAGES_FORMAT_VERSION("2018.07.24");
+//! Last format version whose message index couldn't be searched by event id.
+static const std::string INDEX_WITHOUT_EVENTS_FORMAT_VERSION("2018.08.02");
+//! Last format version that only kept the event ids of the indexed messages.
+static const std::string INDEXED_EVENTS_FORMAT_VERSION("2018.08.03");
+//! Last format version whose message index didn't keep the words of the messages.
+static const std::string INDEX_WITHOUT_WORDS_FORMAT_VERSION("2018.08.04");
 static const std::string SECRET("secret");
 
 static const lmdb::val NEXT_BATCH_KEY("next_batch");
 static const lmdb::val OLM_ACCOUNT_KEY("olm_account");
 static const lmdb::val CACHE_FORMAT_VERSION_KEY("cache_format_version");
 
-constexpr size_t MAX_RESTORED_MESSAGES = 30;
+//! Number of messages kept per room, unless overridden by the user/message_retention setting.
+constexpr size_t DEFAULT_MESSAGE_RETENTION = 1000;
+
+//! Initial size of the memory map. It's grown on demand when it gets full.
+constexpr size_t INITIAL_MAP_SIZE  = 256UL * 1024UL * 1024UL;         /* 256 MB */
+constexpr size_t MAX_MAP_SIZE      = 32UL * 1024UL * 1024UL * 1024UL; /* 32 GB */
+constexpr size_t MAP_GROWTH_FACTOR = 2;
+//! How long to wait for the transactions in flight before resizing the map.
+constexpr auto MAP_RESIZE_TIMEOUT = std::chrono::seconds(10);
+
+//! Size limit of the media store.
+constexpr size_t MEDIA_STORE_SIZE = 256UL * 1024UL * 1024UL; /* 256 MB */
+
+//! Number of rooms whose members are kept in memory.
+constexpr size_t MAX_LOADED_MEMBER_ROOMS = 32;
+//! Number of rooms whose sorted member list is kept in memory.
+constexpr size_t MAX_MEMBER_ORDERS = 4;
+
+//! Size of the reader table. Every read transaction takes a slot, including the reset
+//! ones kept in the pool, so it has to cover the pool & the threads reading at once.
+constexpr unsigned int MAX_READERS = 256;
+//! Number of reset read transactions kept for reuse.
+constexpr size_t MAX_IDLE_READ_TXNS = 16;
+
+//! Lower bound for the number of named databases in the environment.
+constexpr size_t MIN_MAX_DBS = 1024;
+//! Extra capacity for named databases relative to the ones already in use,
+//! so that rooms joined during this session won't exhaust the limit.
+constexpr size_t MAX_DBS_GROWTH_FACTOR = 2;
+//! Named databases that aren't cached: the global ones & the ones only opened by a
+//! single transaction. The environment is reopened before the cached ones eat into it.
+constexpr size_t MAX_DBS_HEADROOM = 64;
 
 //! Cache databases and their format.
 //!
@@ -49,7 +100,6 @@ constexpr auto ROOMS_DB("rooms");
 constexpr auto INVITES_DB("invites");
 //! Keeps already downloaded media for reuse.
 //! Format: matrix_url -> binary data.
-constexpr auto MEDIA_DB("media");
 //! Information that  must be kept between sync requests.
 constexpr auto SYNC_STATE_DB("sync_state");
 //! Read receipts per room/event.
@@ -75,6 +125,18 @@ using Receipts       = std::map<std::string, std::map<std::string, uint64_t>>;
 
 namespace {
 std::unique_ptr<Cache> instance_ = nullptr;
+
+std::string
+toStdString(const QString &s)
+{
+        return s.toStdString();
+}
+
+const std::string &
+toStdString(const std::string &s)
+{
+        return s;
+}
 }
 
 namespace cache {
@@ -106,7 +168,6 @@ Cache::Cache(const QString &userId, QObject *parent)
   , syncStateDb_{0}
   , roomsDb_{0}
   , invitesDb_{0}
-  , mediaDb_{0}
   , readReceiptsDb_{0}
   , notificationsDb_{0}
   , devicesDb_{0}
@@ -114,7 +175,13 @@ Cache::Cache(const QString &userId, QObject *parent)
   , inboundMegolmSessionDb_{0}
   , outboundMegolmSessionDb_{0}
   , localUserId_{userId}
+  , maxDbs_{MIN_MAX_DBS}
 {
+        QSettings settings;
+        messageRetention_ =
+          settings.value("user/message_retention", qulonglong(DEFAULT_MESSAGE_RETENTION))
+            .toULongLong();
+
         setup();
 }
 
@@ -131,11 +198,11 @@ Cache::setup()
                             .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
                             .arg(QString::fromUtf8(localUserId_.toUtf8().toHex()));
 
-        bool isInitial = !QFile::exists(statePath);
+        mediaDirectory_ = QString("%1/media/%2")
+                            .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
+                            .arg(QString::fromUtf8(localUserId_.toUtf8().toHex()));
 
-        env_ = lmdb::env::create();
-        env_.set_mapsize(256UL * 1024UL * 1024UL); /* 256 MB */
-        env_.set_max_dbs(1024UL);
+        bool isInitial = !QFile::exists(statePath);
 
         if (isInitial) {
                 nhlog::db()->info("initializing LMDB");
@@ -146,8 +213,105 @@ Cache::setup()
                 }
         }
 
+        openEnv(statePath);
+
+        media_ = std::make_unique<MediaStore>(mediaDirectory_, MEDIA_STORE_SIZE);
+
+        // The number of named databases grows with the number of rooms & devices,
+        // so the limit has to be raised accordingly before the environment is used.
+        const auto namedDbs = [this]() {
+                auto txn   = beginTxn(MDB_RDONLY);
+                auto total = lmdb::dbi::open(txn, nullptr).size(txn);
+                txn.abort();
+
+                return total;
+        }();
+
+        if (namedDbs * MAX_DBS_GROWTH_FACTOR > maxDbs_) {
+                maxDbs_ = namedDbs * MAX_DBS_GROWTH_FACTOR;
+
+                nhlog::db()->info("reopening LMDB with max_dbs {}", maxDbs_);
+                openEnv(statePath);
+        }
+
+        {
+                auto txn = beginTxn();
+                openDbs(txn);
+                txn.commit();
+        }
+
+        // Open the handles of the per-room & per-device databases once, so they
+        // can be reused by all the following transactions.
+        std::vector<std::string> names;
+        {
+                auto rtxn = beginTxn(MDB_RDONLY);
+                auto main = lmdb::dbi::open(rtxn, nullptr);
+
+                std::string name, unused;
+
+                auto cursor = lmdb::cursor::open(rtxn, main);
+                while (cursor.get(name, unused, MDB_NEXT))
+                        names.emplace_back(name);
+                cursor.close();
+
+                rtxn.abort();
+        }
+
+        cacheDbs(names);
+
+        buildRoomIndex();
+}
+
+void
+Cache::openDbs(lmdb::txn &txn)
+{
+        syncStateDb_     = lmdb::dbi::open(txn, SYNC_STATE_DB, MDB_CREATE);
+        roomsDb_         = lmdb::dbi::open(txn, ROOMS_DB, MDB_CREATE);
+        invitesDb_       = lmdb::dbi::open(txn, INVITES_DB, MDB_CREATE);
+        readReceiptsDb_  = lmdb::dbi::open(txn, READ_RECEIPTS_DB, MDB_CREATE);
+        notificationsDb_ = lmdb::dbi::open(txn, NOTIFICATIONS_DB, MDB_CREATE);
+
+        // Device management
+        devicesDb_    = lmdb::dbi::open(txn, DEVICES_DB, MDB_CREATE);
+        deviceKeysDb_ = lmdb::dbi::open(txn, DEVICE_KEYS_DB, MDB_CREATE);
+
+        // Session management
+        inboundMegolmSessionDb_  = lmdb::dbi::open(txn, INBOUND_MEGOLM_SESSIONS_DB, MDB_CREATE);
+        outboundMegolmSessionDb_ = lmdb::dbi::open(txn, OUTBOUND_MEGOLM_SESSIONS_DB, MDB_CREATE);
+
+        messageIndex_.open(txn);
+}
+
+void
+Cache::buildRoomIndex()
+{
+        roomIndex_.clear();
+
+        auto txn    = beginTxn(MDB_RDONLY);
+        auto cursor = lmdb::cursor::open(txn, roomsDb_);
+
+        lmdb::val room_id, room_data;
+        while (cursor.get(room_id, room_data, MDB_NEXT)) {
+                RoomInfo info;
+
+                if (cache::codec::decode(room_data, info))
+                        roomIndex_.insert(std::string(room_id.data(), room_id.size()), info.name);
+        }
+
+        cursor.close();
+        txn.commit();
+}
+
+void
+Cache::openEnv(const QString &statePath)
+{
+        env_ = lmdb::env::create();
+        env_.set_mapsize(INITIAL_MAP_SIZE);
+        env_.set_max_dbs(maxDbs_);
+        env_.set_max_readers(MAX_READERS);
+
         try {
-                env_.open(statePath.toStdString().c_str());
+                env_.open(statePath.toStdString().c_str(), MDB_NOTLS);
         } catch (const lmdb::error &e) {
                 if (e.code() != MDB_VERSION_MISMATCH && e.code() != MDB_INVALID) {
                         throw std::runtime_error("LMDB initialization failed" +
@@ -164,26 +328,391 @@ Cache::setup()
                                   ("Unable to delete file " + file).toStdString().c_str());
                 }
 
-                env_.open(statePath.toStdString().c_str());
+                env_.open(statePath.toStdString().c_str(), MDB_NOTLS);
         }
+}
 
-        auto txn         = lmdb::txn::begin(env_);
-        syncStateDb_     = lmdb::dbi::open(txn, SYNC_STATE_DB, MDB_CREATE);
-        roomsDb_         = lmdb::dbi::open(txn, ROOMS_DB, MDB_CREATE);
-        invitesDb_       = lmdb::dbi::open(txn, INVITES_DB, MDB_CREATE);
-        mediaDb_         = lmdb::dbi::open(txn, MEDIA_DB, MDB_CREATE);
-        readReceiptsDb_  = lmdb::dbi::open(txn, READ_RECEIPTS_DB, MDB_CREATE);
-        notificationsDb_ = lmdb::dbi::open(txn, NOTIFICATIONS_DB, MDB_CREATE);
+lmdb::dbi
+Cache::openDb(lmdb::txn &txn, const std::string &name)
+{
+        {
+                std::unique_lock<std::mutex> lock(dbisMtx_);
 
-        // Device management
-        devicesDb_    = lmdb::dbi::open(txn, DEVICES_DB, MDB_CREATE);
-        deviceKeysDb_ = lmdb::dbi::open(txn, DEVICE_KEYS_DB, MDB_CREATE);
+                auto it = dbis_.find(name);
+                if (it != dbis_.end())
+                        return lmdb::dbi{it->second};
+        }
 
-        // Session management
-        inboundMegolmSessionDb_  = lmdb::dbi::open(txn, INBOUND_MEGOLM_SESSIONS_DB, MDB_CREATE);
-        outboundMegolmSessionDb_ = lmdb::dbi::open(txn, OUTBOUND_MEGOLM_SESSIONS_DB, MDB_CREATE);
+        // The handle isn't known yet, so it will only be valid for this transaction.
+        return lmdb::dbi::open(txn, name.c_str(), MDB_CREATE);
+}
+
+void
+Cache::cacheDbs(const std::vector<std::string> &names)
+{
+        std::vector<std::string> missing;
+        std::size_t total = 0;
+        std::size_t limit = 0;
+        bool isFull       = false;
+        {
+                std::unique_lock<std::mutex> lock(dbisMtx_);
+
+                for (const auto &name : names) {
+                        if (dbis_.find(name) == dbis_.end())
+                                missing.emplace_back(name);
+                }
+
+                if (missing.empty())
+                        return;
+
+                total  = dbis_.size() + missing.size();
+                limit  = maxDbs_;
+                isFull = total + MAX_DBS_HEADROOM >= limit;
+        }
+
+        if (isFull && !growMaxDbs(total))
+                nhlog::db()->warn("approaching the limit of named databases ({}/{})",
+                                  total,
+                                  limit);
+
+        // Handles are only valid outside of the transaction that opened them
+        // if that transaction is committed.
+        std::vector<std::pair<std::string, MDB_dbi>> opened;
+
+        auto txn = beginTxn();
+        for (const auto &name : missing) {
+                auto db = lmdb::dbi::open(txn, name.c_str(), MDB_CREATE);
+                opened.emplace_back(name, db.handle());
+        }
+        txn.commit();
+
+        std::unique_lock<std::mutex> lock(dbisMtx_);
+        for (const auto &db : opened)
+                dbis_[db.first] = db.second;
+}
+
+void
+Cache::cacheRoomDbs(const std::vector<std::string> &rooms,
+                    const std::vector<std::string> &invites)
+{
+        std::vector<std::string> names;
+        names.reserve(rooms.size() * 3 + invites.size() * 2);
+
+        for (const auto &room_id : rooms) {
+                names.emplace_back(room_id + "/state");
+                names.emplace_back(room_id + "/members");
+                names.emplace_back(room_id + "/messages");
+        }
+
+        for (const auto &room_id : invites) {
+                names.emplace_back(room_id + "/invite_state");
+                names.emplace_back(room_id + "/invite_members");
+        }
+
+        cacheDbs(names);
+}
+
+bool
+Cache::growMaxDbs(std::size_t namedDbs)
+{
+        if (MapLock::isHeld(mapMtx_)) {
+                nhlog::db()->critical("can't raise max_dbs while the thread holds a transaction");
+                return false;
+        }
+
+        std::unique_lock<std::shared_timed_mutex> lock(mapMtx_, std::defer_lock);
+
+        if (!lock.try_lock_for(MAP_RESIZE_TIMEOUT)) {
+                nhlog::db()->critical("timed out waiting for transactions to raise max_dbs");
+                return false;
+        }
+
+        std::vector<std::string> names;
+        {
+                std::unique_lock<std::mutex> dbisLock(dbisMtx_);
+
+                // Raised by another thread in the meantime.
+                if (namedDbs + MAX_DBS_HEADROOM < maxDbs_)
+                        return true;
+
+                for (const auto &db : dbis_)
+                        names.emplace_back(db.first);
+
+                dbis_.clear();
+                maxDbs_ = std::max(namedDbs, names.size()) * MAX_DBS_GROWTH_FACTOR;
+        }
+
+        // The pooled transactions belong to the environment that is closed.
+        {
+                std::unique_lock<std::mutex> poolLock(readTxnsMtx_);
+                idleReadTxns_.clear();
+        }
+
+        MDB_envinfo info;
+        lmdb::env_info(env_, &info);
+
+        nhlog::db()->info("reopening LMDB with max_dbs {}", maxDbs_);
+
+        try {
+                openEnv(cacheDirectory_);
+                env_.set_mapsize(info.me_mapsize);
+
+                // The handles of the previous environment are all invalid. The map is
+                // locked exclusively, so the transaction can't go through beginTxn.
+                std::vector<std::pair<std::string, MDB_dbi>> opened;
+
+                auto txn = lmdb::txn::begin(env_);
+                openDbs(txn);
+                for (const auto &name : names) {
+                        auto db = lmdb::dbi::open(txn, name.c_str(), MDB_CREATE);
+                        opened.emplace_back(name, db.handle());
+                }
+                txn.commit();
+
+                std::unique_lock<std::mutex> dbisLock(dbisMtx_);
+                for (const auto &db : opened)
+                        dbis_[db.first] = db.second;
+        } catch (const lmdb::error &e) {
+                nhlog::db()->critical("failed to reopen LMDB: {}", e.what());
+                throw;
+        }
+
+        return true;
+}
+
+void
+Cache::forgetRoomDbs(const std::vector<std::string> &rooms,
+                     const std::vector<std::string> &invites)
+{
+        std::vector<std::string> names;
+        names.reserve(rooms.size() * 2 + invites.size() * 2);
+
+        for (const auto &room_id : rooms) {
+                names.emplace_back(room_id + "/state");
+                names.emplace_back(room_id + "/members");
+        }
+
+        for (const auto &room_id : invites) {
+                names.emplace_back(room_id + "/invite_state");
+                names.emplace_back(room_id + "/invite_members");
+        }
+
+        forgetDbs(names);
+}
+
+void
+Cache::forgetDbs(const std::vector<std::string> &names)
+{
+        std::unique_lock<std::mutex> lock(dbisMtx_);
+
+        for (const auto &name : names)
+                dbis_.erase(name);
+}
+
+namespace {
+//! The read transactions used by the snapshots of the current thread, by cache. An entry
+//! only lives as long as the outermost snapshot, so nothing is left behind when a thread
+//! exits.
+using ThreadReadTxns = std::vector<std::pair<const Cache *, std::unique_ptr<ReadTxnSlot>>>;
+thread_local ThreadReadTxns threadReadTxns;
+
+ThreadReadTxns::iterator
+findThreadReadTxn(const Cache *cache)
+{
+        return std::find_if(threadReadTxns.begin(),
+                            threadReadTxns.end(),
+                            [cache](const auto &entry) { return entry.first == cache; });
+}
+}
+
+ReadSnapshot::ReadSnapshot(const Cache *cache)
+  : cache_{cache}
+{
+        auto it = findThreadReadTxn(cache);
+
+        if (it == threadReadTxns.end()) {
+                threadReadTxns.emplace_back(cache, cache->acquireReadTxn());
+                it = std::prev(threadReadTxns.end());
+        }
+
+        slot_ = it->second.get();
+        slot_->depth += 1;
+}
+
+ReadSnapshot::~ReadSnapshot()
+{
+        slot_->depth -= 1;
+
+        if (slot_->depth > 0)
+                return;
+
+        auto it   = findThreadReadTxn(cache_);
+        auto slot = std::move(it->second);
+        threadReadTxns.erase(it);
+
+        slot->txn.reset();
+        slot->mapLock.unlock();
+
+        cache_->releaseReadTxn(std::move(slot));
+}
+
+std::unique_ptr<ReadTxnSlot>
+Cache::acquireReadTxn() const
+{
+        MapLock lock(mapMtx_);
+
+        std::unique_ptr<ReadTxnSlot> slot;
+        {
+                std::unique_lock<std::mutex> poolLock(readTxnsMtx_);
+
+                if (!idleReadTxns_.empty()) {
+                        slot = std::move(idleReadTxns_.back());
+                        idleReadTxns_.pop_back();
+                }
+        }
+
+        if (slot)
+                slot->txn.renew();
+        else
+                slot = std::make_unique<ReadTxnSlot>(
+                  lmdb::txn::begin(env_, nullptr, MDB_RDONLY));
+
+        slot->mapLock = std::move(lock);
+
+        return slot;
+}
+
+void
+Cache::releaseReadTxn(std::unique_ptr<ReadTxnSlot> slot) const
+{
+        {
+                std::unique_lock<std::mutex> lock(readTxnsMtx_);
+
+                if (idleReadTxns_.size() < MAX_IDLE_READ_TXNS) {
+                        idleReadTxns_.emplace_back(std::move(slot));
+                        return;
+                }
+        }
+
+        slot->txn.abort();
+}
+
+GuardedTxn
+Cache::beginTxn(unsigned int flags) const
+{
+        MapLock lock(mapMtx_);
+        return GuardedTxn(std::move(lock), lmdb::txn::begin(env_, nullptr, flags));
+}
+
+bool
+Cache::growMap()
+{
+        if (MapLock::isHeld(mapMtx_)) {
+                nhlog::db()->critical("can't grow the map while the thread holds a transaction");
+                return false;
+        }
+
+        std::unique_lock<std::shared_timed_mutex> lock(mapMtx_, std::defer_lock);
+
+        if (!lock.try_lock_for(MAP_RESIZE_TIMEOUT)) {
+                nhlog::db()->critical("timed out waiting for transactions to grow the map");
+                return false;
+        }
+
+        MDB_envinfo info;
+        lmdb::env_info(env_, &info);
+
+        if (info.me_mapsize >= MAX_MAP_SIZE) {
+                nhlog::db()->critical("the cache reached its maximum size: {} bytes",
+                                      info.me_mapsize);
+                return false;
+        }
+
+        const auto newSize = std::min(info.me_mapsize * MAP_GROWTH_FACTOR, MAX_MAP_SIZE);
+
+        try {
+                env_.set_mapsize(newSize);
+        } catch (const lmdb::error &e) {
+                nhlog::db()->critical("failed to grow the map: {}", e.what());
+                return false;
+        }
+
+        nhlog::db()->info("grew the map from {} to {} bytes", info.me_mapsize, newSize);
+
+        lock.unlock();
+
+        try {
+                const auto usage = stats();
+
+                nhlog::db()->info("cache usage: {} used & {} free pages of {} bytes",
+                                  usage.used_pages,
+                                  usage.free_pages,
+                                  usage.page_size);
+
+                for (const auto &db : usage.dbs)
+                        nhlog::db()->debug(
+                          "{}: {} entries, {} pages", db.name, db.entries, db.pages);
+        } catch (const lmdb::error &e) {
+                nhlog::db()->warn("failed to collect cache statistics: {}", e.what());
+        }
+
+        return true;
+}
+
+CacheStats
+Cache::stats()
+{
+        CacheStats result;
+
+        auto txn = beginTxn(MDB_RDONLY);
+
+        MDB_envinfo info;
+        lmdb::env_info(env_, &info);
+
+        MDB_stat envStat;
+        lmdb::env_stat(env_, &envStat);
+
+        result.map_size  = info.me_mapsize;
+        result.page_size = envStat.ms_psize;
+
+        // The free list is stored in the internal database 0. Each record holds
+        // the number of free pages followed by their page numbers.
+        {
+                lmdb::val key, value;
+
+                auto cursor = lmdb::cursor::open(txn, 0);
+                while (cursor.get(key, value, MDB_NEXT))
+                        result.free_pages += *reinterpret_cast<const std::size_t *>(value.data());
+                cursor.close();
+        }
+
+        result.used_pages = info.me_last_pgno + 1 - result.free_pages;
+
+        std::vector<std::string> names;
+        {
+                auto main = lmdb::dbi::open(txn, nullptr);
+
+                std::string name, unused;
+
+                auto cursor = lmdb::cursor::open(txn, main);
+                while (cursor.get(name, unused, MDB_NEXT))
+                        names.emplace_back(name);
+                cursor.close();
+        }
+
+        for (const auto &name : names) {
+                auto db         = openDb(txn, name);
+                const auto stat = db.stat(txn);
+
+                result.dbs.push_back(
+                  DbStats{name,
+                          stat.ms_entries,
+                          stat.ms_branch_pages + stat.ms_leaf_pages + stat.ms_overflow_pages});
+        }
 
         txn.commit();
+
+        return result;
 }
 
 void
@@ -191,7 +720,7 @@ Cache::setEncryptedRoom(lmdb::txn &txn, const std::string &room_id)
 {
         nhlog::db()->info("mark room {} as encrypted", room_id);
 
-        auto db = lmdb::dbi::open(txn, ENCRYPTED_ROOMS_DB, MDB_CREATE);
+        auto db = openDb(txn, ENCRYPTED_ROOMS_DB);
         lmdb::dbi_put(txn, db, lmdb::val(room_id), lmdb::val("0"));
 }
 
@@ -200,8 +729,8 @@ Cache::isRoomEncrypted(const std::string &room_id)
 {
         lmdb::val unused;
 
-        auto txn = lmdb::txn::begin(env_);
-        auto db  = lmdb::dbi::open(txn, ENCRYPTED_ROOMS_DB, MDB_CREATE);
+        auto txn = beginTxn();
+        auto db  = openDb(txn, ENCRYPTED_ROOMS_DB);
         auto res = lmdb::dbi_get(txn, db, lmdb::val(room_id), unused);
         txn.commit();
 
@@ -224,7 +753,7 @@ Cache::saveInboundMegolmSession(const MegolmSessionIndex &index,
         const auto key     = index.to_hash();
         const auto pickled = pickle<InboundSessionObject>(session.get(), SECRET);
 
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
         lmdb::dbi_put(txn, inboundMegolmSessionDb_, lmdb::val(key), lmdb::val(pickled));
         txn.commit();
 
@@ -270,12 +799,11 @@ Cache::updateOutboundMegolmSession(const std::string &room_id, int message_index
         }
 
         // Save the updated pickled data for the session.
-        json j;
-        j["data"]    = data;
-        j["session"] = pickle<OutboundSessionObject>(session, SECRET);
+        const auto record =
+          cache::codec::encode(data, pickle<OutboundSessionObject>(session, SECRET));
 
-        auto txn = lmdb::txn::begin(env_);
-        lmdb::dbi_put(txn, outboundMegolmSessionDb_, lmdb::val(room_id), lmdb::val(j.dump()));
+        auto txn = beginTxn();
+        lmdb::dbi_put(txn, outboundMegolmSessionDb_, lmdb::val(room_id), lmdb::val(record));
         txn.commit();
 }
 
@@ -286,13 +814,10 @@ Cache::saveOutboundMegolmSession(const std::string &room_id,
 {
         using namespace mtx::crypto;
         const auto pickled = pickle<OutboundSessionObject>(session.get(), SECRET);
+        const auto record  = cache::codec::encode(data, pickled);
 
-        json j;
-        j["data"]    = data;
-        j["session"] = pickled;
-
-        auto txn = lmdb::txn::begin(env_);
-        lmdb::dbi_put(txn, outboundMegolmSessionDb_, lmdb::val(room_id), lmdb::val(j.dump()));
+        auto txn = beginTxn();
+        lmdb::dbi_put(txn, outboundMegolmSessionDb_, lmdb::val(room_id), lmdb::val(record));
         txn.commit();
 
         {
@@ -329,7 +854,9 @@ Cache::saveOlmSession(const std::string &curve25519, mtx::crypto::OlmSessionPtr
 {
         using namespace mtx::crypto;
 
-        auto txn = lmdb::txn::begin(env_);
+        cacheDbs({"olm_sessions/" + curve25519});
+
+        auto txn = beginTxn();
         auto db  = getOlmSessionsDb(txn, curve25519);
 
         const auto pickled    = pickle<SessionObject>(session.get(), SECRET);
@@ -345,7 +872,7 @@ Cache::getOlmSession(const std::string &curve25519, const std::string &session_i
 {
         using namespace mtx::crypto;
 
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
         auto db  = getOlmSessionsDb(txn, curve25519);
 
         lmdb::val pickled;
@@ -366,7 +893,7 @@ Cache::getOlmSessions(const std::string &curve25519)
 {
         using namespace mtx::crypto;
 
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
         auto db  = getOlmSessionsDb(txn, curve25519);
 
         std::string session_id, unused;
@@ -385,7 +912,7 @@ Cache::getOlmSessions(const std::string &curve25519)
 void
 Cache::saveOlmAccount(const std::string &data)
 {
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
         lmdb::dbi_put(txn, syncStateDb_, OLM_ACCOUNT_KEY, lmdb::val(data));
         txn.commit();
 }
@@ -395,7 +922,7 @@ Cache::restoreSessions()
 {
         using namespace mtx::crypto;
 
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        auto txn = beginTxn(MDB_RDONLY);
         std::string key, value;
 
         //
@@ -414,23 +941,20 @@ Cache::restoreSessions()
         // Outbound Megolm Sessions
         //
         {
-                auto cursor = lmdb::cursor::open(txn, outboundMegolmSessionDb_);
-                while (cursor.get(key, value, MDB_NEXT)) {
-                        json obj;
-
-                        try {
-                                obj = json::parse(value);
-
-                                session_storage.group_outbound_session_data[key] =
-                                  obj.at("data").get<OutboundGroupSessionData>();
+                auto cursor = lmdb::cursor::open(txn, outboundMegolmSessionDb_);
+                while (cursor.get(key, value, MDB_NEXT)) {
+                        OutboundGroupSessionData data;
+                        std::string pickled;
 
-                                auto session =
-                                  unpickle<OutboundSessionObject>(obj.at("session"), SECRET);
-                                session_storage.group_outbound_sessions[key] = std::move(session);
-                        } catch (const nlohmann::json::exception &e) {
+                        if (!cache::codec::decode(value.data(), value.size(), data, pickled)) {
                                 nhlog::db()->critical(
-                                  "failed to parse outbound megolm session data: {}", e.what());
+                                  "failed to parse outbound megolm session data: {}", key);
+                                continue;
                         }
+
+                        session_storage.group_outbound_session_data[key] = data;
+                        session_storage.group_outbound_sessions[key] =
+                          unpickle<OutboundSessionObject>(pickled, SECRET);
                 }
                 cursor.close();
         }
@@ -443,7 +967,7 @@ Cache::restoreSessions()
 std::string
 Cache::restoreOlmAccount()
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        auto txn = beginTxn(MDB_RDONLY);
         lmdb::val pickled;
         lmdb::dbi_get(txn, syncStateDb_, OLM_ACCOUNT_KEY, pickled);
         txn.commit();
@@ -458,18 +982,8 @@ Cache::restoreOlmAccount()
 void
 Cache::saveImage(const std::string &url, const std::string &img_data)
 {
-        if (url.empty() || img_data.empty())
-                return;
-
         try {
-                auto txn = lmdb::txn::begin(env_);
-
-                lmdb::dbi_put(txn,
-                              mediaDb_,
-                              lmdb::val(url.data(), url.size()),
-                              lmdb::val(img_data.data(), img_data.size()));
-
-                txn.commit();
+                media_->save(url, img_data);
         } catch (const lmdb::error &e) {
                 nhlog::db()->critical("saveImage: {}", e.what());
         }
@@ -482,66 +996,47 @@ Cache::saveImage(const QString &url, const QByteArray &image)
 }
 
 QByteArray
-Cache::image(lmdb::txn &txn, const std::string &url) const
+Cache::image(const std::string &url) const
 {
-        if (url.empty())
-                return QByteArray();
-
         try {
-                lmdb::val image;
-                bool res = lmdb::dbi_get(txn, mediaDb_, lmdb::val(url), image);
-
-                if (!res)
-                        return QByteArray();
-
-                return QByteArray(image.data(), image.size());
+                return media_->get(url);
         } catch (const lmdb::error &e) {
-                nhlog::db()->critical("image: {}, {}", e.what(), url);
+                nhlog::db()->critical("image: {} {}", e.what(), url);
         }
 
         return QByteArray();
 }
 
-QByteArray
-Cache::image(const QString &url) const
+QImage
+Cache::decodeImage(const std::string &url) const
 {
-        if (url.isEmpty())
-                return QByteArray();
-
-        auto key = url.toUtf8();
-
         try {
-                auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-
-                lmdb::val image;
-
-                bool res = lmdb::dbi_get(txn, mediaDb_, lmdb::val(key.data(), key.size()), image);
-
-                txn.commit();
-
-                if (!res)
-                        return QByteArray();
-
-                return QByteArray(image.data(), image.size());
+                return media_->decodeImage(url);
         } catch (const lmdb::error &e) {
-                nhlog::db()->critical("image: {} {}", e.what(), url.toStdString());
+                nhlog::db()->critical("decodeImage: {} {}", e.what(), url);
         }
 
-        return QByteArray();
+        return QImage();
 }
 
 void
 Cache::removeInvite(lmdb::txn &txn, const std::string &room_id)
 {
-        lmdb::dbi_del(txn, invitesDb_, lmdb::val(room_id), nullptr);
-        lmdb::dbi_drop(txn, getInviteStatesDb(txn, room_id), true);
-        lmdb::dbi_drop(txn, getInviteMembersDb(txn, room_id), true);
+        // Called for every joined room, most of which were never invites. Opening
+        // their databases would create them.
+        if (!lmdb::dbi_del(txn, invitesDb_, lmdb::val(room_id), nullptr))
+                return;
+
+        forgetRoomDbs({}, {room_id});
+
+        lmdb::dbi_drop(txn, getInviteStatesDb(txn, room_id), false);
+        lmdb::dbi_drop(txn, getInviteMembersDb(txn, room_id), false);
 }
 
 void
 Cache::removeInvite(const std::string &room_id)
 {
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
         removeInvite(txn, room_id);
         txn.commit();
 }
@@ -550,16 +1045,24 @@ void
 Cache::removeRoom(lmdb::txn &txn, const std::string &roomid)
 {
         lmdb::dbi_del(txn, roomsDb_, lmdb::val(roomid), nullptr);
-        lmdb::dbi_drop(txn, getStatesDb(txn, roomid), true);
-        lmdb::dbi_drop(txn, getMembersDb(txn, roomid), true);
+
+        forgetRoomDbs({roomid}, {});
+
+        lmdb::dbi_drop(txn, getStatesDb(txn, roomid), false);
+        lmdb::dbi_drop(txn, getMembersDb(txn, roomid), false);
+
+        messageIndex_.removeRoom(txn, roomid);
 }
 
 void
 Cache::removeRoom(const std::string &roomid)
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, 0);
+        auto txn = beginTxn();
         lmdb::dbi_del(txn, roomsDb_, lmdb::val(roomid), nullptr);
+        messageIndex_.removeRoom(txn, roomid);
         txn.commit();
+
+        roomIndex_.remove(roomid);
 }
 
 void
@@ -577,25 +1080,22 @@ Cache::setNextBatchToken(lmdb::txn &txn, const QString &token)
 bool
 Cache::isInitialized() const
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn = snapshot.txn();
         lmdb::val token;
 
-        bool res = lmdb::dbi_get(txn, syncStateDb_, NEXT_BATCH_KEY, token);
-
-        txn.commit();
-
-        return res;
+        return lmdb::dbi_get(txn, syncStateDb_, NEXT_BATCH_KEY, token);
 }
 
 std::string
 Cache::nextBatchToken() const
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn = snapshot.txn();
         lmdb::val token;
 
-        lmdb::dbi_get(txn, syncStateDb_, NEXT_BATCH_KEY, token);
-
-        txn.commit();
+        if (!lmdb::dbi_get(txn, syncStateDb_, NEXT_BATCH_KEY, token))
+                return std::string();
 
         return std::string(token.data(), token.size());
 }
@@ -606,14 +1106,21 @@ Cache::deleteData()
         // TODO: We need to remove the env_ while not accepting new requests.
         if (!cacheDirectory_.isEmpty()) {
                 QDir(cacheDirectory_).removeRecursively();
+                QDir(mediaDirectory_).removeRecursively();
                 nhlog::db()->info("deleted cache files from disk");
         }
+
+        roomIndex_.clear();
+
+        std::unique_lock<std::mutex> lock(memberOrdersMtx_);
+        memberOrdersVersion_ += 1;
+        memberOrders_.clear();
 }
 
 bool
 Cache::isFormatValid()
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        auto txn = beginTxn(MDB_RDONLY);
 
         lmdb::val current_version;
         bool res = lmdb::dbi_get(txn, syncStateDb_, CACHE_FORMAT_VERSION_KEY, current_version);
@@ -638,7 +1145,7 @@ Cache::isFormatValid()
 void
 Cache::setCurrentFormat()
 {
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
 
         lmdb::dbi_put(
           txn,
@@ -649,28 +1156,272 @@ Cache::setCurrentFormat()
         txn.commit();
 }
 
+bool
+Cache::runMigrations()
+{
+        using Migration = void (Cache::*)(lmdb::txn &);
+
+        // Each entry upgrades the cache from the given format to the next one.
+        const std::vector<std::pair<std::string, Migration>> migrations{
+          {JSON_CACHE_FORMAT_VERSION, &Cache::migrateToBinaryRecords},
+          {STRING_MESSAGE_KEYS_FORMAT_VERSION, &Cache::migrateMessageKeys},
+          {MEDIA_IN_STATE_FORMAT_VERSION, &Cache::dropStateMedia},
+          {JSON_RECEIPT_KEYS_FORMAT_VERSION, &Cache::migrateReceiptKeys},
+          {UNINDEXED_MESSAGES_FORMAT_VERSION, &Cache::indexStoredMessages},
+          {INDEX_WITHOUT_EVENTS_FORMAT_VERSION, &Cache::indexMessageEventIds},
+          {INDEXED_EVENTS_FORMAT_VERSION, &Cache::mapMessageEventIds},
+          {INDEX_WITHOUT_WORDS_FORMAT_VERSION, &Cache::indexMessageWords},
+        };
+
+        auto txn = beginTxn();
+
+        lmdb::val current_version;
+        if (!lmdb::dbi_get(txn, syncStateDb_, CACHE_FORMAT_VERSION_KEY, current_version)) {
+                txn.abort();
+                return false;
+        }
+
+        const std::string stored_version(current_version.data(), current_version.size());
+
+        auto it = std::find_if(
+          migrations.begin(), migrations.end(), [&stored_version](const auto &migration) {
+                  return migration.first == stored_version;
+          });
+
+        if (it == migrations.end()) {
+                txn.abort();
+                return false;
+        }
+
+        try {
+                for (; it != migrations.end(); ++it) {
+                        nhlog::db()->info("migrating cache from format {}", it->first);
+                        (this->*(it->second))(txn);
+                }
+
+                lmdb::dbi_put(txn,
+                              syncStateDb_,
+                              CACHE_FORMAT_VERSION_KEY,
+                              lmdb::val(CURRENT_CACHE_FORMAT_VERSION.data(),
+                                        CURRENT_CACHE_FORMAT_VERSION.size()));
+
+                txn.commit();
+        } catch (const lmdb::error &e) {
+                nhlog::db()->critical("failed to migrate cache: {}", e.what());
+                return false;
+        }
+
+        nhlog::db()->info("cache migrated to format {}", CURRENT_CACHE_FORMAT_VERSION);
+
+        return true;
+}
+
+std::vector<std::string>
+Cache::roomIds(lmdb::txn &txn, lmdb::dbi &db)
+{
+        std::vector<std::string> rooms;
+        std::string room_id, unused;
+
+        auto cursor = lmdb::cursor::open(txn, db);
+        while (cursor.get(room_id, unused, MDB_NEXT))
+                rooms.emplace_back(room_id);
+        cursor.close();
+
+        return rooms;
+}
+
+void
+Cache::migrateToBinaryRecords(lmdb::txn &txn)
+{
+        const auto rooms   = roomIds(txn, roomsDb_);
+        const auto invites = roomIds(txn, invitesDb_);
+
+        migrateRecords<RoomInfo>(txn, roomsDb_);
+        migrateRecords<RoomInfo>(txn, invitesDb_);
+        migrateRecords<std::map<std::string, uint64_t>>(txn, readReceiptsDb_);
+
+        for (const auto &room : rooms) {
+                auto membersdb = getMembersDb(txn, room);
+                migrateRecords<MemberInfo>(txn, membersdb);
+        }
+
+        for (const auto &room : invites) {
+                auto membersdb = getInviteMembersDb(txn, room);
+                migrateRecords<MemberInfo>(txn, membersdb);
+        }
+
+        // The outbound sessions hold both the session data & the pickled session.
+        std::vector<std::pair<std::string, std::string>> sessions;
+        lmdb::val key, value;
+
+        auto cursor = lmdb::cursor::open(txn, outboundMegolmSessionDb_);
+        while (cursor.get(key, value, MDB_NEXT)) {
+                OutboundGroupSessionData data;
+                std::string pickled;
+
+                if (cache::codec::isLegacyRecord(value) &&
+                    cache::codec::decode(value.data(), value.size(), data, pickled))
+                        sessions.emplace_back(std::string(key.data(), key.size()),
+                                              cache::codec::encode(data, pickled));
+        }
+        cursor.close();
+
+        for (const auto &s : sessions)
+                lmdb::dbi_put(
+                  txn, outboundMegolmSessionDb_, lmdb::val(s.first), lmdb::val(s.second));
+}
+
+void
+Cache::migrateMessageKeys(lmdb::txn &txn)
+{
+        for (const auto &room : roomIds(txn, roomsDb_)) {
+                auto db = getMessagesDb(txn, room);
+
+                std::vector<std::pair<std::string, std::string>> messages;
+                lmdb::val key, value;
+
+                // Walking the database in order doesn't involve any key comparisons,
+                // so the old keys can be read without their comparison function.
+                auto cursor = lmdb::cursor::open(txn, db);
+                while (cursor.get(key, value, MDB_NEXT)) {
+                        std::string msg(value.data(), value.size());
+
+                        try {
+                                const auto ts = std::stoull(std::string(key.data(), key.size()));
+                                const auto event_id =
+                                  json::parse(msg).at("event").at("event_id").get<std::string>();
+
+                                messages.emplace_back(cache::codec::messageKey(ts, event_id),
+                                                      std::move(msg));
+                        } catch (const std::exception &e) {
+                                nhlog::db()->warn("dropping unreadable message in {}: {}",
+                                                  room,
+                                                  e.what());
+                        }
+                }
+                cursor.close();
+
+                lmdb::dbi_drop(txn, db, false);
+
+                for (const auto &m : messages)
+                        lmdb::dbi_put(txn, db, lmdb::val(m.first), lmdb::val(m.second));
+        }
+}
+
+void
+Cache::dropStateMedia(lmdb::txn &txn)
+{
+        try {
+                auto mediaDb = lmdb::dbi::open(txn, "media");
+                lmdb::dbi_drop(txn, mediaDb, true);
+        } catch (const lmdb::error &e) {
+                if (e.code() != MDB_NOTFOUND)
+                        throw;
+        }
+}
+
+void
+Cache::migrateReceiptKeys(lmdb::txn &txn)
+{
+        auto migrate = [&txn](lmdb::dbi db) {
+                std::vector<std::pair<std::string, std::string>> records;
+
+                std::string key, value;
+
+                auto cursor = lmdb::cursor::open(txn, db);
+                while (cursor.get(key, value, MDB_NEXT)) {
+                        try {
+                                const ReadReceiptKey receipt = json::parse(key);
+                                records.emplace_back(
+                                  cache::codec::receiptKey(receipt.room_id, receipt.event_id),
+                                  value);
+                        } catch (const json::exception &e) {
+                                nhlog::db()->warn("dropping receipt with invalid key: {}",
+                                                  e.what());
+                        }
+                }
+                cursor.close();
+
+                lmdb::dbi_drop(txn, db, false);
+
+                for (const auto &r : records)
+                        lmdb::dbi_put(txn, db, lmdb::val(r.first), lmdb::val(r.second));
+        };
+
+        migrate(readReceiptsDb_);
+        migrate(getPendingReceiptsDb(txn));
+}
+
+void
+Cache::indexStoredMessages(lmdb::txn &txn)
+{
+        for (const auto &room : roomIds(txn, roomsDb_)) {
+                std::string key, msg;
+
+                auto cursor = lmdb::cursor::open(txn, getMessagesDb(txn, room));
+                while (cursor.get(key, msg, MDB_NEXT)) {
+                        try {
+                                mtx::events::collections::TimelineEvent event;
+                                mtx::events::collections::from_json(json::parse(msg).at("event"),
+                                                                    event);
+
+                                const auto body = utils::event_body(event.data);
+                                if (!body.isEmpty())
+                                        messageIndex_.add(txn, room, key, body);
+                        } catch (const json::exception &e) {
+                                nhlog::db()->warn("not indexing unreadable message in {}: {}",
+                                                  room,
+                                                  e.what());
+                        }
+                }
+                cursor.close();
+        }
+}
+
+void
+Cache::indexMessageEventIds(lmdb::txn &txn)
+{
+        messageIndex_.indexEventIds(txn);
+}
+
+void
+Cache::mapMessageEventIds(lmdb::txn &txn)
+{
+        for (const auto &room : roomIds(txn, roomsDb_)) {
+                std::string key, unused;
+
+                auto cursor = lmdb::cursor::open(txn, getMessagesDb(txn, room));
+                while (cursor.get(key, unused, MDB_NEXT))
+                        messageIndex_.addEvent(txn, room, key);
+                cursor.close();
+        }
+}
+
+void
+Cache::indexMessageWords(lmdb::txn &txn)
+{
+        messageIndex_.indexWords(txn);
+}
+
 std::vector<QString>
 Cache::pendingReceiptsEvents(lmdb::txn &txn, const std::string &room_id)
 {
         auto db = getPendingReceiptsDb(txn);
 
-        std::string key, unused;
+        const auto prefix = cache::codec::receiptKeyPrefix(room_id);
         std::vector<QString> pending;
 
+        lmdb::val key(prefix), unused;
+
         auto cursor = lmdb::cursor::open(txn, db);
-        while (cursor.get(key, unused, MDB_NEXT)) {
-                ReadReceiptKey receipt;
-                try {
-                        receipt = json::parse(key);
-                } catch (const nlohmann::json::exception &e) {
-                        nhlog::db()->warn("pendingReceiptsEvents: {}", e.what());
-                        continue;
-                }
+        bool found  = cursor.get(key, unused, MDB_SET_RANGE);
+        while (found && key.size() >= prefix.size() &&
+               std::equal(prefix.begin(), prefix.end(), key.data())) {
+                pending.emplace_back(QString::fromUtf8(key.data() + prefix.size(),
+                                                       key.size() - prefix.size()));
 
-                if (receipt.room_id == room_id)
-                        pending.emplace_back(QString::fromStdString(receipt.event_id));
+                found = cursor.get(key, unused, MDB_NEXT);
         }
-
         cursor.close();
 
         return pending;
@@ -681,11 +1432,9 @@ Cache::removePendingReceipt(lmdb::txn &txn, const std::string &room_id, const st
 {
         auto db = getPendingReceiptsDb(txn);
 
-        ReadReceiptKey receipt_key{event_id, room_id};
-        auto key = json(receipt_key).dump();
-
         try {
-                lmdb::dbi_del(txn, db, lmdb::val(key.data(), key.size()), nullptr);
+                lmdb::dbi_del(
+                  txn, db, lmdb::val(cache::codec::receiptKey(room_id, event_id)), nullptr);
         } catch (const lmdb::error &e) {
                 nhlog::db()->critical("removePendingReceipt: {}", e.what());
         }
@@ -694,18 +1443,13 @@ Cache::removePendingReceipt(lmdb::txn &txn, const std::string &room_id, const st
 void
 Cache::addPendingReceipt(const QString &room_id, const QString &event_id)
 {
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
         auto db  = getPendingReceiptsDb(txn);
 
-        ReadReceiptKey receipt_key{event_id.toStdString(), room_id.toStdString()};
-        auto key = json(receipt_key).dump();
-        std::string empty;
+        const auto key = cache::codec::receiptKey(room_id.toStdString(), event_id.toStdString());
 
         try {
-                lmdb::dbi_put(txn,
-                              db,
-                              lmdb::val(key.data(), key.size()),
-                              lmdb::val(empty.data(), empty.size()));
+                lmdb::dbi_put(txn, db, lmdb::val(key), lmdb::val(""));
         } catch (const lmdb::error &e) {
                 nhlog::db()->critical("addPendingReceipt: {}", e.what());
         }
@@ -714,49 +1458,49 @@ Cache::addPendingReceipt(const QString &room_id, const QString &event_id)
 }
 
 CachedReceipts
-Cache::readReceipts(const QString &event_id, const QString &room_id)
+Cache::readReceipts(lmdb::txn &txn, const std::string &event_id, const std::string &room_id)
 {
         CachedReceipts receipts;
 
-        ReadReceiptKey receipt_key{event_id.toStdString(), room_id.toStdString()};
-        nlohmann::json json_key = receipt_key;
-
-        try {
-                auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-                auto key = json_key.dump();
-
-                lmdb::val value;
-
-                bool res =
-                  lmdb::dbi_get(txn, readReceiptsDb_, lmdb::val(key.data(), key.size()), value);
+        const auto key = cache::codec::receiptKey(room_id, event_id);
 
-                txn.commit();
+        lmdb::val value;
+        std::map<std::string, uint64_t> values;
 
-                if (res) {
-                        auto json_response = json::parse(std::string(value.data(), value.size()));
-                        auto values        = json_response.get<std::map<std::string, uint64_t>>();
+        if (lmdb::dbi_get(txn, readReceiptsDb_, lmdb::val(key), value) &&
+            cache::codec::decode(value, values)) {
+                for (const auto &v : values)
+                        // timestamp, user_id
+                        receipts.emplace(v.second, v.first);
+        }
 
-                        for (const auto &v : values)
-                                // timestamp, user_id
-                                receipts.emplace(v.second, v.first);
-                }
+        return receipts;
+}
 
+CachedReceipts
+Cache::readReceipts(const QString &event_id, const QString &room_id)
+{
+        try {
+                ReadSnapshot snapshot(this);
+                return readReceipts(
+                  snapshot.txn(), event_id.toStdString(), room_id.toStdString());
         } catch (const lmdb::error &e) {
                 nhlog::db()->critical("readReceipts: {}", e.what());
         }
 
-        return receipts;
+        return CachedReceipts();
 }
 
 std::vector<QString>
-Cache::filterReadEvents(const QString &room_id,
+Cache::filterReadEvents(lmdb::txn &txn,
+                        const std::string &room_id,
                         const std::vector<QString> &event_ids,
                         const std::string &excluded_user)
 {
         std::vector<QString> read_events;
 
         for (const auto &event : event_ids) {
-                auto receipts = readReceipts(event, room_id);
+                auto receipts = readReceipts(txn, event.toStdString(), room_id);
 
                 if (receipts.size() == 0)
                         continue;
@@ -772,47 +1516,54 @@ Cache::filterReadEvents(const QString &room_id,
         return read_events;
 }
 
+std::vector<QString>
+Cache::filterReadEvents(const QString &room_id,
+                        const std::vector<QString> &event_ids,
+                        const std::string &excluded_user)
+{
+        try {
+                ReadSnapshot snapshot(this);
+                return filterReadEvents(
+                  snapshot.txn(), room_id.toStdString(), event_ids, excluded_user);
+        } catch (const lmdb::error &e) {
+                nhlog::db()->critical("filterReadEvents: {}", e.what());
+        }
+
+        return std::vector<QString>();
+}
+
 void
 Cache::updateReadReceipt(lmdb::txn &txn, const std::string &room_id, const Receipts &receipts)
 {
         for (const auto &receipt : receipts) {
-                const auto event_id = receipt.first;
-                auto event_receipts = receipt.second;
-
-                ReadReceiptKey receipt_key{event_id, room_id};
-                nlohmann::json json_key = receipt_key;
+                const auto &event_id       = receipt.first;
+                const auto &event_receipts = receipt.second;
 
                 try {
-                        const auto key = json_key.dump();
+                        const auto key = cache::codec::receiptKey(room_id, event_id);
 
                         lmdb::val prev_value;
 
-                        bool exists = lmdb::dbi_get(
-                          txn, readReceiptsDb_, lmdb::val(key.data(), key.size()), prev_value);
+                        bool exists =
+                          lmdb::dbi_get(txn, readReceiptsDb_, lmdb::val(key), prev_value);
 
                         std::map<std::string, uint64_t> saved_receipts;
 
                         // If an entry for the event id already exists, we would
                         // merge the existing receipts with the new ones.
-                        if (exists) {
-                                auto json_value =
-                                  json::parse(std::string(prev_value.data(), prev_value.size()));
-
-                                // Retrieve the saved receipts.
-                                saved_receipts = json_value.get<std::map<std::string, uint64_t>>();
-                        }
+                        if (exists)
+                                cache::codec::decode(prev_value, saved_receipts);
 
                         // Append the new ones.
                         for (const auto &event_receipt : event_receipts)
                                 saved_receipts.emplace(event_receipt.first, event_receipt.second);
 
                         // Save back the merged (or only the new) receipts.
-                        nlohmann::json json_updated_value = saved_receipts;
-                        std::string merged_receipts       = json_updated_value.dump();
+                        const auto merged_receipts = cache::codec::encode(saved_receipts);
 
                         lmdb::dbi_put(txn,
                                       readReceiptsDb_,
-                                      lmdb::val(key.data(), key.size()),
+                                      lmdb::val(key),
                                       lmdb::val(merged_receipts.data(), merged_receipts.size()));
 
                 } catch (const lmdb::error &e) {
@@ -821,67 +1572,199 @@ Cache::updateReadReceipt(lmdb::txn &txn, const std::string &room_id, const Recei
         }
 }
 
-void
-Cache::notifyForReadReceipts(lmdb::txn &txn, const std::string &room_id)
+std::vector<QString>
+Cache::takeReadPendingReceipts(lmdb::txn &txn, const std::string &room_id)
 {
-        QSettings settings;
-        auto local_user = settings.value("auth/user_id").toString();
-
-        auto matches = filterReadEvents(QString::fromStdString(room_id),
-                                        pendingReceiptsEvents(txn, room_id),
-                                        local_user.toStdString());
+        auto matches = filterReadEvents(
+          txn, room_id, pendingReceiptsEvents(txn, room_id), localUserId_.toStdString());
 
         for (const auto &m : matches)
                 removePendingReceipt(txn, room_id, m.toStdString());
 
-        if (!matches.empty())
-                emit newReadReceipts(QString::fromStdString(room_id), matches);
+        return matches;
 }
 
 void
 Cache::saveState(const mtx::responses::Sync &res)
 {
-        auto txn = lmdb::txn::begin(env_);
+        {
+                std::vector<std::string> rooms, invites;
 
-        setNextBatchToken(txn, res.next_batch);
+                for (const auto &room : res.rooms.join)
+                        rooms.emplace_back(room.first);
+                for (const auto &room : res.rooms.invite)
+                        invites.emplace_back(room.first);
 
-        // Save joined rooms
-        for (const auto &room : res.rooms.join) {
-                auto statesdb  = getStatesDb(txn, room.first);
-                auto membersdb = getMembersDb(txn, room.first);
+                cacheRoomDbs(rooms, invites);
+        }
 
-                saveStateEvents(txn, statesdb, membersdb, room.first, room.second.state.events);
-                saveStateEvents(txn, statesdb, membersdb, room.first, room.second.timeline.events);
+        RoomInfoUpdateStats updates;
+        std::map<std::string, std::vector<QString>> readEvents;
+        std::map<std::string, std::vector<MemberUpdate>> memberUpdates;
+        std::map<std::string, std::string> roomNames;
+        std::vector<std::string> reorderedRooms;
 
-                saveTimelineMessages(txn, room.first, room.second.timeline);
+        retryOnMapFull([this,
+                        &res,
+                        &updates,
+                        &readEvents,
+                        &memberUpdates,
+                        &roomNames,
+                        &reorderedRooms]() {
+                updates        = RoomInfoUpdateStats{};
+                updates.joined = res.rooms.join.size();
 
-                RoomInfo updatedInfo;
-                updatedInfo.name  = getRoomName(txn, statesdb, membersdb).toStdString();
-                updatedInfo.topic = getRoomTopic(txn, statesdb).toStdString();
-                updatedInfo.avatar_url =
-                  getRoomAvatarUrl(txn, statesdb, membersdb, QString::fromStdString(room.first))
-                    .toStdString();
+                memberUpdates.clear();
+                roomNames.clear();
+                reorderedRooms.clear();
 
-                lmdb::dbi_put(
-                  txn, roomsDb_, lmdb::val(room.first), lmdb::val(json(updatedInfo).dump()));
+                auto txn = beginTxn();
+
+                setNextBatchToken(txn, res.next_batch);
+
+                // Save joined rooms
+                for (const auto &room : res.rooms.join) {
+                        auto statesdb  = getStatesDb(txn, room.first);
+                        auto membersdb = getMembersDb(txn, room.first);
+
+                        RoomStateChanges changes;
+                        saveStateEvents(
+                          txn, statesdb, membersdb, room.first, room.second.state.events, changes);
+                        saveStateEvents(txn,
+                                        statesdb,
+                                        membersdb,
+                                        room.first,
+                                        room.second.timeline.events,
+                                        changes);
+
+                        saveTimelineMessages(txn, room.first, room.second.timeline);
+
+                        const auto info = updateRoomInfo(
+                          txn, statesdb, membersdb, room.first, changes, updates);
+
+                        if (info)
+                                roomNames.emplace(room.first, info->name);
+
+                        if (!changes.memberUpdates.empty())
+                                memberUpdates.emplace(room.first,
+                                                      std::move(changes.memberUpdates));
+
+                        if (changes.members || changes.powerLevels)
+                                reorderedRooms.push_back(room.first);
+
+                        updateReadReceipt(txn, room.first, room.second.ephemeral.receipts);
+
+                        // Clean up non-valid invites.
+                        removeInvite(txn, room.first);
+                }
+
+                saveInvites(txn, res.rooms.invite);
+
+                removeLeftRooms(txn, res.rooms.leave);
+
+                // Match the events we sent against the receipts of this sync.
+                readEvents.clear();
+                for (const auto &room : res.rooms.join) {
+                        auto matches = takeReadPendingReceipts(txn, room.first);
+
+                        if (!matches.empty())
+                                readEvents.emplace(room.first, std::move(matches));
+                }
+
+                txn.commit();
+        });
 
-                updateReadReceipt(txn, room.first, room.second.ephemeral.receipts);
+        nhlog::db()->debug("recomputed info of {}/{} rooms (names: {}, topics: {}, avatars: {})",
+                           updates.recomputed,
+                           updates.joined,
+                           updates.names,
+                           updates.topics,
+                           updates.avatars);
 
-                // Clean up non-valid invites.
-                removeInvite(txn, room.first);
+        {
+                std::unique_lock<std::mutex> lock(roomInfoUpdatesMtx_);
+                roomInfoUpdates_ = updates;
         }
 
-        saveInvites(txn, res.rooms.invite);
+        for (const auto &room : roomNames)
+                roomIndex_.insert(room.first, room.second);
+        for (const auto &room : res.rooms.leave)
+                roomIndex_.remove(room.first);
 
-        removeLeftRooms(txn, res.rooms.leave);
+        // Rooms that were never seen can't be loaded in the member directory.
+        for (const auto &room : memberUpdates) {
+                const auto roomid = ids::find(room.first);
 
-        txn.commit();
+                if (roomid != ids::None)
+                        Members.update(roomid, room.second);
+        }
+
+        for (const auto &room : res.rooms.join)
+                noteSpeakers(room.first, room.second.timeline.events);
+
+        if (!reorderedRooms.empty() || !res.rooms.leave.empty()) {
+                std::unique_lock<std::mutex> lock(memberOrdersMtx_);
+                memberOrdersVersion_ += 1;
+
+                for (const auto &room : reorderedRooms)
+                        memberOrders_.erase(room);
+                for (const auto &room : res.rooms.leave)
+                        memberOrders_.erase(room.first);
+        }
+
+        for (const auto &room : readEvents)
+                emit newReadReceipts(QString::fromStdString(room.first), room.second);
+}
+
+boost::optional<RoomInfo>
+Cache::updateRoomInfo(lmdb::txn &txn,
+                      lmdb::dbi &statesdb,
+                      lmdb::dbi &membersdb,
+                      const std::string &room_id,
+                      const RoomStateChanges &changes,
+                      RoomInfoUpdateStats &updates)
+{
+        RoomInfo info;
+
+        lmdb::val data;
+        const bool isKnown = lmdb::dbi_get(txn, roomsDb_, lmdb::val(room_id), data) &&
+                             cache::codec::decode(data, info);
+
+        if (isKnown && !changes.any())
+                return boost::none;
+
+        // The name & avatar of rooms without an explicit one are derived from their members.
+        const bool updateName   = !isKnown || changes.name || changes.members;
+        const bool updateTopic  = !isKnown || changes.topic;
+        const bool updateAvatar = !isKnown || changes.avatar || changes.members;
+
+        if (updateName) {
+                info.name = getRoomName(txn, statesdb, membersdb).toStdString();
+                updates.names += 1;
+        }
+
+        if (updateTopic) {
+                info.topic = getRoomTopic(txn, statesdb).toStdString();
+                updates.topics += 1;
+        }
+
+        if (updateAvatar) {
+                info.avatar_url = getRoomAvatarUrl(txn, statesdb, membersdb).toStdString();
+                updates.avatars += 1;
+        }
+
+        updates.recomputed += 1;
+
+        lmdb::dbi_put(txn, roomsDb_, lmdb::val(room_id), lmdb::val(cache::codec::encode(info)));
+
+        return info;
+}
 
-        for (const auto &room : res.rooms.join) {
-                auto tmpTxn = lmdb::txn::begin(env_);
-                notifyForReadReceipts(tmpTxn, room.first);
-                tmpTxn.commit();
-        }
+RoomInfoUpdateStats
+Cache::lastRoomInfoUpdates()
+{
+        std::unique_lock<std::mutex> lock(roomInfoUpdatesMtx_);
+        return roomInfoUpdates_;
 }
 
 void
@@ -900,8 +1783,10 @@ Cache::saveInvites(lmdb::txn &txn, const std::map<std::string, mtx::responses::I
                   getInviteRoomAvatarUrl(txn, statesdb, membersdb).toStdString();
                 updatedInfo.is_invite = true;
 
-                lmdb::dbi_put(
-                  txn, invitesDb_, lmdb::val(room.first), lmdb::val(json(updatedInfo).dump()));
+                lmdb::dbi_put(txn,
+                              invitesDb_,
+                              lmdb::val(room.first),
+                              lmdb::val(cache::codec::encode(updatedInfo)));
         }
 }
 
@@ -924,8 +1809,10 @@ Cache::saveInvite(lmdb::txn &txn,
 
                         MemberInfo tmp{display_name, msg.content.avatar_url};
 
-                        lmdb::dbi_put(
-                          txn, membersdb, lmdb::val(msg.state_key), lmdb::val(json(tmp).dump()));
+                        lmdb::dbi_put(txn,
+                                      membersdb,
+                                      lmdb::val(msg.state_key),
+                                      lmdb::val(cache::codec::encode(tmp)));
                 } else {
                         mpark::visit(
                           [&txn, &statesdb](auto msg) {
@@ -982,30 +1869,26 @@ Cache::roomsWithStateUpdates(const mtx::responses::Sync &res)
 RoomInfo
 Cache::singleRoomInfo(const std::string &room_id)
 {
-        auto txn      = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn     = snapshot.txn();
         auto statesdb = getStatesDb(txn, room_id);
 
         lmdb::val data;
 
         // Check if the room is joined.
         if (lmdb::dbi_get(txn, roomsDb_, lmdb::val(room_id), data)) {
-                try {
-                        RoomInfo tmp     = json::parse(std::string(data.data(), data.size()));
+                RoomInfo tmp;
+
+                if (cache::codec::decode(data, tmp)) {
                         tmp.member_count = getMembersDb(txn, room_id).size(txn);
                         tmp.join_rule    = getRoomJoinRule(txn, statesdb);
                         tmp.guest_access = getRoomGuestAccess(txn, statesdb);
 
-                        txn.commit();
-
                         return tmp;
-                } catch (const json::exception &e) {
-                        nhlog::db()->warn("failed to parse room info: room_id ({}), {}",
-                                          room_id,
-                                          std::string(data.data(), data.size()));
                 }
-        }
 
-        txn.commit();
+                nhlog::db()->warn("failed to parse room info: room_id ({})", room_id);
+        }
 
         return RoomInfo();
 }
@@ -1016,7 +1899,7 @@ Cache::getRoomInfo(const std::vector<std::string> &rooms)
         std::map<QString, RoomInfo> room_info;
 
         // TODO This should be read only.
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
 
         for (const auto &room : rooms) {
                 lmdb::val data;
@@ -1024,34 +1907,33 @@ Cache::getRoomInfo(const std::vector<std::string> &rooms)
 
                 // Check if the room is joined.
                 if (lmdb::dbi_get(txn, roomsDb_, lmdb::val(room), data)) {
-                        try {
-                                RoomInfo tmp = json::parse(std::string(data.data(), data.size()));
-                                tmp.member_count = getMembersDb(txn, room).size(txn);
-                                tmp.join_rule    = getRoomJoinRule(txn, statesdb);
-                                tmp.guest_access = getRoomGuestAccess(txn, statesdb);
+                        RoomInfo tmp;
 
-                                room_info.emplace(QString::fromStdString(room), std::move(tmp));
-                        } catch (const json::exception &e) {
-                                nhlog::db()->warn("failed to parse room info: room_id ({}), {}",
-                                                  room,
-                                                  std::string(data.data(), data.size()));
+                        if (!cache::codec::decode(data, tmp)) {
+                                nhlog::db()->warn("failed to parse room info: room_id ({})", room);
+                                continue;
                         }
+
+                        tmp.member_count = getMembersDb(txn, room).size(txn);
+                        tmp.join_rule    = getRoomJoinRule(txn, statesdb);
+                        tmp.guest_access = getRoomGuestAccess(txn, statesdb);
+
+                        room_info.emplace(QString::fromStdString(room), std::move(tmp));
                 } else {
                         // Check if the room is an invite.
                         if (lmdb::dbi_get(txn, invitesDb_, lmdb::val(room), data)) {
-                                try {
-                                        RoomInfo tmp =
-                                          json::parse(std::string(data.data(), data.size()));
-                                        tmp.member_count = getInviteMembersDb(txn, room).size(txn);
-
-                                        room_info.emplace(QString::fromStdString(room),
-                                                          std::move(tmp));
-                                } catch (const json::exception &e) {
+                                RoomInfo tmp;
+
+                                if (!cache::codec::decode(data, tmp)) {
                                         nhlog::db()->warn(
-                                          "failed to parse room info for invite: room_id ({}), {}",
-                                          room,
-                                          std::string(data.data(), data.size()));
+                                          "failed to parse room info for invite: room_id ({})",
+                                          room);
+                                        continue;
                                 }
+
+                                tmp.member_count = getInviteMembersDb(txn, room).size(txn);
+
+                                room_info.emplace(QString::fromStdString(room), std::move(tmp));
                         }
                 }
         }
@@ -1064,7 +1946,7 @@ Cache::getRoomInfo(const std::vector<std::string> &rooms)
 std::map<QString, mtx::responses::Timeline>
 Cache::roomMessages()
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        auto txn = beginTxn(MDB_RDONLY);
 
         std::map<QString, mtx::responses::Timeline> msgs;
         std::string room_id, unused;
@@ -1079,37 +1961,100 @@ Cache::roomMessages()
         return msgs;
 }
 
-mtx::responses::Timeline
-Cache::getTimelineMessages(lmdb::txn &txn, const std::string &room_id)
+mtx::responses::Messages
+Cache::getMessagesBefore(const std::string &room_id, const std::string &key, std::size_t limit)
 {
-        auto db = getMessagesDb(txn, room_id);
+        mtx::responses::Messages msgs;
 
-        mtx::responses::Timeline timeline;
-        std::string timestamp, msg;
+        ReadSnapshot snapshot(this);
+        auto &txn = snapshot.txn();
 
+        auto db = getMessagesDb(txn, room_id);
+
+        std::string msgKey, msg;
         auto cursor = lmdb::cursor::open(txn, db);
 
-        size_t index = 0;
+        // The batch of the last visited message. Messages of consecutive batches are
+        // only contiguous if the newer batch wasn't limited.
+        std::string token;
+        bool isLimited = false;
+
+        const auto readBatch = [&token, &isLimited](const json &obj) {
+                token = obj.at("token").get<std::string>();
+                // Messages stored before the flag existed might be followed by a gap.
+                isLimited = obj.value("limited", true);
+        };
+
+        bool hasMore = false;
+        if (key.empty()) {
+                hasMore = cursor.get(msgKey, msg, MDB_LAST);
+        } else {
+                msgKey = key;
 
-        while (cursor.get(timestamp, msg, MDB_NEXT) && index < MAX_RESTORED_MESSAGES) {
+                // The history can't be continued from an event we didn't store.
+                if (!cursor.get(msgKey, msg, MDB_SET_KEY))
+                        return msgs;
+
+                auto obj = json::parse(msg);
+                if (obj.count("token") == 0)
+                        return msgs;
+
+                readBatch(obj);
+                hasMore = cursor.get(msgKey, msg, MDB_PREV);
+        }
+
+        for (; hasMore && msgs.chunk.size() < limit; hasMore = cursor.get(msgKey, msg, MDB_PREV)) {
                 auto obj = json::parse(msg);
 
                 if (obj.count("event") == 0 || obj.count("token") == 0)
                         continue;
 
+                const auto batch = obj.at("token").get<std::string>();
+                if (!token.empty() && batch != token && isLimited)
+                        break;
+
+                readBatch(obj);
+
+                if (isRedacted(obj))
+                        continue;
+
                 mtx::events::collections::TimelineEvent event;
                 mtx::events::collections::from_json(obj.at("event"), event);
 
-                index += 1;
-
-                timeline.events.push_back(event.data);
-                timeline.prev_batch = obj.at("token").get<std::string>();
+                msgs.chunk.push_back(std::move(event.data));
         }
         cursor.close();
 
-        std::reverse(timeline.events.begin(), timeline.events.end());
+        msgs.end = token;
+
+        return msgs;
+}
+
+void
+Cache::pruneMessages(lmdb::txn &txn, const std::string &room_id, lmdb::dbi &db)
+{
+        auto excess = db.size(txn) - messageRetention_;
+
+        std::string key, msg, token;
+        auto cursor = lmdb::cursor::open(txn, db);
+
+        // Whole batches are removed, so the oldest stored message is always the first of
+        // its batch & the history before it can be fetched with the batch's token.
+        bool hasMore = cursor.get(key, msg, MDB_FIRST);
+        for (; hasMore; hasMore = cursor.get(key, msg, MDB_NEXT)) {
+                const auto batch = json::parse(msg).value("token", "");
 
-        return timeline;
+                if (excess == 0 && batch != token)
+                        break;
+
+                token = batch;
+                if (excess > 0)
+                        excess -= 1;
+
+                messageIndex_.remove(txn, room_id, key);
+                lmdb::cursor_del(cursor.handle());
+        }
+        cursor.close();
 }
 
 QMap<QString, RoomInfo>
@@ -1117,35 +2062,48 @@ Cache::roomInfo(bool withInvites)
 {
         QMap<QString, RoomInfo> result;
 
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn = snapshot.txn();
 
-        std::string room_id;
-        std::string room_data;
+        lmdb::val key, room_data;
 
         // Gather info about the joined rooms.
         auto roomsCursor = lmdb::cursor::open(txn, roomsDb_);
-        while (roomsCursor.get(room_id, room_data, MDB_NEXT)) {
-                RoomInfo tmp     = json::parse(std::move(room_data));
+        while (roomsCursor.get(key, room_data, MDB_NEXT)) {
+                const std::string room_id(key.data(), key.size());
+                RoomInfo tmp;
+
+                if (!cache::codec::decode(room_data, tmp)) {
+                        nhlog::db()->warn("failed to parse room info: room_id ({})", room_id);
+                        continue;
+                }
+
                 tmp.member_count = getMembersDb(txn, room_id).size(txn);
                 tmp.msgInfo      = getLastMessageInfo(txn, room_id);
 
-                result.insert(QString::fromStdString(std::move(room_id)), std::move(tmp));
+                result.insert(QString::fromUtf8(key.data(), key.size()), std::move(tmp));
         }
         roomsCursor.close();
 
         if (withInvites) {
                 // Gather info about the invites.
                 auto invitesCursor = lmdb::cursor::open(txn, invitesDb_);
-                while (invitesCursor.get(room_id, room_data, MDB_NEXT)) {
-                        RoomInfo tmp     = json::parse(room_data);
+                while (invitesCursor.get(key, room_data, MDB_NEXT)) {
+                        const std::string room_id(key.data(), key.size());
+                        RoomInfo tmp;
+
+                        if (!cache::codec::decode(room_data, tmp)) {
+                                nhlog::db()->warn("failed to parse invite info: room_id ({})",
+                                                  room_id);
+                                continue;
+                        }
+
                         tmp.member_count = getInviteMembersDb(txn, room_id).size(txn);
-                        result.insert(QString::fromStdString(std::move(room_id)), std::move(tmp));
+                        result.insert(QString::fromUtf8(key.data(), key.size()), std::move(tmp));
                 }
                 invitesCursor.close();
         }
 
-        txn.commit();
-
         return result;
 }
 
@@ -1157,16 +2115,18 @@ Cache::getLastMessageInfo(lmdb::txn &txn, const std::string &room_id)
         if (db.size(txn) == 0)
                 return DescInfo{};
 
-        std::string timestamp, msg;
+        std::string key, msg;
 
         QSettings settings;
         auto local_user = settings.value("auth/user_id").toString();
 
         auto cursor = lmdb::cursor::open(txn, db);
-        while (cursor.get(timestamp, msg, MDB_NEXT)) {
+
+        bool hasMore = cursor.get(key, msg, MDB_LAST);
+        for (; hasMore; hasMore = cursor.get(key, msg, MDB_PREV)) {
                 auto obj = json::parse(msg);
 
-                if (obj.count("event") == 0)
+                if (obj.count("event") == 0 || isRedacted(obj))
                         continue;
 
                 mtx::events::collections::TimelineEvent event;
@@ -1186,7 +2146,8 @@ Cache::invites()
 {
         std::map<QString, bool> result;
 
-        auto txn    = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn   = snapshot.txn();
         auto cursor = lmdb::cursor::open(txn, invitesDb_);
 
         std::string room_id, unused;
@@ -1195,16 +2156,12 @@ Cache::invites()
                 result.emplace(QString::fromStdString(std::move(room_id)), true);
 
         cursor.close();
-        txn.commit();
 
         return result;
 }
 
 QString
-Cache::getRoomAvatarUrl(lmdb::txn &txn,
-                        lmdb::dbi &statesdb,
-                        lmdb::dbi &membersdb,
-                        const QString &room_id)
+Cache::getRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
 {
         using namespace mtx::events;
         using namespace mtx::events::state;
@@ -1237,20 +2194,29 @@ Cache::getRoomAvatarUrl(lmdb::txn &txn,
                 if (user_id == localUserId_.toStdString())
                         continue;
 
-                try {
-                        MemberInfo m = json::parse(member_data);
+                MemberInfo m;
 
+                if (cache::codec::decode(member_data, m)) {
                         cursor.close();
                         return QString::fromStdString(m.avatar_url);
-                } catch (const json::exception &e) {
-                        nhlog::db()->warn("failed to parse member info: {}", e.what());
                 }
+
+                nhlog::db()->warn("failed to parse member info: {}", user_id);
         }
 
         cursor.close();
 
-        // Default case when there is only one member.
-        return avatarUrl(room_id, localUserId_);
+        // Default case when there is only one member. Read through the transaction, the
+        // member might have been saved by it.
+        lmdb::val info;
+        MemberInfo m;
+
+        const auto local_user = localUserId_.toStdString();
+        if (lmdb::dbi_get(txn, membersdb, lmdb::val(local_user), info) &&
+            cache::codec::decode(info, m))
+                return QString::fromStdString(m.avatar_url);
+
+        return QString();
 }
 
 QString
@@ -1299,11 +2265,12 @@ Cache::getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
         std::map<std::string, MemberInfo> members;
 
         while (cursor.get(user_id, member_data, MDB_NEXT) && ii < 3) {
-                try {
-                        members.emplace(user_id, json::parse(member_data));
-                } catch (const json::exception &e) {
-                        nhlog::db()->warn("failed to parse member info: {}", e.what());
-                }
+                MemberInfo m;
+
+                if (cache::codec::decode(member_data, m))
+                        members.emplace(user_id, std::move(m));
+                else
+                        nhlog::db()->warn("failed to parse member info: {}", user_id);
 
                 ii++;
         }
@@ -1427,14 +2394,14 @@ Cache::getInviteRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &members
                 if (user_id == localUserId_.toStdString())
                         continue;
 
-                try {
-                        MemberInfo tmp = json::parse(member_data);
-                        cursor.close();
+                MemberInfo tmp;
 
+                if (cache::codec::decode(member_data, tmp)) {
+                        cursor.close();
                         return QString::fromStdString(tmp.name);
-                } catch (const json::exception &e) {
-                        nhlog::db()->warn("failed to parse member info: {}", e.what());
                 }
+
+                nhlog::db()->warn("failed to parse member info: {}", user_id);
         }
 
         cursor.close();
@@ -1469,14 +2436,14 @@ Cache::getInviteRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &me
                 if (user_id == localUserId_.toStdString())
                         continue;
 
-                try {
-                        MemberInfo tmp = json::parse(member_data);
-                        cursor.close();
+                MemberInfo tmp;
 
+                if (cache::codec::decode(member_data, tmp)) {
+                        cursor.close();
                         return QString::fromStdString(tmp.avatar_url);
-                } catch (const json::exception &e) {
-                        nhlog::db()->warn("failed to parse member info: {}", e.what());
                 }
+
+                nhlog::db()->warn("failed to parse member info: {}", user_id);
         }
 
         cursor.close();
@@ -1516,45 +2483,32 @@ Cache::getRoomAvatar(const QString &room_id)
 QImage
 Cache::getRoomAvatar(const std::string &room_id)
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn = snapshot.txn();
 
         lmdb::val response;
 
-        if (!lmdb::dbi_get(txn, roomsDb_, lmdb::val(room_id), response)) {
-                txn.commit();
+        if (!lmdb::dbi_get(txn, roomsDb_, lmdb::val(room_id), response))
                 return QImage();
-        }
 
-        std::string media_url;
+        RoomInfo info;
 
-        try {
-                RoomInfo info = json::parse(std::string(response.data(), response.size()));
-                media_url     = std::move(info.avatar_url);
+        if (!cache::codec::decode(response, info))
+                nhlog::db()->warn("failed to parse room info: room_id ({})", room_id);
 
-                if (media_url.empty()) {
-                        txn.commit();
-                        return QImage();
-                }
-        } catch (const json::exception &e) {
-                nhlog::db()->warn("failed to parse room info: {}, {}",
-                                  e.what(),
-                                  std::string(response.data(), response.size()));
-        }
+        const auto media_url = std::move(info.avatar_url);
 
-        if (!lmdb::dbi_get(txn, mediaDb_, lmdb::val(media_url), response)) {
-                txn.commit();
+        if (media_url.empty())
                 return QImage();
-        }
 
-        txn.commit();
-
-        return QImage::fromData(QByteArray(response.data(), response.size()));
+        return decodeImage(media_url);
 }
 
 std::vector<std::string>
 Cache::joinedRooms()
 {
-        auto txn         = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn        = snapshot.txn();
         auto roomsCursor = lmdb::cursor::open(txn, roomsDb_);
 
         std::string id, data;
@@ -1565,109 +2519,115 @@ Cache::joinedRooms()
                 room_ids.emplace_back(id);
 
         roomsCursor.close();
-        txn.commit();
 
         return room_ids;
 }
 
-void
-Cache::populateMembers()
+std::vector<RoomSearchResult>
+Cache::searchRooms(const std::string &query, std::uint8_t max_items)
 {
-        auto rooms = joinedRooms();
-        nhlog::db()->info("loading {} rooms", rooms.size());
-
-        auto txn = lmdb::txn::begin(env_);
-
-        for (const auto &room : rooms) {
-                const auto roomid = QString::fromStdString(room);
-
-                auto membersdb = getMembersDb(txn, room);
-                auto cursor    = lmdb::cursor::open(txn, membersdb);
+        const auto room_ids = roomIndex_.search(query, max_items);
 
-                std::string user_id, info;
-                while (cursor.get(user_id, info, MDB_NEXT)) {
-                        MemberInfo m = json::parse(info);
+        ReadSnapshot snapshot(this);
+        auto &txn = snapshot.txn();
 
-                        const auto userid = QString::fromStdString(user_id);
+        std::vector<RoomSearchResult> results;
+        results.reserve(room_ids.size());
 
-                        insertDisplayName(roomid, userid, QString::fromStdString(m.name));
-                        insertAvatarUrl(roomid, userid, QString::fromStdString(m.avatar_url));
-                }
+        for (const auto &room_id : room_ids) {
+                lmdb::val data;
+                RoomInfo info;
 
-                cursor.close();
+                if (lmdb::dbi_get(txn, roomsDb_, lmdb::val(room_id), data) &&
+                    cache::codec::decode(data, info))
+                        results.push_back(RoomSearchResult{room_id, std::move(info), {}});
         }
 
-        txn.commit();
+        return results;
 }
 
-std::vector<RoomSearchResult>
-Cache::searchRooms(const std::string &query, std::uint8_t max_items)
+std::vector<MessageSearchResult>
+Cache::searchMessages(const QString &query, const std::string &room_id, std::size_t max_items)
 {
-        std::multimap<int, std::pair<std::string, RoomInfo>> items;
+        if (max_items == 0)
+                return {};
 
-        auto txn    = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-        auto cursor = lmdb::cursor::open(txn, roomsDb_);
+        ReadSnapshot snapshot(this);
+        return messageIndex_.search(snapshot.txn(), query, room_id, max_items);
+}
 
-        std::string room_id, room_data;
-        while (cursor.get(room_id, room_data, MDB_NEXT)) {
-                RoomInfo tmp = json::parse(std::move(room_data));
+void
+Cache::indexMessages(const std::string &room_id,
+                     const std::vector<mtx::events::collections::TimelineEvents> &events)
+{
+        // Only the stored messages are indexed, so they leave the index once they're
+        // pruned from the cache.
+        const auto isStored = [this, &room_id](lmdb::txn &txn, const std::string &key) {
+                lmdb::val msg;
+                return lmdb::dbi_get(txn, getMessagesDb(txn, room_id), lmdb::val(key), msg) &&
+                       !isRedacted(json::parse(std::string(msg.data(), msg.size())));
+        };
+
+        std::vector<std::pair<std::string, QString>> messages;
+        {
+                ReadSnapshot snapshot(this);
+                auto &txn = snapshot.txn();
 
-                const int score = utils::levenshtein_distance(
-                  query, QString::fromStdString(tmp.name).toLower().toStdString());
-                items.emplace(score, std::make_pair(room_id, tmp));
-        }
+                for (const auto &e : events) {
+                        auto body = utils::event_body(e);
+                        if (body.isEmpty())
+                                continue;
 
-        cursor.close();
+                        auto key =
+                          cache::codec::messageKey(utils::event_timestamp(e), utils::event_id(e));
 
-        auto end = items.begin();
+                        if (!messageIndex_.contains(txn, room_id, key) && isStored(txn, key))
+                                messages.emplace_back(std::move(key), std::move(body));
+                }
+        }
 
-        if (items.size() >= max_items)
-                std::advance(end, max_items);
-        else if (items.size() > 0)
-                std::advance(end, items.size());
+        // Rooms are usually opened again with the same messages, so the write
+        // transaction is only started if there is something new.
+        if (messages.empty())
+                return;
 
-        std::vector<RoomSearchResult> results;
-        for (auto it = items.begin(); it != end; it++) {
-                results.push_back(
-                  RoomSearchResult{it->second.first,
-                                   it->second.second,
-                                   QImage::fromData(image(txn, it->second.second.avatar_url))});
-        }
+        retryOnMapFull([this, &room_id, &messages, &isStored]() {
+                auto txn = beginTxn();
 
-        txn.commit();
+                for (const auto &message : messages) {
+                        if (isStored(txn, message.first))
+                                messageIndex_.add(txn, room_id, message.first, message.second);
+                }
 
-        return results;
+                txn.commit();
+        });
 }
 
 QVector<SearchResult>
-Cache::searchUsers(const std::string &room_id, const std::string &query, std::uint8_t max_items)
+Cache::searchUsers(const std::string &room_id,
+                   const std::string &query,
+                   std::uint8_t max_items,
+                   const std::atomic<bool> *cancelled)
 {
-        std::multimap<int, std::pair<std::string, std::string>> items;
+        const auto isCancelled = [cancelled]() { return cancelled && *cancelled; };
 
-        auto txn    = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-        auto cursor = lmdb::cursor::open(txn, getMembersDb(txn, room_id));
+        if (max_items == 0 || isCancelled())
+                return {};
 
-        std::string user_id, user_data;
-        while (cursor.get(user_id, user_data, MDB_NEXT)) {
-                const auto display_name = displayName(room_id, user_id);
-                const int score         = utils::levenshtein_distance(query, display_name);
-
-                items.emplace(score, std::make_pair(user_id, display_name));
-        }
+        loadMembers(room_id, cancelled);
 
-        auto end = items.begin();
+        if (isCancelled())
+                return {};
 
-        if (items.size() >= max_items)
-                std::advance(end, max_items);
-        else if (items.size() > 0)
-                std::advance(end, items.size());
+        const auto matches =
+          Members.complete(ids::intern(room_id), QString::fromStdString(query), max_items);
 
         QVector<SearchResult> results;
-        for (auto it = items.begin(); it != end; it++) {
-                const auto user = it->second;
-                results.push_back(SearchResult{QString::fromStdString(user.first),
-                                               QString::fromStdString(user.second)});
-        }
+        if (!matches)
+                return results;
+
+        for (const auto &match : *matches)
+                results.push_back(SearchResult{ids::toQString(match.user_id), match.displayName});
 
         return results;
 }
@@ -1675,43 +2635,110 @@ Cache::searchUsers(const std::string &room_id, const std::string &query, std::ui
 std::vector<RoomMember>
 Cache::getMembers(const std::string &room_id, std::size_t startIndex, std::size_t len)
 {
-        auto txn    = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-        auto db     = getMembersDb(txn, room_id);
-        auto cursor = lmdb::cursor::open(txn, db);
+        const auto order = memberOrder(room_id);
 
-        std::size_t currentIndex = 0;
+        if (startIndex >= order->size())
+                return {};
 
-        const auto endIndex = std::min(startIndex + len, db.size(txn));
+        const auto first = order->begin() + startIndex;
+        const auto last  = order->begin() + std::min(startIndex + len, order->size());
 
-        std::vector<RoomMember> members;
+        return std::vector<RoomMember>(first, last);
+}
 
-        std::string user_id, user_data;
-        while (cursor.get(user_id, user_data, MDB_NEXT)) {
-                if (currentIndex < startIndex) {
-                        currentIndex += 1;
-                        continue;
-                }
+std::shared_ptr<const std::vector<RoomMember>>
+Cache::memberOrder(const std::string &room_id)
+{
+        using namespace mtx::events;
+        using namespace mtx::events::state;
 
-                if (currentIndex >= endIndex)
-                        break;
+        uint64_t version = 0;
+        {
+                std::unique_lock<std::mutex> lock(memberOrdersMtx_);
 
-                try {
-                        MemberInfo tmp = json::parse(user_data);
-                        members.emplace_back(
-                          RoomMember{QString::fromStdString(user_id),
-                                     QString::fromStdString(tmp.name),
-                                     QImage::fromData(image(txn, tmp.avatar_url))});
-                } catch (const json::exception &e) {
-                        nhlog::db()->warn("{}", e.what());
+                auto it = memberOrders_.find(room_id);
+                if (it != memberOrders_.end())
+                        return it->second;
+
+                version = memberOrdersVersion_;
+        }
+
+        // Members paired with their case folded display name, the sort key.
+        std::vector<std::pair<QString, RoomMember>> members;
+        {
+                ReadSnapshot snapshot(this);
+                auto &txn = snapshot.txn();
+
+                boost::optional<PowerLevels> levels;
+
+                lmdb::val event;
+                if (lmdb::dbi_get(txn,
+                                  getStatesDb(txn, room_id),
+                                  lmdb::val(to_string(EventType::RoomPowerLevels)),
+                                  event)) {
+                        try {
+                                StateEvent<PowerLevels> msg =
+                                  json::parse(std::string(event.data(), event.size()));
+                                levels = msg.content;
+                        } catch (const json::exception &e) {
+                                nhlog::db()->warn("failed to parse m.room.power_levels event: {}",
+                                                  e.what());
+                        }
                 }
 
-                currentIndex += 1;
+                auto db = getMembersDb(txn, room_id);
+                members.reserve(db.size(txn));
+
+                lmdb::val user_id, user_data;
+
+                auto cursor = lmdb::cursor::open(txn, db);
+                while (cursor.get(user_id, user_data, MDB_NEXT)) {
+                        const std::string id(user_id.data(), user_id.size());
+                        MemberInfo tmp;
+
+                        if (!cache::codec::decode(user_data, tmp)) {
+                                nhlog::db()->warn("failed to parse member info: {}", id);
+                                continue;
+                        }
+
+                        RoomMember member{QString::fromStdString(id),
+                                          QString::fromStdString(tmp.name),
+                                          QString::fromStdString(tmp.avatar_url),
+                                          levels ? levels->user_level(id) : 0};
+
+                        auto key = member.display_name.toCaseFolded();
+                        members.emplace_back(std::move(key), std::move(member));
+                }
+                cursor.close();
         }
 
-        cursor.close();
-        txn.commit();
+        std::sort(members.begin(), members.end(), [](const auto &a, const auto &b) {
+                if (a.second.power_level != b.second.power_level)
+                        return a.second.power_level > b.second.power_level;
+                if (a.first != b.first)
+                        return a.first < b.first;
 
-        return members;
+                return a.second.user_id < b.second.user_id;
+        });
+
+        auto order = std::make_shared<std::vector<RoomMember>>();
+        order->reserve(members.size());
+
+        for (auto &member : members)
+                order->emplace_back(std::move(member.second));
+
+        std::unique_lock<std::mutex> lock(memberOrdersMtx_);
+
+        // The membership changed while the order was computed.
+        if (version != memberOrdersVersion_)
+                return order;
+
+        if (memberOrders_.size() >= MAX_MEMBER_ORDERS)
+                memberOrders_.erase(memberOrders_.begin());
+
+        memberOrders_.emplace(room_id, order);
+
+        return order;
 }
 
 void
@@ -1728,25 +2755,71 @@ Cache::saveTimelineMessages(lmdb::txn &txn,
                 if (isStateEvent(e))
                         continue;
 
-                if (mpark::holds_alternative<RedactionEvent<msg::Redaction>>(e))
+                if (mpark::holds_alternative<RedactionEvent<msg::Redaction>>(e)) {
+                        redactMessage(
+                          txn, room_id, db, mpark::get<RedactionEvent<msg::Redaction>>(e).redacts);
                         continue;
+                }
 
                 json obj = json::object();
 
-                obj["event"] = utils::serialize_event(e);
-                obj["token"] = res.prev_batch;
+                obj["event"]   = utils::serialize_event(e);
+                obj["token"]   = res.prev_batch;
+                obj["limited"] = res.limited;
 
-                lmdb::dbi_put(txn,
-                              db,
-                              lmdb::val(std::to_string(utils::event_timestamp(e))),
-                              lmdb::val(obj.dump()));
+                const auto key =
+                  cache::codec::messageKey(utils::event_timestamp(e), utils::event_id(e));
+
+                lmdb::dbi_put(txn, db, lmdb::val(key), lmdb::val(obj.dump()));
+                messageIndex_.addEvent(txn, room_id, key);
+
+                // Encrypted messages are indexed once they're decrypted by the timeline.
+                const auto body = utils::event_body(e);
+                if (!body.isEmpty())
+                        messageIndex_.add(txn, room_id, key, body);
+        }
+
+        if (db.size(txn) > messageRetention_)
+                pruneMessages(txn, room_id, db);
+}
+
+void
+Cache::redactMessage(lmdb::txn &txn,
+                     const std::string &room_id,
+                     lmdb::dbi &db,
+                     const std::string &event_id)
+{
+        std::string key;
+        if (!messageIndex_.findEvent(txn, room_id, event_id, key))
+                return;
+
+        // The redacted message can't be found by its content anymore.
+        messageIndex_.remove(txn, room_id, key);
+
+        lmdb::val msg;
+        if (!lmdb::dbi_get(txn, db, lmdb::val(key), msg))
+                return;
+
+        auto obj = json::parse(std::string(msg.data(), msg.size()));
+
+        // The entry stays, with its batch, so the history can still be paged through it.
+        json stripped = json::object();
+        for (const auto field : {"event_id", "origin_server_ts", "room_id", "sender", "type"}) {
+                if (obj.at("event").count(field) != 0)
+                        stripped[field] = obj.at("event").at(field);
         }
+        stripped["content"] = json::object();
+
+        obj["event"]    = stripped;
+        obj["redacted"] = true;
+
+        lmdb::dbi_put(txn, db, lmdb::val(key), lmdb::val(obj.dump()));
 }
 
 void
 Cache::markSentNotification(const std::string &event_id)
 {
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
         lmdb::dbi_put(txn, notificationsDb_, lmdb::val(event_id), lmdb::val(std::string("")));
         txn.commit();
 }
@@ -1754,7 +2827,7 @@ Cache::markSentNotification(const std::string &event_id)
 void
 Cache::removeReadNotification(const std::string &event_id)
 {
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
 
         lmdb::dbi_del(txn, notificationsDb_, lmdb::val(event_id), nullptr);
 
@@ -1764,13 +2837,11 @@ Cache::removeReadNotification(const std::string &event_id)
 bool
 Cache::isNotificationSent(const std::string &event_id)
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn = snapshot.txn();
 
         lmdb::val value;
-        bool res = lmdb::dbi_get(txn, notificationsDb_, lmdb::val(event_id), value);
-        txn.commit();
-
-        return res;
+        return lmdb::dbi_get(txn, notificationsDb_, lmdb::val(event_id), value);
 }
 
 bool
@@ -1781,7 +2852,7 @@ Cache::hasEnoughPowerLevel(const std::vector<mtx::events::EventType> &eventTypes
         using namespace mtx::events;
         using namespace mtx::events::state;
 
-        auto txn = lmdb::txn::begin(env_);
+        auto txn = beginTxn();
         auto db  = getStatesDb(txn, room_id);
 
         uint16_t min_event_level = std::numeric_limits<uint16_t>::max();
@@ -1815,7 +2886,8 @@ Cache::hasEnoughPowerLevel(const std::vector<mtx::events::EventType> &eventTypes
 std::vector<std::string>
 Cache::roomMembers(const std::string &room_id)
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        ReadSnapshot snapshot(this);
+        auto &txn = snapshot.txn();
 
         std::vector<std::string> members;
         std::string user_id, unused;
@@ -1827,70 +2899,146 @@ Cache::roomMembers(const std::string &room_id)
                 members.emplace_back(std::move(user_id));
         cursor.close();
 
-        txn.commit();
-
         return members;
 }
 
-QHash<QString, QString> Cache::DisplayNames;
-QHash<QString, QString> Cache::AvatarUrls;
+MemberDirectory Cache::Members{MAX_LOADED_MEMBER_ROOMS};
 
-QString
-Cache::displayName(const QString &room_id, const QString &user_id)
+template<class Id>
+boost::optional<MemberProfile>
+Cache::findMember(const Id &room_id, const Id &user_id)
 {
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        if (DisplayNames.contains(fmt))
-                return DisplayNames[fmt];
+        const auto room = ids::find(room_id);
+        const auto user = ids::find(user_id);
+
+        if (room != ids::None) {
+                if (user != ids::None) {
+                        if (auto member = Members.find(room, user))
+                                return member;
+                }
 
-        return user_id;
+                if (Members.isLoaded(room))
+                        return boost::none;
+        }
+
+        if (!cache::client())
+                return boost::none;
+
+        return cache::client()->readMember(toStdString(room_id), toStdString(user_id));
 }
 
-std::string
-Cache::displayName(const std::string &room_id, const std::string &user_id)
+void
+Cache::noteSpeakers(const std::string &room_id,
+                    const std::vector<mtx::events::collections::TimelineEvents> &events)
 {
-        auto fmt = QString::fromStdString(room_id + " " + user_id);
-        if (DisplayNames.contains(fmt))
-                return DisplayNames[fmt].toStdString();
+        std::vector<std::pair<ids::Id, uint64_t>> speakers;
+
+        for (const auto &e : events) {
+                const auto type = utils::event_type(e);
+
+                if (type == mtx::events::EventType::RoomMessage ||
+                    type == mtx::events::EventType::RoomEncrypted)
+                        speakers.emplace_back(ids::intern(utils::event_sender(e)),
+                                              utils::event_timestamp(e));
+        }
 
-        return user_id;
+        if (!speakers.empty())
+                Members.addSpeakers(ids::intern(room_id), speakers);
 }
 
-QString
-Cache::avatarUrl(const QString &room_id, const QString &user_id)
+boost::optional<MemberProfile>
+Cache::readMember(const std::string &room_id, const std::string &user_id)
 {
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        if (AvatarUrls.contains(fmt))
-                return AvatarUrls[fmt];
+        try {
+                ReadSnapshot snapshot(this);
+                auto &txn = snapshot.txn();
 
-        return QString();
+                lmdb::val info;
+                if (!lmdb::dbi_get(txn, getMembersDb(txn, room_id), lmdb::val(user_id), info))
+                        return boost::none;
+
+                MemberInfo m;
+                if (!cache::codec::decode(info, m))
+                        return boost::none;
+
+                return MemberProfile{QString::fromStdString(m.name),
+                                     QString::fromStdString(m.avatar_url)};
+        } catch (const lmdb::error &e) {
+                nhlog::db()->warn("failed to read member {} of {}: {}", user_id, room_id, e.what());
+        }
+
+        return boost::none;
 }
 
 void
-Cache::insertDisplayName(const QString &room_id,
-                         const QString &user_id,
-                         const QString &display_name)
+Cache::loadMembers(const std::string &room_id, const std::atomic<bool> *cancelled)
 {
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        DisplayNames.insert(fmt, display_name);
+        const auto roomid = ids::intern(room_id);
+
+        if (!Members.startLoading(roomid))
+                return;
+
+        MemberDirectory::Members members;
+
+        try {
+                ReadSnapshot snapshot(this);
+                auto &txn = snapshot.txn();
+
+                auto membersdb = getMembersDb(txn, room_id);
+                auto cursor    = lmdb::cursor::open(txn, membersdb);
+
+                members.reserve(membersdb.size(txn));
+
+                lmdb::val user_id, info;
+                while (cursor.get(user_id, info, MDB_NEXT)) {
+                        if (cancelled && *cancelled) {
+                                cursor.close();
+                                Members.failLoading(roomid);
+                                return;
+                        }
+
+                        const auto userid = std::string(user_id.data(), user_id.size());
+                        MemberInfo m;
+
+                        if (!cache::codec::decode(info, m)) {
+                                nhlog::db()->warn("failed to parse member info: {}", userid);
+                                continue;
+                        }
+
+                        members.emplace(ids::intern(userid),
+                                        MemberProfile{QString::fromStdString(m.name),
+                                                      QString::fromStdString(m.avatar_url)});
+                }
+
+                cursor.close();
+        } catch (const lmdb::error &e) {
+                nhlog::db()->warn("failed to load the members of {}: {}", room_id, e.what());
+                Members.failLoading(roomid);
+                return;
+        }
+
+        nhlog::db()->debug("loaded {} members of {}", members.size(), room_id);
+
+        Members.finishLoading(roomid, std::move(members));
 }
 
-void
-Cache::removeDisplayName(const QString &room_id, const QString &user_id)
+QString
+Cache::displayName(const QString &room_id, const QString &user_id)
 {
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        DisplayNames.remove(fmt);
+        const auto member = findMember(room_id, user_id);
+        return member ? member->displayName : user_id;
 }
 
-void
-Cache::insertAvatarUrl(const QString &room_id, const QString &user_id, const QString &avatar_url)
+std::string
+Cache::displayName(const std::string &room_id, const std::string &user_id)
 {
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        AvatarUrls.insert(fmt, avatar_url);
+        const auto member = findMember(room_id, user_id);
+        return member ? member->displayName.toStdString() : user_id;
 }
 
-void
-Cache::removeAvatarUrl(const QString &room_id, const QString &user_id)
+QString
+Cache::avatarUrl(const QString &room_id, const QString &user_id)
 {
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        AvatarUrls.remove(fmt);
+        const auto member = findMember(room_id, user_id);
+        return member ? member->avatarUrl : QString();
 }
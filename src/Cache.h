@@ -29,9 +29,20 @@
 #include <mtx/events/join_rules.hpp>
 #include <mtx/responses.hpp>
 #include <mtxclient/crypto/client.hpp>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 
+#include "CacheCodec.h"
+#include "MapLock.h"
+#include "InternedIds.h"
 #include "Logging.h"
+#include "MediaStore.h"
+#include "MemberDirectory.h"
+#include "MessageIndex.h"
+#include "RoomSearchIndex.h"
 
 using mtx::events::state::JoinRule;
 
@@ -39,7 +50,8 @@ struct RoomMember
 {
         QString user_id;
         QString display_name;
-        QImage avatar;
+        QString avatar_url;
+        int64_t power_level = 0;
 };
 
 struct SearchResult
@@ -48,26 +60,14 @@ struct SearchResult
         QString display_name;
 };
 
-static int
-numeric_key_comparison(const MDB_val *a, const MDB_val *b)
-{
-        auto lhs = std::stoull(std::string((char *)a->mv_data, a->mv_size));
-        auto rhs = std::stoull(std::string((char *)b->mv_data, b->mv_size));
-
-        if (lhs < rhs)
-                return 1;
-        else if (lhs == rhs)
-                return 0;
-
-        return -1;
-}
-
 Q_DECLARE_METATYPE(SearchResult)
 Q_DECLARE_METATYPE(QVector<SearchResult>)
 Q_DECLARE_METATYPE(RoomMember)
 Q_DECLARE_METATYPE(mtx::responses::Timeline)
 
-//! Used to uniquely identify a list of read receipts.
+//! Key of the read receipts written by older versions of the cache.
+//!
+//! They are now keyed by cache::codec::receiptKey.
 struct ReadReceiptKey
 {
         std::string event_id;
@@ -169,7 +169,8 @@ struct RoomSearchResult
 {
         std::string room_id;
         RoomInfo info;
-        QImage img;
+        //! Decoded by the caller of the search, off the GUI thread.
+        QImage avatar;
 };
 
 Q_DECLARE_METATYPE(RoomSearchResult)
@@ -251,6 +252,113 @@ struct OlmSessionStorage
         std::mutex group_inbound_mtx;
 };
 
+class Cache;
+
+//! Holds the lock that keeps the memory map from being resized.
+struct MapLockHolder
+{
+        MapLock mapLock;
+};
+
+//! A transaction that keeps the memory map from being resized while it's alive.
+//!
+//! The lock is held by the first base class, so it's only released after the
+//! transaction has been committed or aborted.
+class GuardedTxn
+  : private MapLockHolder
+  , public lmdb::txn
+{
+public:
+        GuardedTxn(MapLock &&lock, lmdb::txn &&txn)
+          : MapLockHolder{std::move(lock)}
+          , lmdb::txn{std::move(txn)}
+        {}
+};
+
+//! A read-only transaction that is reused by the lookups of a snapshot & of the
+//! snapshots nested in it.
+struct ReadTxnSlot
+{
+        explicit ReadTxnSlot(lmdb::txn &&t)
+          : txn{std::move(t)}
+        {}
+
+        lmdb::txn txn;
+        //! Held while the transaction is in use.
+        MapLock mapLock;
+        //! Number of snapshots currently using the transaction.
+        int depth = 0;
+};
+
+//! Inputs of the derived RoomInfo fields that were changed by a sync.
+struct RoomStateChanges
+{
+        //! m.room.name or m.room.canonical_alias.
+        bool name    = false;
+        bool topic   = false;
+        bool avatar  = false;
+        bool members = false;
+        //! m.room.power_levels, which doesn't affect the RoomInfo.
+        bool powerLevels = false;
+
+        //! Membership changes to apply to the member directory once they're saved.
+        std::vector<MemberUpdate> memberUpdates;
+
+        bool any() const { return name || topic || avatar || members; }
+};
+
+//! Number of derived RoomInfo fields recomputed while saving a sync.
+struct RoomInfoUpdateStats
+{
+        std::size_t joined     = 0;
+        std::size_t recomputed = 0;
+        std::size_t names      = 0;
+        std::size_t topics     = 0;
+        std::size_t avatars    = 0;
+};
+
+//! Size information about a named database.
+struct DbStats
+{
+        std::string name;
+        std::size_t entries = 0;
+        //! Branch, leaf & overflow pages used by the database.
+        std::size_t pages = 0;
+};
+
+//! Usage of the memory map.
+struct CacheStats
+{
+        std::size_t map_size   = 0;
+        std::size_t page_size  = 0;
+        std::size_t used_pages = 0;
+        std::size_t free_pages = 0;
+        std::vector<DbStats> dbs;
+};
+
+//! Scoped view of the cache, backed by a pooled read transaction.
+//!
+//! The outermost snapshot of a thread takes a reset transaction from the pool of the
+//! cache & renews it, and gives it back when it goes out of scope. Multiple lookups can
+//! be batched without paying for a new transaction each time. Nested snapshots share
+//! the view of the outer one. Values read through the transaction are only valid while
+//! the snapshot is alive.
+class ReadSnapshot
+{
+public:
+        explicit ReadSnapshot(const Cache *cache);
+        ~ReadSnapshot();
+
+        ReadSnapshot(const ReadSnapshot &) = delete;
+        ReadSnapshot &operator=(const ReadSnapshot &) = delete;
+
+        lmdb::txn &txn() { return slot_->txn; }
+
+private:
+        const Cache *cache_;
+        ReadTxnSlot *slot_;
+};
+
 class Cache : public QObject
 {
         Q_OBJECT
@@ -258,25 +366,14 @@ class Cache : public QObject
 public:
         Cache(const QString &userId, QObject *parent = nullptr);
 
-        static QHash<QString, QString> DisplayNames;
-        static QHash<QString, QString> AvatarUrls;
-
         static std::string displayName(const std::string &room_id, const std::string &user_id);
         static QString displayName(const QString &room_id, const QString &user_id);
         static QString avatarUrl(const QString &room_id, const QString &user_id);
 
-        static void removeDisplayName(const QString &room_id, const QString &user_id);
-        static void removeAvatarUrl(const QString &room_id, const QString &user_id);
-
-        static void insertDisplayName(const QString &room_id,
-                                      const QString &user_id,
-                                      const QString &display_name);
-        static void insertAvatarUrl(const QString &room_id,
-                                    const QString &user_id,
-                                    const QString &avatar_url);
-
-        //! Load saved data for the display names & avatars.
-        void populateMembers();
+        //! Load the display names & avatars of the members of a room, unless
+        //! they're already loaded. A cancelled load leaves the room unloaded.
+        void loadMembers(const std::string &room_id,
+                         const std::atomic<bool> *cancelled = nullptr);
         std::vector<std::string> joinedRooms();
 
         QMap<QString, RoomInfo> roomInfo(bool withInvites = true);
@@ -290,25 +387,38 @@ public:
         //! Retrieve the topic of the room if any.
         QString getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb);
         //! Retrieve the room avatar's url if any.
-        QString getRoomAvatarUrl(lmdb::txn &txn,
-                                 lmdb::dbi &statesdb,
-                                 lmdb::dbi &membersdb,
-                                 const QString &room_id);
+        QString getRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
 
-        //! Retrieve member info from a room.
+        //! Retrieve a page of the members of a room, ordered by power level and then by
+        //! display name. The order is computed once & kept until the membership or the
+        //! power levels of the room change, so any page is read without walking the
+        //! members before it.
         std::vector<RoomMember> getMembers(const std::string &room_id,
                                            std::size_t startIndex = 0,
                                            std::size_t len        = 30);
+        //! All the members of a room in the order of getMembers. The list is never
+        //! modified, so it can be paged through while newer orders are computed.
+        std::shared_ptr<const std::vector<RoomMember>> memberOrder(const std::string &room_id);
 
         void saveState(const mtx::responses::Sync &res);
+
+        //! Current usage of the memory map & of each named database.
+        CacheStats stats();
+        //! How much of the room metadata was recomputed by the last saveState.
+        RoomInfoUpdateStats lastRoomInfoUpdates();
         bool isInitialized() const;
 
         std::string nextBatchToken() const;
 
         void deleteData();
 
+        //! The invite databases are emptied rather than deleted. Deleting a database
+        //! closes its handle for the whole environment right away, even if the
+        //! transaction is aborted afterwards (e.g. to retry it with a larger map).
         void removeInvite(lmdb::txn &txn, const std::string &room_id);
         void removeInvite(const std::string &room_id);
+        //! Same as removeInvite, for the state & members databases of the room.
+        //! Their handles are forgotten first, so other transactions open them again.
         void removeRoom(lmdb::txn &txn, const std::string &roomid);
         void removeRoom(const std::string &roomid);
         void removeRoom(const QString &roomid) { removeRoom(roomid.toStdString()); };
@@ -316,8 +426,20 @@ public:
 
         bool isFormatValid();
         void setCurrentFormat();
+        //! Upgrade the stored data to the current format, if there is a migration path
+        //! from the stored version. Returns false if the cache has to be reset instead.
+        bool runMigrations();
 
         std::map<QString, mtx::responses::Timeline> roomMessages();
+        //! Read up to `limit` stored messages of a room that are older than the one with the
+        //! given key (see cache::codec::messageKey), or the most recent ones if it's empty.
+        //!
+        //! The result looks like a /messages response: the events are in reverse
+        //! chronological order & `end` is the token to fetch the events before them.
+        //! No events are returned if the stored history has a gap before the given message.
+        mtx::responses::Messages getMessagesBefore(const std::string &room_id,
+                                                   const std::string &key,
+                                                   std::size_t limit);
 
         //! Retrieve all the user ids from a room.
         std::vector<std::string> roomMembers(const std::string &room_id);
@@ -346,25 +468,34 @@ public:
         //! Returns a map of user ids and the time of the read receipt in milliseconds.
         using UserReceipts = std::multimap<uint64_t, std::string, std::greater<uint64_t>>;
         UserReceipts readReceipts(const QString &event_id, const QString &room_id);
+        UserReceipts readReceipts(lmdb::txn &txn,
+                                  const std::string &event_id,
+                                  const std::string &room_id);
 
         //! Filter the events that have at least one read receipt.
         std::vector<QString> filterReadEvents(const QString &room_id,
                                               const std::vector<QString> &event_ids,
                                               const std::string &excluded_user);
+        std::vector<QString> filterReadEvents(lmdb::txn &txn,
+                                              const std::string &room_id,
+                                              const std::vector<QString> &event_ids,
+                                              const std::string &excluded_user);
         //! Add event for which we are expecting some read receipts.
         void addPendingReceipt(const QString &room_id, const QString &event_id);
         void removePendingReceipt(lmdb::txn &txn,
                                   const std::string &room_id,
                                   const std::string &event_id);
-        void notifyForReadReceipts(lmdb::txn &txn, const std::string &room_id);
+        //! Remove the pending receipts of the room that have been read by another user.
+        //!
+        //! Returns the ids of the read events.
+        std::vector<QString> takeReadPendingReceipts(lmdb::txn &txn, const std::string &room_id);
         std::vector<QString> pendingReceiptsEvents(lmdb::txn &txn, const std::string &room_id);
 
-        QByteArray image(const QString &url) const;
-        QByteArray image(lmdb::txn &txn, const std::string &url) const;
-        QByteArray image(const std::string &url) const
-        {
-                return image(QString::fromStdString(url));
-        }
+        //! Retrieve a copy of a media file.
+        QByteArray image(const std::string &url) const;
+        QByteArray image(const QString &url) const { return image(url.toStdString()); }
+        QImage decodeImage(const std::string &url) const;
+        QImage decodeImage(const QString &url) const { return decodeImage(url.toStdString()); }
         void saveImage(const std::string &url, const std::string &data);
         void saveImage(const QString &url, const QByteArray &data);
 
@@ -376,11 +507,24 @@ public:
                 return getRoomInfo(roomsWithStateUpdates(sync));
         }
 
+        //! Members of a room to complete the query with, see MemberDirectory::complete.
+        //! Loads the members of the room if needed. Gives up & returns nothing once
+        //! `cancelled` is set.
         QVector<SearchResult> searchUsers(const std::string &room_id,
                                           const std::string &query,
-                                          std::uint8_t max_items = 5);
+                                          std::uint8_t max_items = 5,
+                                          const std::atomic<bool> *cancelled = nullptr);
         std::vector<RoomSearchResult> searchRooms(const std::string &query,
                                                   std::uint8_t max_items = 5);
+        //! Stored messages that contain the words of the query, most recent first.
+        //! See MessageIndex::search.
+        std::vector<MessageSearchResult> searchMessages(const QString &query,
+                                                        const std::string &room_id = "",
+                                                        std::size_t max_items = 20);
+        //! Add the decrypted messages of an encrypted room to the search index.
+        //! Messages that are already indexed are skipped.
+        void indexMessages(const std::string &room_id,
+                           const std::vector<mtx::events::collections::TimelineEvents> &events);
 
         void markSentNotification(const std::string &event_id);
         //! Removes an event from the sent notifications.
@@ -437,6 +581,20 @@ signals:
         void newReadReceipts(const QString &room_id, const std::vector<QString> &event_ids);
 
 private:
+        //! Display names & avatars of the members of the recently used rooms.
+        static MemberDirectory Members;
+
+        //! The profile of a member. Members of the rooms that aren't loaded are read
+        //! from the cache.
+        template<class Id>
+        static boost::optional<MemberProfile> findMember(const Id &room_id, const Id &user_id);
+        boost::optional<MemberProfile> readMember(const std::string &room_id,
+                                                  const std::string &user_id);
+
+        //! Rank the senders of the messages first when completing member names.
+        void noteSpeakers(const std::string &room_id,
+                          const std::vector<mtx::events::collections::TimelineEvents> &events);
+
         //! Save an invited room.
         void saveInvite(lmdb::txn &txn,
                         lmdb::dbi &statesdb,
@@ -452,7 +610,16 @@ private:
                                   const std::string &room_id,
                                   const mtx::responses::Timeline &res);
 
-        mtx::responses::Timeline getTimelineMessages(lmdb::txn &txn, const std::string &room_id);
+        //! Strip the content of a stored message & drop it from the index. Redacted
+        //! messages are skipped when the history is read.
+        void redactMessage(lmdb::txn &txn,
+                           const std::string &room_id,
+                           lmdb::dbi &db,
+                           const std::string &event_id);
+        static bool isRedacted(const json &msg) { return msg.value("redacted", false); }
+
+        //! Remove the oldest messages of a room that are beyond the retention limit.
+        void pruneMessages(lmdb::txn &txn, const std::string &room_id, lmdb::dbi &db);
 
         //! Remove a room from the cache.
         // void removeLeftRoom(lmdb::txn &txn, const std::string &room_id);
@@ -461,10 +628,11 @@ private:
                              const lmdb::dbi &statesdb,
                              const lmdb::dbi &membersdb,
                              const std::string &room_id,
-                             const std::vector<T> &events)
+                             const std::vector<T> &events,
+                             RoomStateChanges &changes)
         {
                 for (const auto &e : events)
-                        saveStateEvent(txn, statesdb, membersdb, room_id, e);
+                        saveStateEvent(txn, statesdb, membersdb, room_id, e, changes);
         }
 
         template<class T>
@@ -472,7 +640,8 @@ private:
                             const lmdb::dbi &statesdb,
                             const lmdb::dbi &membersdb,
                             const std::string &room_id,
-                            const T &event)
+                            const T &event,
+                            RoomStateChanges &changes)
         {
                 using namespace mtx::events;
                 using namespace mtx::events::state;
@@ -480,6 +649,8 @@ private:
                 if (mpark::holds_alternative<StateEvent<Member>>(event)) {
                         const auto e = mpark::get<StateEvent<Member>>(event);
 
+                        changes.members = true;
+
                         switch (e.content.membership) {
                         //
                         // We only keep users with invite or join membership.
@@ -496,15 +667,12 @@ private:
                                 lmdb::dbi_put(txn,
                                               membersdb,
                                               lmdb::val(e.state_key),
-                                              lmdb::val(json(tmp).dump()));
-
-                                insertDisplayName(QString::fromStdString(room_id),
-                                                  QString::fromStdString(e.state_key),
-                                                  QString::fromStdString(display_name));
+                                              lmdb::val(cache::codec::encode(tmp)));
 
-                                insertAvatarUrl(QString::fromStdString(room_id),
-                                                QString::fromStdString(e.state_key),
-                                                QString::fromStdString(e.content.avatar_url));
+                                changes.memberUpdates.push_back(
+                                  {ids::intern(e.state_key),
+                                   MemberProfile{QString::fromStdString(display_name),
+                                                 QString::fromStdString(e.content.avatar_url)}});
 
                                 break;
                         }
@@ -512,10 +680,8 @@ private:
                                 lmdb::dbi_del(
                                   txn, membersdb, lmdb::val(e.state_key), lmdb::val(""));
 
-                                removeDisplayName(QString::fromStdString(room_id),
-                                                  QString::fromStdString(e.state_key));
-                                removeAvatarUrl(QString::fromStdString(room_id),
-                                                QString::fromStdString(e.state_key));
+                                changes.memberUpdates.push_back(
+                                  {ids::intern(e.state_key), boost::none});
 
                                 break;
                         }
@@ -530,6 +696,16 @@ private:
                 if (!isStateEvent(event))
                         return;
 
+                if (mpark::holds_alternative<StateEvent<Name>>(event) ||
+                    mpark::holds_alternative<StateEvent<CanonicalAlias>>(event))
+                        changes.name = true;
+                else if (mpark::holds_alternative<StateEvent<Topic>>(event))
+                        changes.topic = true;
+                else if (mpark::holds_alternative<StateEvent<state::Avatar>>(event))
+                        changes.avatar = true;
+                else if (mpark::holds_alternative<StateEvent<PowerLevels>>(event))
+                        changes.powerLevels = true;
+
                 mpark::visit(
                   [&txn, &statesdb](auto e) {
                           lmdb::dbi_put(
@@ -582,6 +758,14 @@ private:
                        mpark::holds_alternative<StrippedEvent<Topic>>(e);
         }
 
+        //! Recompute the RoomInfo fields whose inputs were changed by a sync.
+        //! Returns the new RoomInfo if any field was recomputed.
+        boost::optional<RoomInfo> updateRoomInfo(lmdb::txn &txn,
+                                                 lmdb::dbi &statesdb,
+                                                 lmdb::dbi &membersdb,
+                                                 const std::string &room_id,
+                                                 const RoomStateChanges &changes,
+                                                 RoomInfoUpdateStats &updates);
         void saveInvites(lmdb::txn &txn,
                          const std::map<std::string, mtx::responses::InvitedRoom> &rooms);
 
@@ -597,40 +781,47 @@ private:
                 }
         }
 
-        lmdb::dbi getPendingReceiptsDb(lmdb::txn &txn)
-        {
-                return lmdb::dbi::open(txn, "pending_receipts", MDB_CREATE);
-        }
+        //! Open a named database, reusing the cached handle if there is one.
+        lmdb::dbi openDb(lmdb::txn &txn, const std::string &name);
+        //! Open the given databases in a separate transaction & keep their handles around.
+        //! The environment is reopened with a higher max_dbs when they get close to the
+        //! limit, so it must not be called while the thread holds a transaction.
+        void cacheDbs(const std::vector<std::string> &names);
+        void cacheRoomDbs(const std::vector<std::string> &rooms,
+                          const std::vector<std::string> &invites);
+        //! Reopen the environment with room for twice as many named databases. Waits for
+        //! the transactions in flight to finish, like growMap.
+        bool growMaxDbs(std::size_t namedDbs);
+        //! Invalidate the cached handles of databases that are about to be dropped.
+        void forgetDbs(const std::vector<std::string> &names);
+        void forgetRoomDbs(const std::vector<std::string> &rooms,
+                           const std::vector<std::string> &invites);
+
+        lmdb::dbi getPendingReceiptsDb(lmdb::txn &txn) { return openDb(txn, "pending_receipts"); }
 
         lmdb::dbi getMessagesDb(lmdb::txn &txn, const std::string &room_id)
         {
-                auto db =
-                  lmdb::dbi::open(txn, std::string(room_id + "/messages").c_str(), MDB_CREATE);
-                lmdb::dbi_set_compare(txn, db, numeric_key_comparison);
-
-                return db;
+                return openDb(txn, room_id + "/messages");
         }
 
         lmdb::dbi getInviteStatesDb(lmdb::txn &txn, const std::string &room_id)
         {
-                return lmdb::dbi::open(
-                  txn, std::string(room_id + "/invite_state").c_str(), MDB_CREATE);
+                return openDb(txn, room_id + "/invite_state");
         }
 
         lmdb::dbi getInviteMembersDb(lmdb::txn &txn, const std::string &room_id)
         {
-                return lmdb::dbi::open(
-                  txn, std::string(room_id + "/invite_members").c_str(), MDB_CREATE);
+                return openDb(txn, room_id + "/invite_members");
         }
 
         lmdb::dbi getStatesDb(lmdb::txn &txn, const std::string &room_id)
         {
-                return lmdb::dbi::open(txn, std::string(room_id + "/state").c_str(), MDB_CREATE);
+                return openDb(txn, room_id + "/state");
         }
 
         lmdb::dbi getMembersDb(lmdb::txn &txn, const std::string &room_id)
         {
-                return lmdb::dbi::open(txn, std::string(room_id + "/members").c_str(), MDB_CREATE);
+                return openDb(txn, room_id + "/members");
         }
 
         //! Retrieves or creates the database that stores the open OLM sessions between our device
@@ -639,8 +830,7 @@ private:
         //! Each entry is a map from the session_id to the pickled representation of the session.
         lmdb::dbi getOlmSessionsDb(lmdb::txn &txn, const std::string &curve25519_key)
         {
-                return lmdb::dbi::open(
-                  txn, std::string("olm_sessions/" + curve25519_key).c_str(), MDB_CREATE);
+                return openDb(txn, "olm_sessions/" + curve25519_key);
         }
 
         QString getDisplayName(const mtx::events::StateEvent<mtx::events::state::Member> &event)
@@ -651,14 +841,84 @@ private:
                 return QString::fromStdString(event.state_key);
         }
 
+        //! Ids of the rooms stored in the rooms or the invites database.
+        std::vector<std::string> roomIds(lmdb::txn &txn, lmdb::dbi &db);
+        //! Fill the room search index from the rooms database.
+        void buildRoomIndex();
+        //! Cache migrations, applied by runMigrations().
+        void migrateToBinaryRecords(lmdb::txn &txn);
+        void migrateMessageKeys(lmdb::txn &txn);
+        //! The media files are now kept in the MediaStore.
+        void dropStateMedia(lmdb::txn &txn);
+        void migrateReceiptKeys(lmdb::txn &txn);
+        void indexStoredMessages(lmdb::txn &txn);
+        void indexMessageEventIds(lmdb::txn &txn);
+        //! Keep the event ids of the stored messages that weren't indexed.
+        void mapMessageEventIds(lmdb::txn &txn);
+        void indexMessageWords(lmdb::txn &txn);
+
+        //! Rewrite the records of a database that are still stored as JSON.
+        template<class T>
+        void migrateRecords(lmdb::txn &txn, lmdb::dbi &db)
+        {
+                std::vector<std::pair<std::string, std::string>> records;
+                lmdb::val key, value;
+
+                auto cursor = lmdb::cursor::open(txn, db);
+                while (cursor.get(key, value, MDB_NEXT)) {
+                        T tmp;
+
+                        if (cache::codec::isLegacyRecord(value) && cache::codec::decode(value, tmp))
+                                records.emplace_back(std::string(key.data(), key.size()),
+                                                     cache::codec::encode(tmp));
+                }
+                cursor.close();
+
+                for (const auto &r : records)
+                        lmdb::dbi_put(txn, db, lmdb::val(r.first), lmdb::val(r.second));
+        }
+
         void setNextBatchToken(lmdb::txn &txn, const std::string &token);
         void setNextBatchToken(lmdb::txn &txn, const QString &token);
 
+        void openEnv(const QString &statePath);
+        //! Open the databases that aren't specific to a room or a device.
+        void openDbs(lmdb::txn &txn);
+
+        friend class ReadSnapshot;
+        //! Take a reset read transaction from the pool, or begin a new one, and renew it.
+        std::unique_ptr<ReadTxnSlot> acquireReadTxn() const;
+        //! Put a reset read transaction back in the pool, or abort it if the pool is full.
+        void releaseReadTxn(std::unique_ptr<ReadTxnSlot> slot) const;
+
+        //! Begin a transaction that prevents the map from being resized while it's alive.
+        GuardedTxn beginTxn(unsigned int flags = 0) const;
+        //! Grow the memory map after a transaction failed with MDB_MAP_FULL.
+        //!
+        //! Waits for the transactions in flight to finish, so it must not be called
+        //! while the thread holds one. Returns false if the map couldn't be grown.
+        bool growMap();
+        //! Run a write operation, growing the map & retrying it if it runs out of space.
+        //!
+        //! The operation must begin and commit its own transaction.
+        template<class Op>
+        void retryOnMapFull(Op &&op)
+        {
+                for (;;) {
+                        try {
+                                op();
+                                return;
+                        } catch (const lmdb::error &e) {
+                                if (e.code() != MDB_MAP_FULL || !growMap())
+                                        throw;
+                        }
+                }
+        }
+
         lmdb::env env_;
         lmdb::dbi syncStateDb_;
         lmdb::dbi roomsDb_;
         lmdb::dbi invitesDb_;
-        lmdb::dbi mediaDb_;
         lmdb::dbi readReceiptsDb_;
         lmdb::dbi notificationsDb_;
 
@@ -670,6 +930,43 @@ private:
 
         QString localUserId_;
         QString cacheDirectory_;
+        QString mediaDirectory_;
+
+        //! The maximum number of named databases the environment was opened with.
+        //! Guarded by dbisMtx_ once the cache is set up.
+        std::size_t maxDbs_;
+        //! Number of messages kept for each room.
+        std::size_t messageRetention_;
+        //! Handles of the named databases that were opened by a committed transaction.
+        std::mutex dbisMtx_;
+        std::unordered_map<std::string, MDB_dbi> dbis_;
+
+        //! Reset read transactions that aren't used by a snapshot. The environment is
+        //! opened with MDB_NOTLS, so they can be renewed by any thread. A reset transaction
+        //! keeps its slot in the reader table, so the pool is bounded.
+        mutable std::mutex readTxnsMtx_;
+        mutable std::vector<std::unique_ptr<ReadTxnSlot>> idleReadTxns_;
+        //! Taken exclusively while the memory map is resized.
+        mutable std::shared_timed_mutex mapMtx_;
+
+        std::mutex roomInfoUpdatesMtx_;
+        RoomInfoUpdateStats roomInfoUpdates_;
+
+        //! Avatars & thumbnails, stored outside of the environment of the sync state.
+        std::unique_ptr<MediaStore> media_;
+
+        //! Names of the joined rooms, for searchRooms.
+        RoomSearchIndex roomIndex_;
+        //! Words of the stored messages, for searchMessages.
+        MessageIndex messageIndex_;
+
+        std::mutex memberOrdersMtx_;
+        //! Member orders of the rooms whose member list was viewed recently.
+        std::unordered_map<std::string, std::shared_ptr<const std::vector<RoomMember>>>
+          memberOrders_;
+        //! Bumped whenever orders are dropped, so an order computed from older data
+        //! isn't kept.
+        uint64_t memberOrdersVersion_ = 0;
 };
 
 namespace cache {
@@ -0,0 +1,160 @@
+#include "CacheCodec.h"
+
+#include "Cache.h"
+
+namespace {
+//! Parse a record written by older versions of the client.
+template<class T>
+bool
+decodeLegacy(const char *data, std::size_t size, T &out)
+{
+        try {
+                out = json::parse(data, data + size).get<T>();
+                return true;
+        } catch (const json::exception &e) {
+                nhlog::db()->warn("failed to parse legacy cache record: {}", e.what());
+        }
+
+        return false;
+}
+}
+
+namespace cache {
+namespace codec {
+
+std::string
+encode(const RoomInfo &info)
+{
+        Writer w;
+        w.reserve(info.name.size() + info.topic.size() + info.avatar_url.size() + 16);
+
+        w.str(info.name);
+        w.str(info.topic);
+        w.str(info.avatar_url);
+        w.u8(info.is_invite);
+        w.u8(static_cast<uint8_t>(info.join_rule));
+        w.u8(info.guest_access);
+        w.u16(static_cast<uint16_t>(info.member_count));
+
+        return w.take();
+}
+
+std::string
+encode(const MemberInfo &info)
+{
+        Writer w;
+        w.reserve(info.name.size() + info.avatar_url.size() + 8);
+
+        w.str(info.name);
+        w.str(info.avatar_url);
+
+        return w.take();
+}
+
+std::string
+encode(const std::map<std::string, uint64_t> &receipts)
+{
+        Writer w;
+        w.u32(static_cast<uint32_t>(receipts.size()));
+
+        for (const auto &receipt : receipts) {
+                w.str(receipt.first);
+                w.u64(receipt.second);
+        }
+
+        return w.take();
+}
+
+std::string
+encode(const OutboundGroupSessionData &data, const std::string &pickled_session)
+{
+        Writer w;
+        w.str(data.session_id);
+        w.str(data.session_key);
+        w.u64(data.message_index);
+        w.str(pickled_session);
+
+        return w.take();
+}
+
+bool
+decode(const char *data, std::size_t size, RoomInfo &info)
+{
+        if (isLegacyRecord(data, size))
+                return decodeLegacy(data, size, info);
+
+        Reader r(data, size);
+
+        info.name         = r.str();
+        info.topic        = r.str();
+        info.avatar_url   = r.str();
+        info.is_invite    = r.u8() != 0;
+        info.join_rule    = static_cast<JoinRule>(r.u8());
+        info.guest_access = r.u8() != 0;
+        info.member_count = static_cast<int16_t>(r.u16());
+
+        return r.ok();
+}
+
+bool
+decode(const char *data, std::size_t size, MemberInfo &info)
+{
+        if (isLegacyRecord(data, size))
+                return decodeLegacy(data, size, info);
+
+        Reader r(data, size);
+
+        info.name       = r.str();
+        info.avatar_url = r.str();
+
+        return r.ok();
+}
+
+bool
+decode(const char *data, std::size_t size, std::map<std::string, uint64_t> &receipts)
+{
+        if (isLegacyRecord(data, size))
+                return decodeLegacy(data, size, receipts);
+
+        Reader r(data, size);
+
+        const auto count = r.u32();
+        for (uint32_t i = 0; i < count && r.ok(); ++i) {
+                auto user_id      = r.str();
+                receipts[user_id] = r.u64();
+        }
+
+        return r.ok();
+}
+
+bool
+decode(const char *data,
+       std::size_t size,
+       OutboundGroupSessionData &sessionData,
+       std::string &pickled_session)
+{
+        if (isLegacyRecord(data, size)) {
+                try {
+                        auto obj        = json::parse(data, data + size);
+                        sessionData     = obj.at("data").get<OutboundGroupSessionData>();
+                        pickled_session = obj.at("session").get<std::string>();
+                        return true;
+                } catch (const json::exception &e) {
+                        nhlog::db()->warn("failed to parse legacy megolm session data: {}",
+                                          e.what());
+                }
+
+                return false;
+        }
+
+        Reader r(data, size);
+
+        sessionData.session_id    = r.str();
+        sessionData.session_key   = r.str();
+        sessionData.message_index = r.u64();
+        pickled_session           = r.str();
+
+        return r.ok();
+}
+} // namespace codec
+} // namespace cache
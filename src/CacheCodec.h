@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+struct RoomInfo;
+struct MemberInfo;
+struct OutboundGroupSessionData;
+
+//! Compact binary encoding for the records stored in the cache.
+//!
+//! Every record starts with a one byte tag holding the version of the encoding,
+//! followed by fixed-width little-endian integers and length-prefixed strings.
+//! Records written by older clients are plain JSON objects and are still accepted
+//! by the decoders so they can be upgraded lazily.
+//!
+//! Records can be read from any buffer with data() & size(), e.g. a lmdb::val or a
+//! std::string, so the encoding doesn't depend on the database.
+namespace cache {
+namespace codec {
+
+//! Version of the binary encoding. Should be bumped when the layout of a record changes.
+constexpr uint8_t RECORD_VERSION = 1;
+
+//! Whether the data holds a record that was serialized as JSON.
+inline bool
+isLegacyRecord(const char *data, std::size_t size)
+{
+        return size > 0 && data[0] == '{';
+}
+
+template<class Buffer>
+bool
+isLegacyRecord(const Buffer &v)
+{
+        return isLegacyRecord(v.data(), v.size());
+}
+
+//! Key of a timeline message: the big-endian timestamp followed by the event id.
+//!
+//! Messages sort chronologically with the default (memcmp) key comparison and events
+//! that share the same timestamp are kept as separate records.
+inline std::string
+messageKey(uint64_t timestamp, const std::string &event_id)
+{
+        std::string key;
+        key.reserve(sizeof(timestamp) + event_id.size());
+
+        for (int shift = 56; shift >= 0; shift -= 8)
+                key.push_back(static_cast<char>((timestamp >> shift) & 0xff));
+
+        key.append(event_id);
+
+        return key;
+}
+
+//! Key of the read receipts of an event: the room id, a NUL separator and the event id.
+//!
+//! The entries of a room are kept next to each other, so they can be visited
+//! by a range lookup on receiptKeyPrefix().
+inline std::string
+receiptKey(const std::string &room_id, const std::string &event_id)
+{
+        std::string key;
+        key.reserve(room_id.size() + 1 + event_id.size());
+
+        key.append(room_id);
+        key.push_back('\0');
+        key.append(event_id);
+
+        return key;
+}
+
+inline std::string
+receiptKeyPrefix(const std::string &room_id)
+{
+        return receiptKey(room_id, std::string());
+}
+
+//! Appends encoded fields to an output buffer.
+class Writer
+{
+public:
+        Writer() { buf_.push_back(static_cast<char>(RECORD_VERSION)); }
+
+        void reserve(std::size_t size) { buf_.reserve(size + 1); }
+
+        void u8(uint8_t v) { buf_.push_back(static_cast<char>(v)); }
+        void u16(uint16_t v) { fixed(v, sizeof(v)); }
+        void u32(uint32_t v) { fixed(v, sizeof(v)); }
+        void u64(uint64_t v) { fixed(v, sizeof(v)); }
+        void str(const std::string &s)
+        {
+                u32(static_cast<uint32_t>(s.size()));
+                buf_.append(s);
+        }
+
+        std::string take() { return std::move(buf_); }
+
+private:
+        void fixed(uint64_t v, std::size_t width)
+        {
+                for (std::size_t i = 0; i < width; ++i)
+                        buf_.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+        }
+
+        std::string buf_;
+};
+
+//! Reads fields from an encoded record without taking ownership of the data.
+//!
+//! Any out of bounds access will mark the reader as invalid and return zeroed values.
+class Reader
+{
+public:
+        Reader(const char *data, std::size_t size)
+          : pos_{data}
+          , end_{data + size}
+        {
+                ok_ = size > 0 && static_cast<uint8_t>(*pos_++) == RECORD_VERSION;
+        }
+
+        bool ok() const { return ok_; }
+        bool atEnd() const { return pos_ == end_; }
+
+        uint8_t u8() { return static_cast<uint8_t>(fixed(sizeof(uint8_t))); }
+        uint16_t u16() { return static_cast<uint16_t>(fixed(sizeof(uint16_t))); }
+        uint32_t u32() { return static_cast<uint32_t>(fixed(sizeof(uint32_t))); }
+        uint64_t u64() { return fixed(sizeof(uint64_t)); }
+        std::string str()
+        {
+                const auto len = u32();
+
+                if (!ok_ || static_cast<std::size_t>(end_ - pos_) < len) {
+                        ok_ = false;
+                        return std::string();
+                }
+
+                std::string s(pos_, len);
+                pos_ += len;
+
+                return s;
+        }
+
+private:
+        uint64_t fixed(std::size_t width)
+        {
+                if (!ok_ || static_cast<std::size_t>(end_ - pos_) < width) {
+                        ok_ = false;
+                        return 0;
+                }
+
+                uint64_t v = 0;
+                for (std::size_t i = 0; i < width; ++i)
+                        v |= static_cast<uint64_t>(static_cast<uint8_t>(pos_[i])) << (8 * i);
+
+                pos_ += width;
+
+                return v;
+        }
+
+        const char *pos_;
+        const char *end_;
+        bool ok_ = false;
+};
+
+std::string
+encode(const RoomInfo &info);
+std::string
+encode(const MemberInfo &info);
+//! Read receipts of a single event (user_id -> timestamp).
+std::string
+encode(const std::map<std::string, uint64_t> &receipts);
+//! Outbound megolm session data along with the pickled session.
+std::string
+encode(const OutboundGroupSessionData &data, const std::string &pickled_session);
+
+//! Decode a record. Returns false if the data is neither a valid binary nor a legacy record.
+bool
+decode(const char *data, std::size_t size, RoomInfo &info);
+bool
+decode(const char *data, std::size_t size, MemberInfo &info);
+bool
+decode(const char *data, std::size_t size, std::map<std::string, uint64_t> &receipts);
+bool
+decode(const char *data,
+       std::size_t size,
+       OutboundGroupSessionData &sessionData,
+       std::string &pickled_session);
+
+template<class Buffer, class T>
+bool
+decode(const Buffer &v, T &out)
+{
+        return decode(v.data(), v.size(), out);
+}
+} // namespace codec
+} // namespace cache
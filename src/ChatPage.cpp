@@ -57,6 +57,8 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
   , isConnected_(true)
   , userSettings_{userSettings}
   , notificationsManager(this)
+  , syncDeferred_(false)
+  , syncQueue_(SYNC_QUEUE_CAPACITY)
 {
         setObjectName("chatPage");
 
@@ -545,6 +547,8 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
                 view_manager_,
                 &TimelineViewManager::initWithMessages);
         connect(this, &ChatPage::syncUI, this, [this](const mtx::responses::Rooms &rooms) {
+                const auto started = std::chrono::steady_clock::now();
+
                 try {
                         room_list_->cleanupInvites(cache::client()->invites());
                 } catch (const lmdb::error &e) {
@@ -581,6 +585,12 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
 
                                   emit notificationsRetrieved(std::move(res));
                           });
+
+                nhlog::ui()->debug(
+                  "sync ui: {}ms",
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - started)
+                    .count());
         });
         connect(this, &ChatPage::syncRoomlist, room_list_, &RoomList::sync);
         connect(
@@ -613,6 +623,7 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QWidget *parent)
 void
 ChatPage::logout()
 {
+        resetSync();
         deleteConfigs();
 
         resetUI();
@@ -624,6 +635,7 @@ ChatPage::logout()
 void
 ChatPage::dropToLoginPage(const QString &msg)
 {
+        resetSync();
         deleteConfigs();
         resetUI();
 
@@ -693,7 +705,10 @@ ChatPage::bootstrap(QString userid, QString homeserver, QString token)
                 const bool isInitialized = cache::client()->isInitialized();
                 const bool isValid       = cache::client()->isFormatValid();
 
-                if (isInitialized && !isValid) {
+                if (isInitialized && !isValid && cache::client()->runMigrations()) {
+                        loadStateFromCache();
+                        return;
+                } else if (isInitialized && !isValid) {
                         nhlog::db()->warn("breaking changes in cache");
                         // TODO: Deleting session data but keep using the
                         //	 same device doesn't work.
@@ -802,8 +817,6 @@ ChatPage::loadStateFromCache()
                         olm::client()->load(cache::client()->restoreOlmAccount(),
                                             STORAGE_SECRET_KEY);
 
-                        cache::client()->populateMembers();
-
                         emit initializeEmptyViews(cache::client()->roomMessages());
                         emit initializeRoomList(cache::client()->roomInfo());
 
@@ -959,6 +972,9 @@ ChatPage::updateRoomNotificationCount(const QString &room_id, uint16_t notificat
 void
 ChatPage::sendDesktopNotifications(const mtx::responses::Notifications &res)
 {
+        // Share a single read transaction for all the cache lookups.
+        ReadSnapshot snapshot(cache::client());
+
         for (const auto &item : res.notifications) {
                 const auto event_id = utils::event_id(item.event);
 
@@ -1043,15 +1059,31 @@ ChatPage::trySync()
         if (!connectivityTimer_.isActive())
                 connectivityTimer_.start();
 
-        try {
-                opts.since = cache::client()->nextBatchToken();
-        } catch (const lmdb::error &e) {
-                nhlog::db()->error("failed to retrieve next batch token: {}", e.what());
-                return;
+        {
+                std::unique_lock<std::mutex> lock(nextBatchMtx_);
+                opts.since = nextBatch_;
         }
 
+        // Nothing has been received since startup, so resume from the saved state.
+        if (opts.since.empty()) {
+                try {
+                        opts.since = cache::client()->nextBatchToken();
+                } catch (const lmdb::error &e) {
+                        nhlog::db()->error("failed to retrieve next batch token: {}", e.what());
+                        return;
+                }
+        }
+
+        const auto requested  = std::chrono::steady_clock::now();
+        const auto generation = syncGeneration_.load();
+
         http::client()->sync(
-          opts, [this](const mtx::responses::Sync &res, mtx::http::RequestErr err) {
+          opts,
+          [this, requested, generation](const mtx::responses::Sync &res,
+                                        mtx::http::RequestErr err) {
+                  if (generation != syncGeneration_)
+                          return;
+
                   if (err) {
                           const auto error      = QString::fromStdString(err->matrix_error.error);
                           const auto msg        = tr("Please try to login again: %1").arg(error);
@@ -1092,28 +1124,124 @@ ChatPage::trySync()
 
                   nhlog::net()->debug("sync completed: {}", res.next_batch);
 
-                  // Ensure that we have enough one-time keys available.
-                  ensureOneTimeKeyCount(res.device_one_time_keys_count);
+                  const auto received = std::chrono::steady_clock::now();
 
-                  // TODO: fine grained error handling
-                  try {
-                          cache::client()->saveState(res);
-                          olm::handle_to_device_messages(res.to_device);
+                  {
+                          std::unique_lock<std::mutex> lock(nextBatchMtx_);
+                          nextBatch_ = res.next_batch;
+                  }
 
-                          emit syncUI(res.rooms);
+                  auto response = std::make_shared<mtx::responses::Sync>(res);
+                  syncQueue_.push([this, response, requested, received, generation]() {
+                          if (generation != syncGeneration_)
+                                  return;
 
-                          auto updates = cache::client()->roomUpdates(res);
+                          if (!processSync(*response, requested, received)) {
+                                  restartSync(generation);
+                                  return;
+                          }
 
-                          emit syncTopBar(updates);
-                          emit syncRoomlist(updates);
-                  } catch (const lmdb::error &e) {
-                          nhlog::db()->error("saving sync response: {}", e.what());
-                  }
+                          if (syncQueue_.hasCapacity() && syncDeferred_.exchange(false))
+                                  emit trySyncCb();
+                  });
 
-                  emit trySyncCb();
+                  // The next request doesn't have to wait for the response to be saved,
+                  // unless the queue is already backed up.
+                  syncDeferred_ = true;
+                  if (syncQueue_.hasCapacity() && syncDeferred_.exchange(false))
+                          emit trySyncCb();
           });
 }
 
+bool
+ChatPage::processSync(const mtx::responses::Sync &res,
+                      std::chrono::steady_clock::time_point requested,
+                      std::chrono::steady_clock::time_point received)
+{
+        using namespace std::chrono;
+
+        if (!http::is_logged_in())
+                return true;
+
+        const auto started = steady_clock::now();
+        auto saved         = started;
+
+        try {
+                cache::client()->saveState(res);
+        } catch (const lmdb::error &e) {
+                nhlog::db()->error("saving sync response: {}", e.what());
+                return false;
+        }
+
+        // TODO: fine grained error handling
+        try {
+                olm::handle_to_device_messages(res.to_device);
+
+                // Ensure that we have enough one-time keys available.
+                ensureOneTimeKeyCount(res.device_one_time_keys_count);
+
+                saved = steady_clock::now();
+
+                emit syncUI(res.rooms);
+
+                auto updates = cache::client()->roomUpdates(res);
+
+                emit syncTopBar(updates);
+                emit syncRoomlist(updates);
+        } catch (const lmdb::error &e) {
+                nhlog::db()->error("processing sync response: {}", e.what());
+        }
+
+        const auto finished = steady_clock::now();
+
+        nhlog::net()->debug("sync stages: network {}ms, queued {}ms, save {}ms, updates {}ms",
+                            duration_cast<milliseconds>(received - requested).count(),
+                            duration_cast<milliseconds>(started - received).count(),
+                            duration_cast<milliseconds>(saved - started).count(),
+                            duration_cast<milliseconds>(finished - saved).count());
+
+        return true;
+}
+
+void
+ChatPage::resetSync()
+{
+        syncGeneration_ += 1;
+        syncQueue_.clear();
+        syncDeferred_ = false;
+
+        std::unique_lock<std::mutex> lock(nextBatchMtx_);
+        nextBatch_.clear();
+}
+
+void
+ChatPage::restartSync(uint64_t generation)
+{
+        // A concurrent reset (e.g. a logout) takes precedence.
+        if (!syncGeneration_.compare_exchange_strong(generation, generation + 1))
+                return;
+
+        syncQueue_.clear();
+        syncDeferred_ = false;
+
+        std::string token;
+        try {
+                token = cache::client()->nextBatchToken();
+        } catch (const lmdb::error &e) {
+                nhlog::db()->error("failed to retrieve next batch token: {}", e.what());
+        }
+
+        {
+                std::unique_lock<std::mutex> lock(nextBatchMtx_);
+                nextBatch_ = token;
+        }
+
+        nhlog::net()->warn("restarting sync from the last saved token: {}", token);
+
+        if (http::is_logged_in())
+                emit tryDelayedSyncCb();
+}
+
 void
 ChatPage::joinRoom(const QString &room)
 {
@@ -1275,9 +1403,9 @@ ChatPage::getProfileInfo()
                   emit setUserDisplayName(QString::fromStdString(res.display_name));
 
                   if (cache::client()) {
-                          auto data = cache::client()->image(res.avatar_url);
-                          if (!data.isNull()) {
-                                  emit setUserAvatar(QImage::fromData(data));
+                          auto img = cache::client()->decodeImage(res.avatar_url);
+                          if (!img.isNull()) {
+                                  emit setUserAvatar(img);
                                   return;
                           }
                   }
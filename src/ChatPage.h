@@ -18,6 +18,8 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <mutex>
 
 #include <QFrame>
 #include <QHBoxLayout>
@@ -29,6 +31,7 @@
 #include "Cache.h"
 #include "CommunitiesList.h"
 #include "MatrixClient.h"
+#include "WorkQueue.h"
 #include "notifications/Manager.h"
 
 class OverlayModal;
@@ -51,6 +54,8 @@ class ReadReceipts;
 constexpr int CONSENSUS_TIMEOUT      = 1000;
 constexpr int SHOW_CONTENT_TIMEOUT   = 3000;
 constexpr int TYPING_REFRESH_TIMEOUT = 10000;
+//! Sync responses that may wait to be saved before we stop requesting new ones.
+constexpr std::size_t SYNC_QUEUE_CAPACITY = 2;
 
 class ChatPage : public QWidget
 {
@@ -170,6 +175,20 @@ private:
         void initialSyncHandler(const mtx::responses::Sync &res, mtx::http::RequestErr err);
         void tryInitialSync();
         void trySync();
+        //! Save a sync response & push the changes to the UI.
+        //!
+        //! Runs on the sync queue, in the order the responses were received. Returns
+        //! false if the response couldn't be saved.
+        bool processSync(const mtx::responses::Sync &res,
+                         std::chrono::steady_clock::time_point requested,
+                         std::chrono::steady_clock::time_point received);
+        //! Stop processing the queued sync responses & forget the batch token. The
+        //! response of the request in flight is ignored.
+        void resetSync();
+        //! Drop the responses that follow one that couldn't be saved & request them
+        //! again, starting from the last saved token. Does nothing if the sync was reset
+        //! since the given generation.
+        void restartSync(uint64_t generation);
         void ensureOneTimeKeyCount(const std::map<std::string, uint16_t> &counts);
         void getProfileInfo();
 
@@ -247,6 +266,19 @@ private:
         QSharedPointer<UserSettings> userSettings_;
 
         NotificationsManager notificationsManager;
+
+        //! Token of the last received sync response. It might not be saved yet.
+        std::mutex nextBatchMtx_;
+        std::string nextBatch_;
+        //! Whether the next sync request waits for the queue to drain.
+        std::atomic_bool syncDeferred_;
+        //! Bumped when the sync is reset. Responses & queued jobs of an older generation
+        //! are dropped.
+        std::atomic<uint64_t> syncGeneration_{0};
+
+        //! Saves the sync responses in the background. Destroyed first, so the
+        //! queued jobs don't outlive the page.
+        WorkQueue syncQueue_;
 };
 
 template<class Collection>
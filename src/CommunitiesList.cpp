@@ -151,11 +151,9 @@ CommunitiesList::highlightSelectedCommunity(const QString &community_id)
 void
 CommunitiesList::fetchCommunityAvatar(const QString &id, const QString &avatarUrl)
 {
-        auto savedImgData = cache::client()->image(avatarUrl);
-        if (!savedImgData.isNull()) {
-                QPixmap pix;
-                pix.loadFromData(savedImgData);
-                emit avatarRetrieved(id, pix);
+        auto savedImg = cache::client()->decodeImage(avatarUrl);
+        if (!savedImg.isNull()) {
+                emit avatarRetrieved(id, QPixmap::fromImage(savedImg));
                 return;
         }
 
@@ -0,0 +1,106 @@
+#include "EditDistance.h"
+
+#include <algorithm>
+#include <vector>
+
+int
+utils::levenshtein_distance(const std::string &s1, const std::string &s2)
+{
+        return EditDistance(s1)(s2);
+}
+
+utils::EditDistance::EditDistance(const std::string &query)
+  : query_{query}
+{
+        if (query_.size() > 64)
+                return;
+
+        for (std::size_t i = 0; i < query_.size(); ++i)
+                positions_[static_cast<unsigned char>(query_[i])] |= uint64_t(1) << i;
+}
+
+int
+utils::EditDistance::operator()(const std::string &s, int cutoff) const
+{
+        if (s.empty())
+                return -1;
+        if (query_.size() == 1)
+                return s.find(query_);
+        if (query_.empty())
+                return 0;
+
+        if (query_.size() > 64)
+                return dynamic(s);
+
+        return bitParallel(s, cutoff);
+}
+
+int
+utils::EditDistance::bitParallel(const std::string &s, int cutoff) const
+{
+        const int nlen      = query_.size();
+        const uint64_t last = uint64_t(1) << (nlen - 1);
+
+        // Vertical deltas of the current column, +1 & -1 respectively.
+        uint64_t pv = ~uint64_t(0);
+        uint64_t mv = 0;
+
+        // The first column is the distance to an empty string.
+        int score = nlen;
+        int best  = nlen;
+
+        const int hlen = s.size();
+        for (int j = 0; j < hlen; ++j) {
+                const uint64_t eq = positions_[static_cast<unsigned char>(s[j])];
+                const uint64_t xv = eq | mv;
+                const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+
+                // Horizontal deltas. Since characters can be skipped at the start of the
+                // string, the first row is all zeroes & nothing is carried into it.
+                uint64_t ph = mv | ~(xh | pv);
+                uint64_t mh = pv & xh;
+
+                if (ph & last)
+                        ++score;
+                else if (mh & last)
+                        --score;
+
+                ph <<= 1;
+                mh <<= 1;
+
+                pv = mh | ~(xv | ph);
+                mv = ph & xv;
+
+                best = std::min(best, score);
+
+                // Each remaining column can lower the score by one at most.
+                if (best == 0 || (best >= cutoff && score - (hlen - j - 1) >= cutoff))
+                        break;
+        }
+
+        return best;
+}
+
+int
+utils::EditDistance::dynamic(const std::string &s) const
+{
+        const int nlen = query_.size();
+        const int hlen = s.size();
+
+        std::vector<int> row1(hlen + 1, 0);
+        std::vector<int> row2(hlen + 1, 0);
+
+        for (int i = 0; i < nlen; ++i) {
+                row2[0] = i + 1;
+
+                for (int j = 0; j < hlen; ++j) {
+                        const int cost = query_[i] != s[j];
+                        row2[j + 1] =
+                          std::min(row1[j + 1] + 1, std::min(row2[j] + 1, row1[j] + cost));
+                }
+
+                row1.swap(row2);
+        }
+
+        return *std::min_element(row1.begin(), row1.end());
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+namespace utils {
+
+//! Calculate the Levenshtein distance between two strings with character skipping.
+int
+levenshtein_distance(const std::string &s1, const std::string &s2);
+
+//! Computes levenshtein_distance() between a query & many strings.
+//!
+//! Queries of up to 64 bytes are matched with Myers' bit-parallel algorithm,
+//! one column of the distance matrix per byte of the string.
+class EditDistance
+{
+public:
+        explicit EditDistance(const std::string &query);
+
+        //! The distance from the query to the string. Once the distance can't get
+        //! below `cutoff` the computation stops & a value no lower than it is returned.
+        int operator()(const std::string &s, int cutoff = std::numeric_limits<int>::max()) const;
+
+private:
+        int bitParallel(const std::string &s, int cutoff) const;
+        int dynamic(const std::string &s) const;
+
+        std::string query_;
+        //! The positions of each byte value in the query, as a bit mask.
+        std::array<uint64_t, 256> positions_{};
+};
+}
@@ -0,0 +1,263 @@
+#include "InternedIds.h"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <QHash>
+
+namespace {
+struct Entry
+{
+        std::string std;
+        QString qt;
+};
+
+//! Number of entries in the first chunk. Every chunk is twice as large as the
+//! previous one, so 32 chunks hold more ids than a handle can address.
+constexpr std::size_t FIRST_CHUNK_SIZE = 256;
+constexpr std::size_t MAX_CHUNKS       = 32;
+
+//! The chunk that holds the entry at the given position & the position in the chunk.
+std::pair<std::size_t, std::size_t>
+locate(std::size_t pos)
+{
+        std::size_t chunk = 0;
+        std::size_t size  = FIRST_CHUNK_SIZE;
+
+        while (pos >= size) {
+                pos -= size;
+                size *= 2;
+                chunk += 1;
+        }
+
+        return {chunk, pos};
+}
+
+//! The string of an entry used to look it up, and its hash.
+template<class String>
+struct Key;
+
+template<>
+struct Key<std::string>
+{
+        static std::size_t hash(const std::string &id) { return std::hash<std::string>()(id); }
+        static const std::string &of(const Entry &entry) { return entry.std; }
+};
+
+template<>
+struct Key<QString>
+{
+        static std::size_t hash(const QString &id) { return qHash(id); }
+        static const QString &of(const Entry &entry) { return entry.qt; }
+};
+
+//! Open addressing hash set of handles, probed linearly. Empty slots hold None.
+struct Slots
+{
+        explicit Slots(std::size_t size)
+          : mask{size - 1}
+          , handles{new std::atomic<ids::Id>[size]()}
+        {}
+
+        const std::size_t mask;
+        std::unique_ptr<std::atomic<ids::Id>[]> handles;
+};
+
+//! The handles of the ids by one of their string types.
+//!
+//! Slots are filled & never emptied, so they can be probed without a lock. Once they
+//! are half full they're copied to twice as many slots. The old slots are kept, since
+//! readers might still be probing them, which takes less memory than the new ones.
+template<class String>
+struct Index
+{
+        std::atomic<const Slots *> current{nullptr};
+        std::vector<std::unique_ptr<Slots>> generations;
+        std::size_t count = 0;
+};
+
+//! Append-only table of the ids.
+//!
+//! The entries are stored in chunks that are never reallocated. A new entry is
+//! written, then its handle is added to the indexes & the size is increased last,
+//! so readers only have to load the size to know which entries they can access.
+//! An id becomes visible through both string types at once. Only additions take
+//! the mutex.
+struct Table
+{
+        std::mutex mtx;
+        //! The entry of an id is at the position of its handle minus one.
+        std::array<std::unique_ptr<Entry[]>, MAX_CHUNKS> chunks;
+        std::atomic<std::size_t> size{0};
+        Index<std::string> byStd;
+        Index<QString> byQt;
+
+        ids::Id add(std::string std, QString qt)
+        {
+                const auto pos = size.load(std::memory_order_relaxed);
+                const auto id  = static_cast<ids::Id>(pos + 1);
+
+                const auto loc = locate(pos);
+                auto &chunk    = chunks[loc.first];
+                if (!chunk)
+                        chunk.reset(new Entry[FIRST_CHUNK_SIZE << loc.first]);
+
+                chunk[loc.second] = {std::move(std), std::move(qt)};
+
+                insert(byStd, id);
+                insert(byQt, id);
+
+                size.store(pos + 1, std::memory_order_release);
+
+                return id;
+        }
+
+        const Entry *at(ids::Id id) const
+        {
+                if (id == ids::None || id > size.load(std::memory_order_acquire))
+                        return nullptr;
+
+                return &entry(id);
+        }
+
+        //! The entry of a handle that was added, or is being added, to an index.
+        const Entry &entry(ids::Id id) const
+        {
+                const auto loc = locate(id - 1);
+                return chunks[loc.first][loc.second];
+        }
+
+        template<class String>
+        ids::Id find(const Index<String> &index, const String &id) const
+        {
+                const auto slots = index.current.load(std::memory_order_acquire);
+                if (!slots)
+                        return ids::None;
+
+                for (auto i = Key<String>::hash(id) & slots->mask;; i = (i + 1) & slots->mask) {
+                        const auto handle = slots->handles[i].load(std::memory_order_acquire);
+                        if (handle == ids::None)
+                                return ids::None;
+
+                        // The id might still be in the middle of its addition.
+                        if (Key<String>::of(entry(handle)) == id)
+                                return at(handle) ? handle : ids::None;
+                }
+        }
+
+        template<class String>
+        void insert(Index<String> &index, ids::Id id)
+        {
+                auto slots = index.current.load(std::memory_order_relaxed);
+
+                if (!slots || (index.count + 1) * 2 > slots->mask + 1) {
+                        std::unique_ptr<Slots> larger(
+                          new Slots(slots ? (slots->mask + 1) * 2 : FIRST_CHUNK_SIZE * 2));
+
+                        if (slots) {
+                                for (std::size_t i = 0; i <= slots->mask; ++i) {
+                                        const auto handle =
+                                          slots->handles[i].load(std::memory_order_relaxed);
+                                        if (handle != ids::None)
+                                                place<String>(*larger, handle);
+                                }
+                        }
+
+                        slots = larger.get();
+                        index.generations.push_back(std::move(larger));
+                        index.current.store(slots, std::memory_order_release);
+                }
+
+                place<String>(*slots, id);
+                index.count += 1;
+        }
+
+        template<class String>
+        void place(const Slots &slots, ids::Id id) const
+        {
+                auto i = Key<String>::hash(Key<String>::of(entry(id))) & slots.mask;
+                while (slots.handles[i].load(std::memory_order_relaxed) != ids::None)
+                        i = (i + 1) & slots.mask;
+
+                slots.handles[i].store(id, std::memory_order_release);
+        }
+};
+
+Table &
+table()
+{
+        static Table instance;
+        return instance;
+}
+}
+
+namespace ids {
+
+Id
+intern(const std::string &id)
+{
+        auto &t = table();
+
+        const auto found = t.find(t.byStd, id);
+        if (found != None)
+                return found;
+
+        std::unique_lock<std::mutex> lock(t.mtx);
+
+        // Another thread might have added it in the meantime.
+        const auto added = t.find(t.byStd, id);
+        return added != None ? added : t.add(id, QString::fromStdString(id));
+}
+
+Id
+intern(const QString &id)
+{
+        auto &t = table();
+
+        const auto found = t.find(t.byQt, id);
+        if (found != None)
+                return found;
+
+        std::unique_lock<std::mutex> lock(t.mtx);
+
+        const auto added = t.find(t.byQt, id);
+        return added != None ? added : t.add(id.toStdString(), id);
+}
+
+Id
+find(const std::string &id)
+{
+        auto &t = table();
+        return t.find(t.byStd, id);
+}
+
+Id
+find(const QString &id)
+{
+        auto &t = table();
+        return t.find(t.byQt, id);
+}
+
+const std::string &
+toStdString(Id id)
+{
+        static const std::string empty;
+
+        const auto entry = table().at(id);
+        return entry ? entry->std : empty;
+}
+
+const QString &
+toQString(Id id)
+{
+        static const QString empty;
+
+        const auto entry = table().at(id);
+        return entry ? entry->qt : empty;
+}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <QString>
+
+//! Process-wide table of the room & user ids seen by the client.
+//!
+//! Every id is stored once, in both string types, and is identified by a small
+//! integer handle. Handles are cheap to hash & compare, so they can be used as keys
+//! instead of the ids themselves. Ids are never removed from the table & never move,
+//! so looking up the id behind a handle or the handle of an id doesn't take a lock.
+//! Only adding an id does.
+//!
+//! All the functions are thread-safe.
+namespace ids {
+
+//! Handle of an interned id. No id ever gets the None handle.
+using Id = uint32_t;
+
+constexpr Id None = 0;
+
+//! The handle of the id, adding the id to the table if needed.
+Id
+intern(const std::string &id);
+Id
+intern(const QString &id);
+
+//! The handle of the id if it has been interned, None otherwise.
+Id
+find(const std::string &id);
+Id
+find(const QString &id);
+
+//! The id behind the handle. Empty for None. The reference stays valid for the
+//! lifetime of the process.
+const std::string &
+toStdString(Id id);
+const QString &
+toQString(Id id);
+}
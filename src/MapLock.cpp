@@ -0,0 +1,73 @@
+#include "MapLock.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+//! Number of locks the current thread holds on each mutex.
+thread_local std::vector<std::pair<const std::shared_timed_mutex *, int>> heldLocks;
+
+std::vector<std::pair<const std::shared_timed_mutex *, int>>::iterator
+findHeld(const std::shared_timed_mutex &mtx)
+{
+        return std::find_if(heldLocks.begin(), heldLocks.end(), [&mtx](const auto &held) {
+                return held.first == &mtx;
+        });
+}
+}
+
+MapLock::MapLock(std::shared_timed_mutex &mtx)
+  : mtx_{&mtx}
+{
+        auto it = findHeld(mtx);
+        if (it != heldLocks.end()) {
+                it->second += 1;
+                return;
+        }
+
+        mtx.lock_shared();
+        heldLocks.emplace_back(&mtx, 1);
+}
+
+MapLock::~MapLock() { unlock(); }
+
+MapLock::MapLock(MapLock &&other) noexcept
+  : mtx_{other.mtx_}
+{
+        other.mtx_ = nullptr;
+}
+
+MapLock &
+MapLock::operator=(MapLock &&other) noexcept
+{
+        if (this != &other) {
+                unlock();
+
+                mtx_       = other.mtx_;
+                other.mtx_ = nullptr;
+        }
+
+        return *this;
+}
+
+void
+MapLock::unlock()
+{
+        if (!mtx_)
+                return;
+
+        auto it = findHeld(*mtx_);
+        if (it != heldLocks.end() && --it->second == 0) {
+                heldLocks.erase(it);
+                mtx_->unlock_shared();
+        }
+
+        mtx_ = nullptr;
+}
+
+bool
+MapLock::isHeld(const std::shared_timed_mutex &mtx)
+{
+        return findHeld(mtx) != heldLocks.end();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <shared_mutex>
+
+//! Shared lock on the memory map of the cache, that keeps it from being resized.
+//!
+//! The lock is re-entrant within a thread: only the outermost lock of a thread locks
+//! the mutex. Taking a shared lock twice on the same thread is undefined behaviour &
+//! with a writer-preferring mutex, the second one waits behind a pending resize,
+//! which waits for the first one. Locks can be released in any order, but only by
+//! the thread that took them.
+class MapLock
+{
+public:
+        MapLock() = default;
+        explicit MapLock(std::shared_timed_mutex &mtx);
+        ~MapLock();
+
+        MapLock(MapLock &&other) noexcept;
+        MapLock &operator=(MapLock &&other) noexcept;
+
+        MapLock(const MapLock &) = delete;
+        MapLock &operator=(const MapLock &) = delete;
+
+        void unlock();
+
+        //! Whether the calling thread holds a lock on the mutex.
+        static bool isHeld(const std::shared_timed_mutex &mtx);
+
+private:
+        std::shared_timed_mutex *mtx_ = nullptr;
+};
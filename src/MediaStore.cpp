@@ -0,0 +1,347 @@
+#include "MediaStore.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+
+#include "CacheCodec.h"
+#include "Logging.h"
+
+namespace {
+constexpr auto BLOBS_DB("blobs");
+constexpr auto ENTRIES_DB("entries");
+constexpr auto ACCESS_DB("access");
+constexpr auto META_DB("meta");
+
+static const lmdb::val TOTAL_SIZE_KEY("total_size");
+
+//! Room left in the memory map for the pages LMDB keeps around during writes.
+constexpr std::size_t MAP_SIZE_FACTOR = 2;
+//! After an eviction the store is brought down to this fraction of its limit.
+constexpr std::size_t EVICTION_TARGET_PERCENT = 90;
+//! Files bigger than this fraction of the limit are not stored.
+constexpr std::size_t MAX_FILE_SIZE_DIVISOR = 8;
+//! Number of lookups to collect before their access times are written.
+constexpr std::size_t ACCESS_FLUSH_THRESHOLD = 64;
+
+struct Entry
+{
+        uint64_t accessed = 0;
+        uint64_t size     = 0;
+};
+
+std::string
+encodeEntry(const Entry &entry)
+{
+        cache::codec::Writer w;
+        w.u64(entry.accessed);
+        w.u64(entry.size);
+
+        return w.take();
+}
+
+bool
+decodeEntry(const lmdb::val &v, Entry &entry)
+{
+        cache::codec::Reader r(v.data(), v.size());
+
+        entry.accessed = r.u64();
+        entry.size     = r.u64();
+
+        return r.ok();
+}
+
+//! Entries sort by access time, with the same layout as the timeline message keys.
+std::string
+accessKey(uint64_t accessed, const std::string &key)
+{
+        return cache::codec::messageKey(accessed, key);
+}
+
+uint64_t
+now()
+{
+        return static_cast<uint64_t>(QDateTime::currentMSecsSinceEpoch());
+}
+
+uint64_t
+totalSize(lmdb::txn &txn, lmdb::dbi &db)
+{
+        lmdb::val value;
+        if (!lmdb::dbi_get(txn, db, TOTAL_SIZE_KEY, value))
+                return 0;
+
+        cache::codec::Reader r(value.data(), value.size());
+        const auto total = r.u64();
+
+        return r.ok() ? total : 0;
+}
+
+void
+setTotalSize(lmdb::txn &txn, lmdb::dbi &db, uint64_t total)
+{
+        cache::codec::Writer w;
+        w.u64(total);
+
+        lmdb::dbi_put(txn, db, TOTAL_SIZE_KEY, lmdb::val(w.take()));
+}
+}
+
+MediaStore::MediaStore(const QString &path, std::size_t maxSize)
+  : env_{nullptr}
+  , blobsDb_{0}
+  , entriesDb_{0}
+  , accessDb_{0}
+  , metaDb_{0}
+  , maxSize_{maxSize}
+{
+        if (!QDir().mkpath(path))
+                throw std::runtime_error(
+                  ("Unable to create media directory:" + path).toStdString().c_str());
+
+        env_ = lmdb::env::create();
+        env_.set_mapsize(maxSize_ * MAP_SIZE_FACTOR);
+        env_.set_max_dbs(4);
+
+        try {
+                env_.open(path.toStdString().c_str(), MDB_NOTLS);
+        } catch (const lmdb::error &e) {
+                if (e.code() != MDB_VERSION_MISMATCH && e.code() != MDB_INVALID)
+                        throw;
+
+                // The files can always be downloaded again.
+                nhlog::db()->warn("resetting media store: {}", e.what());
+
+                QDir mediaDir(path);
+                for (const auto &file : mediaDir.entryList(QDir::Files))
+                        mediaDir.remove(file);
+
+                env_.open(path.toStdString().c_str(), MDB_NOTLS);
+        }
+
+        auto txn   = lmdb::txn::begin(env_);
+        blobsDb_   = lmdb::dbi::open(txn, BLOBS_DB, MDB_CREATE);
+        entriesDb_ = lmdb::dbi::open(txn, ENTRIES_DB, MDB_CREATE);
+        accessDb_  = lmdb::dbi::open(txn, ACCESS_DB, MDB_CREATE);
+        metaDb_    = lmdb::dbi::open(txn, META_DB, MDB_CREATE);
+        txn.commit();
+}
+
+std::string
+MediaStore::key(const std::string &url)
+{
+        const auto hash = QCryptographicHash::hash(QByteArray::fromStdString(url),
+                                                   QCryptographicHash::Sha256);
+
+        return hash.toStdString();
+}
+
+void
+MediaStore::save(const std::string &url, const std::string &data)
+{
+        if (url.empty() || data.empty())
+                return;
+
+        if (data.size() > maxSize_ / MAX_FILE_SIZE_DIVISOR) {
+                nhlog::db()->debug("not storing {}: {} bytes", url, data.size());
+                return;
+        }
+
+        const auto k = key(url);
+
+        auto txn = lmdb::txn::begin(env_);
+
+        flushAccessTimes(txn);
+
+        auto total = totalSize(txn, metaDb_);
+
+        lmdb::val value;
+        if (lmdb::dbi_get(txn, entriesDb_, lmdb::val(k), value)) {
+                Entry old;
+                if (decodeEntry(value, old)) {
+                        lmdb::dbi_del(txn, accessDb_, lmdb::val(accessKey(old.accessed, k)));
+                        total -= std::min<uint64_t>(old.size, total);
+                }
+        }
+
+        Entry entry;
+        entry.accessed = now();
+        entry.size     = data.size();
+
+        lmdb::dbi_put(txn, blobsDb_, lmdb::val(k), lmdb::val(data.data(), data.size()));
+        lmdb::dbi_put(txn, entriesDb_, lmdb::val(k), lmdb::val(encodeEntry(entry)));
+        lmdb::dbi_put(txn, accessDb_, lmdb::val(accessKey(entry.accessed, k)), lmdb::val(""));
+
+        setTotalSize(txn, metaDb_, total + entry.size);
+
+        evict(txn);
+
+        txn.commit();
+}
+
+QByteArray
+MediaStore::get(const std::string &url)
+{
+        if (url.empty())
+                return QByteArray();
+
+        const auto k = key(url);
+
+        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+
+        lmdb::val data;
+        if (!lmdb::dbi_get(txn, blobsDb_, lmdb::val(k), data))
+                return QByteArray();
+
+        QByteArray result(data.data(), data.size());
+        txn.commit();
+
+        touch(k);
+
+        return result;
+}
+
+QImage
+MediaStore::decodeImage(const std::string &url)
+{
+        if (url.empty())
+                return QImage();
+
+        const auto k = key(url);
+
+        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+
+        lmdb::val data;
+        if (!lmdb::dbi_get(txn, blobsDb_, lmdb::val(k), data))
+                return QImage();
+
+        auto image = QImage::fromData(QByteArray::fromRawData(data.data(), data.size()));
+        txn.commit();
+
+        touch(k);
+
+        return image;
+}
+
+std::size_t
+MediaStore::size()
+{
+        auto txn         = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        const auto total = totalSize(txn, metaDb_);
+        txn.commit();
+
+        return total;
+}
+
+void
+MediaStore::touch(const std::string &key)
+{
+        bool shouldFlush = false;
+        {
+                std::unique_lock<std::mutex> lock(pendingMtx_);
+                pendingAccess_[key] = now();
+
+                shouldFlush = pendingAccess_.size() >= ACCESS_FLUSH_THRESHOLD;
+        }
+
+        if (!shouldFlush)
+                return;
+
+        try {
+                auto txn = lmdb::txn::begin(env_);
+                flushAccessTimes(txn);
+                txn.commit();
+        } catch (const lmdb::error &e) {
+                nhlog::db()->warn("failed to update media access times: {}", e.what());
+        }
+}
+
+void
+MediaStore::flushAccessTimes(lmdb::txn &txn)
+{
+        std::unordered_map<std::string, uint64_t> pending;
+        {
+                std::unique_lock<std::mutex> lock(pendingMtx_);
+                pending.swap(pendingAccess_);
+        }
+
+        for (const auto &access : pending) {
+                lmdb::val value;
+                if (!lmdb::dbi_get(txn, entriesDb_, lmdb::val(access.first), value))
+                        continue;
+
+                Entry entry;
+                if (!decodeEntry(value, entry) || entry.accessed >= access.second)
+                        continue;
+
+                lmdb::dbi_del(txn, accessDb_, lmdb::val(accessKey(entry.accessed, access.first)));
+
+                entry.accessed = access.second;
+
+                const auto newKey = accessKey(entry.accessed, access.first);
+
+                lmdb::dbi_put(
+                  txn, entriesDb_, lmdb::val(access.first), lmdb::val(encodeEntry(entry)));
+                lmdb::dbi_put(txn, accessDb_, lmdb::val(newKey), lmdb::val(""));
+        }
+}
+
+void
+MediaStore::evict(lmdb::txn &txn)
+{
+        auto total = totalSize(txn, metaDb_);
+
+        if (total <= maxSize_)
+                return;
+
+        const uint64_t target = maxSize_ * EVICTION_TARGET_PERCENT / 100;
+
+        std::vector<std::string> evicted;
+        {
+                lmdb::val access, unused;
+
+                auto cursor = lmdb::cursor::open(txn, accessDb_);
+                while (total > target && cursor.get(access, unused, MDB_NEXT)) {
+                        if (access.size() < sizeof(uint64_t))
+                                continue;
+
+                        // Strip the timestamp prefix.
+                        std::string k(access.data() + sizeof(uint64_t),
+                                      access.size() - sizeof(uint64_t));
+
+                        lmdb::val value;
+                        Entry entry;
+                        if (lmdb::dbi_get(txn, entriesDb_, lmdb::val(k), value) &&
+                            decodeEntry(value, entry))
+                                total -= std::min<uint64_t>(entry.size, total);
+
+                        evicted.emplace_back(std::move(k));
+                }
+                cursor.close();
+        }
+
+        for (const auto &k : evicted)
+                remove(txn, k);
+
+        setTotalSize(txn, metaDb_, total);
+
+        nhlog::db()->debug("evicted {} media files, {} bytes left", evicted.size(), total);
+}
+
+void
+MediaStore::remove(lmdb::txn &txn, const std::string &key)
+{
+        lmdb::val value;
+        if (lmdb::dbi_get(txn, entriesDb_, lmdb::val(key), value)) {
+                Entry entry;
+                if (decodeEntry(value, entry))
+                        lmdb::dbi_del(txn, accessDb_, lmdb::val(accessKey(entry.accessed, key)));
+        }
+
+        lmdb::dbi_del(txn, entriesDb_, lmdb::val(key), nullptr);
+        lmdb::dbi_del(txn, blobsDb_, lmdb::val(key), nullptr);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+#include <lmdb++.h>
+
+//! Size limited store for downloaded media (avatars & thumbnails).
+//!
+//! The files are kept in their own LMDB environment, so saving them never waits
+//! for the writer of the sync state. Entries are keyed by the hash of their mxc
+//! url and the least recently used ones are evicted once the store grows past
+//! its size limit.
+class MediaStore
+{
+public:
+        MediaStore(const QString &path, std::size_t maxSize);
+
+        void save(const std::string &url, const std::string &data);
+        //! Retrieve a copy of the stored file.
+        QByteArray get(const std::string &url);
+        //! Decode an image straight from the memory map.
+        QImage decodeImage(const std::string &url);
+
+        //! Total size of the stored files in bytes.
+        std::size_t size();
+
+private:
+        //! Fixed size key derived from the url.
+        static std::string key(const std::string &url);
+
+        //! Record the access time of an entry.
+        //!
+        //! The times are kept in memory and written along with the next change,
+        //! so lookups only need a read-only transaction.
+        void touch(const std::string &key);
+        void flushAccessTimes(lmdb::txn &txn);
+        //! Remove the least recently used entries until the store fits its limit.
+        void evict(lmdb::txn &txn);
+        void remove(lmdb::txn &txn, const std::string &key);
+
+        lmdb::env env_;
+        //! key -> file contents.
+        lmdb::dbi blobsDb_;
+        //! key -> last access time & size.
+        lmdb::dbi entriesDb_;
+        //! Big endian access time followed by the key, for walking entries in LRU order.
+        lmdb::dbi accessDb_;
+        //! Bookkeeping like the total size of the files.
+        lmdb::dbi metaDb_;
+
+        std::size_t maxSize_;
+
+        std::mutex pendingMtx_;
+        std::unordered_map<std::string, uint64_t> pendingAccess_;
+};
@@ -0,0 +1,351 @@
+#include "MemberDirectory.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+
+using ReadLock  = std::shared_lock<std::shared_timed_mutex>;
+using WriteLock = std::unique_lock<std::shared_timed_mutex>;
+
+MemberDirectory::MemberDirectory(std::size_t capacity)
+  : capacity_{capacity}
+{}
+
+boost::optional<MemberProfile>
+MemberDirectory::find(ids::Id room_id, ids::Id user_id) const
+{
+        const auto &s = shard(room_id);
+        ReadLock lock(s.mtx);
+
+        auto room = s.rooms.find(room_id);
+        if (room == s.rooms.end() || !room->second.isLoaded)
+                return boost::none;
+
+        room->second.lastUsed.store(tick(), std::memory_order_relaxed);
+
+        auto member = room->second.members.find(user_id);
+        if (member == room->second.members.end())
+                return boost::none;
+
+        return member->second;
+}
+
+bool
+MemberDirectory::isLoaded(ids::Id room_id) const
+{
+        const auto &s = shard(room_id);
+        ReadLock lock(s.mtx);
+
+        auto room = s.rooms.find(room_id);
+        return room != s.rooms.end() && room->second.isLoaded;
+}
+
+boost::optional<std::vector<MemberMatch>>
+MemberDirectory::complete(ids::Id room_id, const QString &prefix, std::size_t max_items)
+{
+        auto &s = shard(room_id);
+
+        {
+                ReadLock lock(s.mtx);
+
+                auto room = s.rooms.find(room_id);
+                if (room == s.rooms.end() || !room->second.isLoaded)
+                        return boost::none;
+
+                room->second.lastUsed.store(tick(), std::memory_order_relaxed);
+
+                if (room->second.hasTokens)
+                        return complete(room->second, speakersOf(s, room_id), prefix, max_items);
+        }
+
+        // The keys are built by the first query.
+        WriteLock lock(s.mtx);
+
+        auto room = s.rooms.find(room_id);
+        if (room == s.rooms.end() || !room->second.isLoaded)
+                return boost::none;
+
+        if (!room->second.hasTokens)
+                buildTokens(room->second);
+
+        return complete(room->second, speakersOf(s, room_id), prefix, max_items);
+}
+
+const MemberDirectory::Speakers &
+MemberDirectory::speakersOf(const Shard &s, ids::Id room_id)
+{
+        static const Speakers none;
+
+        auto it = s.speakers.find(room_id);
+        return it == s.speakers.end() ? none : it->second;
+}
+
+std::vector<MemberMatch>
+MemberDirectory::complete(const Room &room,
+                          const Speakers &speakers,
+                          const QString &prefix,
+                          std::size_t max_items)
+{
+        std::vector<ids::Id> users;
+
+        auto it = std::lower_bound(room.tokens.begin(),
+                                   room.tokens.end(),
+                                   prefix,
+                                   [](const auto &token, const QString &value) {
+                                           return token.first < value;
+                                   });
+
+        for (; it != room.tokens.end() && it->first.startsWith(prefix); ++it)
+                users.push_back(it->second);
+
+        // A member matches once per matching key.
+        std::sort(users.begin(), users.end());
+        users.erase(std::unique(users.begin(), users.end()), users.end());
+
+        const auto lastSpoke = [&speakers](ids::Id user_id) -> uint64_t {
+                auto it = speakers.find(user_id);
+                return it == speakers.end() ? 0 : it->second;
+        };
+        const auto &members = room.members;
+
+        const auto count = std::min(max_items, users.size());
+
+        std::partial_sort(users.begin(),
+                          users.begin() + count,
+                          users.end(),
+                          [&lastSpoke, &members](ids::Id a, ids::Id b) {
+                                  const auto spokeA = lastSpoke(a);
+                                  const auto spokeB = lastSpoke(b);
+
+                                  if (spokeA != spokeB)
+                                          return spokeA > spokeB;
+
+                                  return members.at(a).displayName.compare(
+                                           members.at(b).displayName, Qt::CaseInsensitive) < 0;
+                          });
+
+        std::vector<MemberMatch> matches;
+        matches.reserve(count);
+
+        for (std::size_t i = 0; i < count; ++i)
+                matches.push_back({users[i], members.at(users[i]).displayName});
+
+        return matches;
+}
+
+void
+MemberDirectory::addSpeakers(ids::Id room_id,
+                             const std::vector<std::pair<ids::Id, uint64_t>> &speakers)
+{
+        auto &s = shard(room_id);
+        WriteLock lock(s.mtx);
+
+        auto &lastSpoke = s.speakers[room_id];
+
+        for (const auto &speaker : speakers) {
+                auto &timestamp = lastSpoke[speaker.first];
+                timestamp       = std::max(timestamp, speaker.second);
+        }
+}
+
+std::vector<QString>
+MemberDirectory::tokensOf(ids::Id user_id, const MemberProfile &profile)
+{
+        const auto name = profile.displayName.toLower();
+
+        auto tokens = name.split(' ', QString::SkipEmptyParts);
+        tokens.append(name);
+
+        // The localpart of @localpart:server.
+        const auto id = ids::toQString(user_id);
+        tokens.append(id.mid(1, id.indexOf(':') - 1).toLower());
+
+        tokens.removeDuplicates();
+
+        return tokens.toVector().toStdVector();
+}
+
+void
+MemberDirectory::addTokens(Room &room, ids::Id user_id, const MemberProfile &profile)
+{
+        for (auto &text : tokensOf(user_id, profile)) {
+                auto token = std::make_pair(std::move(text), user_id);
+                room.tokens.insert(
+                  std::lower_bound(room.tokens.begin(), room.tokens.end(), token), token);
+        }
+}
+
+void
+MemberDirectory::removeTokens(Room &room, ids::Id user_id, const MemberProfile &profile)
+{
+        for (auto &text : tokensOf(user_id, profile)) {
+                const auto token = std::make_pair(std::move(text), user_id);
+
+                auto it = std::lower_bound(room.tokens.begin(), room.tokens.end(), token);
+                if (it != room.tokens.end() && *it == token)
+                        room.tokens.erase(it);
+        }
+}
+
+void
+MemberDirectory::buildTokens(Room &room)
+{
+        room.tokens.clear();
+        room.tokens.reserve(room.members.size() * 2);
+
+        for (const auto &member : room.members) {
+                for (auto &text : tokensOf(member.first, member.second))
+                        room.tokens.emplace_back(std::move(text), member.first);
+        }
+
+        std::sort(room.tokens.begin(), room.tokens.end());
+        room.hasTokens = true;
+}
+
+bool
+MemberDirectory::startLoading(ids::Id room_id)
+{
+        auto &s = shard(room_id);
+        WriteLock lock(s.mtx);
+
+        return !s.rooms[room_id].isLoaded;
+}
+
+void
+MemberDirectory::finishLoading(ids::Id room_id, Members members)
+{
+        {
+                auto &s = shard(room_id);
+                WriteLock lock(s.mtx);
+
+                auto it = s.rooms.find(room_id);
+                if (it == s.rooms.end() || it->second.isLoaded)
+                        return;
+
+                auto &room = it->second;
+
+                // The members that changed during the load are newer than the ones read.
+                for (auto &member : members) {
+                        if (room.removed.count(member.first) == 0)
+                                room.members.emplace(member.first, std::move(member.second));
+                }
+
+                room.removed.clear();
+                room.isLoaded = true;
+                room.lastUsed.store(tick(), std::memory_order_relaxed);
+        }
+
+        if (++loadedRooms_ > capacity_)
+                evict(room_id);
+}
+
+void
+MemberDirectory::failLoading(ids::Id room_id)
+{
+        auto &s = shard(room_id);
+        WriteLock lock(s.mtx);
+
+        auto it = s.rooms.find(room_id);
+        if (it != s.rooms.end() && !it->second.isLoaded)
+                s.rooms.erase(it);
+}
+
+void
+MemberDirectory::update(ids::Id room_id, const std::vector<MemberUpdate> &updates)
+{
+        auto &s = shard(room_id);
+        WriteLock lock(s.mtx);
+
+        auto speakers = s.speakers.find(room_id);
+        if (speakers != s.speakers.end()) {
+                for (const auto &update : updates) {
+                        if (!update.profile)
+                                speakers->second.erase(update.user_id);
+                }
+        }
+
+        auto it = s.rooms.find(room_id);
+        if (it == s.rooms.end())
+                return;
+
+        auto &room = it->second;
+
+        for (const auto &update : updates) {
+                auto member = room.members.find(update.user_id);
+
+                if (room.hasTokens && member != room.members.end())
+                        removeTokens(room, update.user_id, member->second);
+
+                if (update.profile) {
+                        if (member != room.members.end())
+                                member->second = *update.profile;
+                        else
+                                room.members.emplace(update.user_id, *update.profile);
+
+                        if (room.hasTokens)
+                                addTokens(room, update.user_id, *update.profile);
+
+                        room.removed.erase(update.user_id);
+                } else {
+                        if (member != room.members.end())
+                                room.members.erase(member);
+
+                        if (!room.isLoaded)
+                                room.removed.insert(update.user_id);
+                }
+        }
+}
+
+void
+MemberDirectory::clear()
+{
+        for (auto &s : shards_) {
+                WriteLock lock(s.mtx);
+
+                for (auto it = s.rooms.begin(); it != s.rooms.end();) {
+                        if (it->second.isLoaded)
+                                --loadedRooms_;
+
+                        it = s.rooms.erase(it);
+                }
+
+                s.speakers.clear();
+        }
+}
+
+void
+MemberDirectory::evict(ids::Id keep)
+{
+        while (loadedRooms_ > capacity_) {
+                auto oldest   = ids::None;
+                auto lastUsed = std::numeric_limits<uint64_t>::max();
+
+                for (const auto &s : shards_) {
+                        ReadLock lock(s.mtx);
+
+                        for (const auto &room : s.rooms) {
+                                const auto used =
+                                  room.second.lastUsed.load(std::memory_order_relaxed);
+
+                                if (room.second.isLoaded && room.first != keep &&
+                                    used < lastUsed) {
+                                        oldest   = room.first;
+                                        lastUsed = used;
+                                }
+                        }
+                }
+
+                if (oldest == ids::None)
+                        return;
+
+                auto &s = shard(oldest);
+                WriteLock lock(s.mtx);
+
+                // Another thread might have dropped it in the meantime.
+                auto it = s.rooms.find(oldest);
+                if (it != s.rooms.end() && it->second.isLoaded) {
+                        s.rooms.erase(it);
+                        --loadedRooms_;
+                }
+        }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <QString>
+#include <boost/optional.hpp>
+
+#include "InternedIds.h"
+
+//! Display name & avatar of a room member.
+struct MemberProfile
+{
+        QString displayName;
+        QString avatarUrl;
+};
+
+//! A member matching a completion query.
+struct MemberMatch
+{
+        ids::Id user_id;
+        QString displayName;
+};
+
+//! A membership change that was saved to the cache.
+struct MemberUpdate
+{
+        ids::Id user_id;
+        //! None if the user left the room.
+        boost::optional<MemberProfile> profile;
+};
+
+//! The profiles of the members of the recently used rooms, by room & by user.
+//!
+//! Rooms are loaded from the cache when they are first needed, and the least
+//! recently used ones are dropped once more than `capacity` rooms are loaded.
+//!
+//! Each loaded room can also complete the names of its members. The words of their
+//! names & their localparts are kept in a sorted list, built on the first query &
+//! updated along with the members afterwards.
+//!
+//! The directory is written from the sync thread & by the loaders, and read from
+//! the GUI thread. Rooms are spread over a fixed number of shards, each guarded by
+//! its own reader-writer lock, so a reader can only be held up by a writer updating
+//! a room of the same shard.
+class MemberDirectory
+{
+public:
+        //! Profiles by user.
+        using Members = std::unordered_map<ids::Id, MemberProfile>;
+
+        explicit MemberDirectory(std::size_t capacity);
+
+        //! The profile of a member, none if the user isn't a member of the room or
+        //! the room isn't loaded.
+        boost::optional<MemberProfile> find(ids::Id room_id, ids::Id user_id) const;
+        //! Whether all the members of the room are in the directory.
+        bool isLoaded(ids::Id room_id) const;
+
+        //! Members of a loaded room whose name, a word of their name or their localpart
+        //! starts with the prefix, which is expected to be in lower case. The latest
+        //! speakers come first, then the members by name. None if the room isn't loaded.
+        boost::optional<std::vector<MemberMatch>> complete(ids::Id room_id,
+                                                           const QString &prefix,
+                                                           std::size_t max_items);
+        //! Remember when members last sent a message, to rank the completions. Speakers
+        //! are kept even for the rooms that aren't loaded.
+        void addSpeakers(ids::Id room_id,
+                         const std::vector<std::pair<ids::Id, uint64_t>> &speakers);
+
+        //! Called before the members of a room are read from the cache. The updates
+        //! applied from then on take precedence over the members read.
+        //! Returns false if the room is already loaded.
+        bool startLoading(ids::Id room_id);
+        //! Add the members read from the cache & drop the least recently used rooms.
+        void finishLoading(ids::Id room_id, Members members);
+        //! Forget a room whose members couldn't be read or whose load was cancelled, so
+        //! it can be loaded again.
+        void failLoading(ids::Id room_id);
+
+        //! Apply membership changes after they were saved to the cache. Rooms that
+        //! aren't loaded nor loading are skipped, the cache is up to date for them.
+        void update(ids::Id room_id, const std::vector<MemberUpdate> &updates);
+        void clear();
+
+private:
+        static constexpr std::size_t SHARD_COUNT = 16;
+
+        //! Timestamp of the last message of each member.
+        using Speakers = std::unordered_map<ids::Id, uint64_t>;
+
+        struct Room
+        {
+                Members members;
+                //! Users that left while the room was loading.
+                std::unordered_set<ids::Id> removed;
+                bool isLoaded = false;
+
+                //! Completion keys of the members, sorted. Only valid if hasTokens is set.
+                std::vector<std::pair<QString, ids::Id>> tokens;
+                bool hasTokens = false;
+                //! Value of the clock when the room was last looked up.
+                mutable std::atomic<uint64_t> lastUsed{0};
+        };
+
+        struct Shard
+        {
+                mutable std::shared_timed_mutex mtx;
+                std::unordered_map<ids::Id, Room> rooms;
+                //! Speakers by room, apart from the rooms so they outlive their loads.
+                std::unordered_map<ids::Id, Speakers> speakers;
+        };
+
+        Shard &shard(ids::Id room_id) { return shards_[room_id % SHARD_COUNT]; }
+        const Shard &shard(ids::Id room_id) const { return shards_[room_id % SHARD_COUNT]; }
+
+        //! The completion keys of a member, in lower case.
+        static std::vector<QString> tokensOf(ids::Id user_id, const MemberProfile &profile);
+        static void addTokens(Room &room, ids::Id user_id, const MemberProfile &profile);
+        static void removeTokens(Room &room, ids::Id user_id, const MemberProfile &profile);
+        static void buildTokens(Room &room);
+        static std::vector<MemberMatch> complete(const Room &room,
+                                                 const Speakers &speakers,
+                                                 const QString &prefix,
+                                                 std::size_t max_items);
+        //! The speakers of a room, empty if none were added.
+        static const Speakers &speakersOf(const Shard &s, ids::Id room_id);
+
+        uint64_t tick() const { return clock_.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+        //! Drop the least recently used rooms until at most capacity_ rooms are loaded.
+        void evict(ids::Id keep);
+
+        const std::size_t capacity_;
+
+        mutable std::atomic<uint64_t> clock_{0};
+        std::atomic<std::size_t> loadedRooms_{0};
+
+        std::array<Shard, SHARD_COUNT> shards_;
+};
@@ -0,0 +1,687 @@
+#include "MessageIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+
+#include "Logging.h"
+
+namespace {
+//! document -> body
+constexpr auto DOCUMENTS_DB("message_documents");
+//! word -> postings
+constexpr auto POSTINGS_DB("message_postings");
+//! document -> words
+constexpr auto WORDS_DB("message_words");
+//! room id & event id -> key of the stored message
+constexpr auto EVENTS_DB("message_events");
+
+//! Size limit of a posting. Values of a MDB_DUPSORT database are stored as keys,
+//! so they can't be larger than the maximum key size (511 bytes by default).
+constexpr std::size_t MAX_POSTING_SIZE = 480;
+//! Longer words (e.g urls) aren't indexed.
+constexpr int MAX_WORD_LENGTH = 64;
+
+//! Characters shown before the first match & length of a snippet.
+constexpr int SNIPPET_CONTEXT = 30;
+constexpr int SNIPPET_LENGTH  = 120;
+
+//! Key of an indexed message: the room id, a NUL separator and the key of the
+//! message (see cache::codec::messageKey).
+std::string
+documentKey(const std::string &room_id, const std::string &key)
+{
+        std::string document;
+        document.reserve(room_id.size() + 1 + key.size());
+
+        document.append(room_id);
+        document.push_back('\0');
+        document.append(key);
+
+        return document;
+}
+
+//! Key of the event of an indexed message: the room id, a NUL separator and the
+//! event id, which follows the timestamp in the key of the message.
+std::string
+eventKey(const std::string &room_id, const std::string &key)
+{
+        const auto event_id = key.size() > sizeof(uint64_t) ? key.substr(sizeof(uint64_t))
+                                                            : std::string();
+
+        return documentKey(room_id, event_id);
+}
+
+bool
+parseDocument(const std::string &document,
+              std::string &room_id,
+              uint64_t &timestamp,
+              std::string &event_id)
+{
+        const auto separator = document.find('\0');
+        if (separator == std::string::npos || document.size() < separator + 1 + sizeof(timestamp))
+                return false;
+
+        room_id = document.substr(0, separator);
+
+        const auto key = separator + 1;
+
+        timestamp = 0;
+        for (std::size_t i = 0; i < sizeof(timestamp); ++i)
+                timestamp = timestamp << 8 | static_cast<unsigned char>(document[key + i]);
+
+        event_id = document.substr(key + sizeof(timestamp));
+
+        return true;
+}
+
+//! The smallest value past the postings of the room of the prefix.
+std::string
+roomEnd(const std::string &prefix)
+{
+        auto end = prefix;
+        end.back() = '\1';
+
+        return end;
+}
+
+bool
+hasPrefix(const lmdb::val &value, const std::string &prefix)
+{
+        return value.size() >= prefix.size() &&
+               std::equal(prefix.begin(), prefix.end(), value.data());
+}
+
+bool
+isWordCharacter(QChar c)
+{
+        return c.isLetterOrNumber() || c.isMark();
+}
+}
+
+void
+MessageIndex::open(lmdb::txn &txn)
+{
+        documentsDb_ = lmdb::dbi::open(txn, DOCUMENTS_DB, MDB_CREATE);
+        postingsDb_  = lmdb::dbi::open(txn, POSTINGS_DB, MDB_CREATE | MDB_DUPSORT);
+        wordsDb_     = lmdb::dbi::open(txn, WORDS_DB, MDB_CREATE);
+        eventsDb_    = lmdb::dbi::open(txn, EVENTS_DB, MDB_CREATE);
+}
+
+std::vector<MessageIndex::Token>
+MessageIndex::tokenize(const QString &text)
+{
+        std::vector<Token> tokens;
+        uint32_t position = 0;
+
+        int start = -1;
+        for (int i = 0; i <= text.size(); ++i) {
+                const bool inWord = i < text.size() && isWordCharacter(text.at(i));
+
+                if (inWord && start < 0) {
+                        start = i;
+                } else if (!inWord && start >= 0) {
+                        // Skipped words still count, so phrases don't match across them.
+                        if (i - start <= MAX_WORD_LENGTH)
+                                tokens.push_back(
+                                  {text.mid(start, i - start).toLower().toStdString(),
+                                   position,
+                                   start});
+
+                        position += 1;
+                        start = -1;
+                }
+        }
+
+        return tokens;
+}
+
+std::vector<std::pair<std::string, std::string>>
+MessageIndex::postings(const std::string &document, const QString &body)
+{
+        std::map<std::string, std::vector<uint32_t>> words;
+        for (const auto &token : tokenize(body))
+                words[token.word].push_back(token.position);
+
+        std::vector<std::pair<std::string, std::string>> result;
+        result.reserve(words.size());
+
+        for (const auto &word : words) {
+                // The document, a NUL separator, the truncation flag & the positions
+                // as varint encoded deltas.
+                std::string value = document;
+                value.push_back('\0');
+                value.push_back('\0');
+
+                const auto flag = value.size() - 1;
+
+                uint32_t previous = 0;
+                for (const auto position : word.second) {
+                        std::string encoded;
+
+                        auto delta = position - previous;
+                        while (delta >= 0x80) {
+                                encoded.push_back(static_cast<char>((delta & 0x7f) | 0x80));
+                                delta >>= 7;
+                        }
+                        encoded.push_back(static_cast<char>(delta));
+
+                        if (value.size() + encoded.size() > MAX_POSTING_SIZE) {
+                                value[flag] = 1;
+                                break;
+                        }
+
+                        value.append(encoded);
+                        previous = position;
+                }
+
+                result.emplace_back(word.first, std::move(value));
+        }
+
+        return result;
+}
+
+std::string
+MessageIndex::joinWords(const std::vector<std::pair<std::string, std::string>> &postings)
+{
+        std::string words;
+
+        for (const auto &posting : postings) {
+                if (!words.empty())
+                        words.push_back('\0');
+
+                words.append(posting.first);
+        }
+
+        return words;
+}
+
+bool
+MessageIndex::decode(const lmdb::val &value, Posting &posting)
+{
+        const auto data = value.data();
+        const auto size = value.size();
+
+        // Skip the room id & the timestamp, the event id is followed by a NUL.
+        const auto separator = static_cast<const char *>(std::memchr(data, '\0', size));
+        if (!separator || static_cast<std::size_t>(separator - data) + 1 + sizeof(uint64_t) > size)
+                return false;
+
+        const auto event = separator + 1 + sizeof(uint64_t);
+        const auto end =
+          static_cast<const char *>(std::memchr(event, '\0', size - (event - data)));
+        if (!end || static_cast<std::size_t>(end - data) + 2 > size)
+                return false;
+
+        posting.document.assign(data, end - data);
+        posting.truncated = end[1] != 0;
+        posting.positions.clear();
+
+        uint32_t position = 0;
+        uint32_t delta    = 0;
+        int shift         = 0;
+
+        for (auto it = end + 2; it != data + size; ++it) {
+                const auto byte = static_cast<unsigned char>(*it);
+
+                delta |= static_cast<uint32_t>(byte & 0x7f) << shift;
+                shift += 7;
+
+                if ((byte & 0x80) == 0) {
+                        position += delta;
+                        posting.positions.push_back(position);
+
+                        delta = 0;
+                        shift = 0;
+                }
+        }
+
+        return true;
+}
+
+bool
+MessageIndex::lastPosting(lmdb::cursor &cursor,
+                          const std::string &word,
+                          const std::string &prefix,
+                          lmdb::val &value)
+{
+        const auto end = roomEnd(prefix);
+
+        // Right before the first posting past the room, or the last one of the word.
+        lmdb::val key(word);
+        value = lmdb::val(end);
+
+        bool found = false;
+        if (cursor.get(key, value, MDB_GET_BOTH_RANGE)) {
+                found = cursor.get(key, value, MDB_PREV_DUP);
+        } else {
+                key   = lmdb::val(word);
+                found = cursor.get(key, value, MDB_SET_KEY) &&
+                        cursor.get(key, value, MDB_LAST_DUP);
+        }
+
+        return found && hasPrefix(value, prefix);
+}
+
+void
+MessageIndex::pushCandidate(lmdb::cursor &cursor,
+                            const std::string &prefix,
+                            lmdb::val value,
+                            std::priority_queue<Candidate> &candidates)
+{
+        Posting posting;
+        Candidate candidate;
+        std::string room_id, event_id;
+
+        lmdb::val key;
+        for (bool found = true; found && hasPrefix(value, prefix);
+             found      = cursor.get(key, value, MDB_PREV_DUP)) {
+                if (!decode(value, posting) ||
+                    !parseDocument(posting.document, room_id, candidate.timestamp, event_id))
+                        continue;
+
+                candidate.document = std::move(posting.document);
+                candidate.posting.assign(value.data(), value.size());
+                candidate.prefix = prefix;
+
+                candidates.push(std::move(candidate));
+                return;
+        }
+}
+
+bool
+MessageIndex::contains(lmdb::txn &txn, const std::string &room_id, const std::string &key)
+{
+        lmdb::val unused;
+        return lmdb::dbi_get(txn, documentsDb_, lmdb::val(documentKey(room_id, key)), unused);
+}
+
+void
+MessageIndex::add(lmdb::txn &txn,
+                  const std::string &room_id,
+                  const std::string &key,
+                  const QString &body)
+{
+        const auto document = documentKey(room_id, key);
+
+        // There has to be room for at least one position in the postings.
+        if (document.size() + 3 > MAX_POSTING_SIZE) {
+                nhlog::db()->warn("not indexing message with oversized ids in {}", room_id);
+                return;
+        }
+
+        lmdb::val unused;
+        if (lmdb::dbi_get(txn, documentsDb_, lmdb::val(document), unused))
+                return;
+
+        const auto entries = postings(document, body);
+
+        lmdb::dbi_put(txn, documentsDb_, lmdb::val(document), lmdb::val(body.toStdString()));
+        lmdb::dbi_put(txn, wordsDb_, lmdb::val(document), lmdb::val(joinWords(entries)));
+        lmdb::dbi_put(txn, eventsDb_, lmdb::val(eventKey(room_id, key)), lmdb::val(key));
+
+        for (const auto &posting : entries)
+                lmdb::dbi_put(
+                  txn, postingsDb_, lmdb::val(posting.first), lmdb::val(posting.second));
+}
+
+void
+MessageIndex::remove(lmdb::txn &txn, const std::string &room_id, const std::string &key)
+{
+        const auto document = documentKey(room_id, key);
+
+        lmdb::dbi_del(txn, eventsDb_, lmdb::val(eventKey(room_id, key)), nullptr);
+
+        lmdb::val value;
+        if (!lmdb::dbi_get(txn, wordsDb_, lmdb::val(document), value))
+                return;
+
+        const std::string words(value.data(), value.size());
+        const auto start = document + std::string(1, '\0');
+
+        // The posting of the message is the first one past its document in the list of
+        // each of its words.
+        auto cursor = lmdb::cursor::open(txn, postingsDb_);
+
+        std::size_t begin = 0;
+        while (begin < words.size()) {
+                auto end = words.find('\0', begin);
+                if (end == std::string::npos)
+                        end = words.size();
+
+                const auto word = words.substr(begin, end - begin);
+                begin           = end + 1;
+
+                lmdb::val key(word), posting(start);
+                if (cursor.get(key, posting, MDB_GET_BOTH_RANGE) &&
+                    hasPrefix(posting, start))
+                        lmdb::cursor_del(cursor.handle());
+        }
+        cursor.close();
+
+        lmdb::dbi_del(txn, documentsDb_, lmdb::val(document), nullptr);
+        lmdb::dbi_del(txn, wordsDb_, lmdb::val(document), nullptr);
+}
+
+void
+MessageIndex::removeRoom(lmdb::txn &txn, const std::string &room_id)
+{
+        const auto prefix = documentKey(room_id, std::string());
+
+        std::vector<std::string> keys;
+        lmdb::val document(prefix), unused;
+
+        auto cursor = lmdb::cursor::open(txn, documentsDb_);
+        bool found  = cursor.get(document, unused, MDB_SET_RANGE);
+        while (found && hasPrefix(document, prefix)) {
+                keys.emplace_back(document.data() + prefix.size(), document.size() - prefix.size());
+
+                found = cursor.get(document, unused, MDB_NEXT);
+        }
+        cursor.close();
+
+        for (const auto &key : keys)
+                remove(txn, room_id, key);
+
+        // The event ids of the messages that weren't indexed.
+        lmdb::val event(prefix);
+
+        auto events = lmdb::cursor::open(txn, eventsDb_);
+        found       = events.get(event, unused, MDB_SET_RANGE);
+        while (found && hasPrefix(event, prefix)) {
+                lmdb::cursor_del(events.handle());
+                found = events.get(event, unused, MDB_NEXT);
+        }
+        events.close();
+}
+
+void
+MessageIndex::indexEventIds(lmdb::txn &txn)
+{
+        lmdb::val document, unused;
+
+        auto cursor = lmdb::cursor::open(txn, documentsDb_);
+        while (cursor.get(document, unused, MDB_NEXT)) {
+                const std::string key(document.data(), document.size());
+
+                const auto separator = key.find('\0');
+                if (separator == std::string::npos)
+                        continue;
+
+                const auto room_id = key.substr(0, separator);
+                const auto message = key.substr(separator + 1);
+
+                lmdb::dbi_put(
+                  txn, eventsDb_, lmdb::val(eventKey(room_id, message)), lmdb::val(message));
+        }
+        cursor.close();
+}
+
+void
+MessageIndex::addEvent(lmdb::txn &txn, const std::string &room_id, const std::string &key)
+{
+        lmdb::dbi_put(txn, eventsDb_, lmdb::val(eventKey(room_id, key)), lmdb::val(key));
+}
+
+bool
+MessageIndex::findEvent(lmdb::txn &txn,
+                        const std::string &room_id,
+                        const std::string &event_id,
+                        std::string &key)
+{
+        // Same layout as eventKey.
+        lmdb::val value;
+        if (!lmdb::dbi_get(txn, eventsDb_, lmdb::val(documentKey(room_id, event_id)), value))
+                return false;
+
+        key.assign(value.data(), value.size());
+        return true;
+}
+
+void
+MessageIndex::indexWords(lmdb::txn &txn)
+{
+        // The words are split the same way they were when the messages were added.
+        lmdb::val document, body;
+
+        auto cursor = lmdb::cursor::open(txn, documentsDb_);
+        while (cursor.get(document, body, MDB_NEXT)) {
+                const std::string key(document.data(), document.size());
+                const auto words =
+                  joinWords(postings(key, QString::fromUtf8(body.data(), body.size())));
+
+                lmdb::dbi_put(txn, wordsDb_, lmdb::val(key), lmdb::val(words));
+        }
+        cursor.close();
+}
+
+std::vector<uint32_t>
+MessageIndex::positions(lmdb::txn &txn, const std::string &document, const std::string &word)
+{
+        const auto start = document + std::string(1, '\0');
+
+        lmdb::val key(word), value(start);
+        Posting posting;
+
+        auto cursor = lmdb::cursor::open(txn, postingsDb_);
+        const bool found = cursor.get(key, value, MDB_GET_BOTH_RANGE) &&
+                           decode(value, posting) && posting.document == document;
+        cursor.close();
+
+        if (!found)
+                return {};
+
+        if (!posting.truncated)
+                return posting.positions;
+
+        // Words that appear too often in a message only keep their first positions.
+        lmdb::val body;
+        if (!lmdb::dbi_get(txn, documentsDb_, lmdb::val(document), body))
+                return {};
+
+        std::vector<uint32_t> result;
+        for (const auto &token : tokenize(QString::fromUtf8(body.data(), body.size()))) {
+                if (token.word == word)
+                        result.push_back(token.position);
+        }
+
+        return result;
+}
+
+bool
+MessageIndex::matches(lmdb::txn &txn,
+                      const std::string &document,
+                      const std::vector<std::vector<std::string>> &phrases)
+{
+        for (const auto &phrase : phrases) {
+                const auto first = positions(txn, document, phrase.front());
+                if (first.empty())
+                        return false;
+
+                std::vector<std::vector<uint32_t>> rest;
+                for (std::size_t i = 1; i < phrase.size(); ++i) {
+                        rest.emplace_back(positions(txn, document, phrase.at(i)));
+
+                        if (rest.back().empty())
+                                return false;
+                }
+
+                const bool found =
+                  std::any_of(first.begin(), first.end(), [&rest](uint32_t position) {
+                          for (std::size_t i = 0; i < rest.size(); ++i) {
+                                  if (!std::binary_search(
+                                        rest.at(i).begin(), rest.at(i).end(), position + i + 1))
+                                          return false;
+                          }
+
+                          return true;
+                  });
+
+                if (!found)
+                        return false;
+        }
+
+        return true;
+}
+
+QString
+MessageIndex::snippet(lmdb::txn &txn,
+                      const std::string &document,
+                      const std::vector<std::vector<std::string>> &phrases)
+{
+        lmdb::val value;
+        if (!lmdb::dbi_get(txn, documentsDb_, lmdb::val(document), value))
+                return QString();
+
+        const auto body = QString::fromUtf8(value.data(), value.size());
+
+        int from = 0;
+        for (const auto &token : tokenize(body)) {
+                const bool isMatch =
+                  std::any_of(phrases.begin(), phrases.end(), [&token](const auto &phrase) {
+                          return phrase.front() == token.word;
+                  });
+
+                if (isMatch) {
+                        from = std::max(0, token.offset - SNIPPET_CONTEXT);
+                        break;
+                }
+        }
+
+        auto text = body.mid(from, SNIPPET_LENGTH).simplified();
+
+        if (from > 0)
+                text.prepend(QChar(0x2026));
+        if (from + SNIPPET_LENGTH < body.size())
+                text.append(QChar(0x2026));
+
+        return text;
+}
+
+std::vector<MessageSearchResult>
+MessageIndex::search(lmdb::txn &txn,
+                     const QString &query,
+                     const std::string &room_id,
+                     std::size_t max_items)
+{
+        // Every other part of the query is quoted.
+        std::vector<std::vector<std::string>> phrases;
+
+        const auto parts = query.split('"');
+        for (int i = 0; i < parts.size(); ++i) {
+                const auto tokens = tokenize(parts.at(i));
+                if (tokens.empty())
+                        continue;
+
+                if (i % 2 == 1) {
+                        phrases.emplace_back();
+                        for (const auto &token : tokens)
+                                phrases.back().push_back(token.word);
+                } else {
+                        for (const auto &token : tokens)
+                                phrases.push_back({token.word});
+                }
+        }
+
+        if (phrases.empty())
+                return {};
+
+        // The candidates are taken from the postings of the rarest word.
+        std::string rarest;
+        std::size_t fewest = std::numeric_limits<std::size_t>::max();
+
+        auto cursor = lmdb::cursor::open(txn, postingsDb_);
+
+        for (const auto &phrase : phrases) {
+                for (const auto &word : phrase) {
+                        lmdb::val key(word), unused;
+
+                        if (!cursor.get(key, unused, MDB_SET_KEY))
+                                return {};
+
+                        std::size_t count = 0;
+                        const int rc      = mdb_cursor_count(cursor.handle(), &count);
+                        if (rc != MDB_SUCCESS)
+                                lmdb::error::raise("mdb_cursor_count", rc);
+
+                        if (count < fewest) {
+                                rarest = word;
+                                fewest = count;
+                        }
+                }
+        }
+
+        // The postings of the rarest word already prove that a message contains it.
+        auto remaining = phrases;
+        remaining.erase(
+          std::remove(remaining.begin(), remaining.end(), std::vector<std::string>{rarest}),
+          remaining.end());
+
+        // The postings are sorted by room & then chronologically. The postings of every
+        // room are walked backwards from its end & the rooms are merged newest first,
+        // until enough messages match.
+        std::priority_queue<Candidate> candidates;
+
+        if (!room_id.empty()) {
+                const auto prefix = documentKey(room_id, std::string());
+
+                lmdb::val value;
+                if (lastPosting(cursor, rarest, prefix, value))
+                        pushCandidate(cursor, prefix, value, candidates);
+        } else {
+                lmdb::val key(rarest), value;
+                bool found = cursor.get(key, value, MDB_SET_KEY);
+
+                while (found) {
+                        const auto separator =
+                          static_cast<const char *>(std::memchr(value.data(), '\0', value.size()));
+                        if (!separator)
+                                break;
+
+                        const std::string prefix(value.data(), separator - value.data() + 1);
+
+                        lmdb::val last;
+                        if (lastPosting(cursor, rarest, prefix, last))
+                                pushCandidate(cursor, prefix, last, candidates);
+
+                        // Skip to the first posting of the next room.
+                        const auto next = roomEnd(prefix);
+
+                        key   = lmdb::val(rarest);
+                        value = lmdb::val(next);
+                        found = cursor.get(key, value, MDB_GET_BOTH_RANGE);
+                }
+        }
+
+        std::vector<std::string> matched;
+
+        while (!candidates.empty() && matched.size() < max_items) {
+                const auto candidate = candidates.top();
+                candidates.pop();
+
+                if (remaining.empty() || matches(txn, candidate.document, remaining))
+                        matched.push_back(candidate.document);
+
+                // The cursor may have moved to another room since, so the posting has to
+                // be found again before moving to the previous one.
+                lmdb::val key(rarest), value(candidate.posting);
+                if (cursor.get(key, value, MDB_GET_BOTH) &&
+                    cursor.get(key, value, MDB_PREV_DUP) && hasPrefix(value, candidate.prefix))
+                        pushCandidate(cursor, candidate.prefix, value, candidates);
+        }
+        cursor.close();
+
+        std::vector<MessageSearchResult> results;
+        results.reserve(matched.size());
+
+        for (const auto &document : matched) {
+                MessageSearchResult result;
+                parseDocument(document, result.room_id, result.timestamp, result.event_id);
+                result.snippet = snippet(txn, document, phrases);
+
+                results.emplace_back(std::move(result));
+        }
+
+        return results;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <queue>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <QString>
+
+#include <lmdb++.h>
+
+struct MessageSearchResult
+{
+        std::string room_id;
+        std::string event_id;
+        uint64_t timestamp = 0;
+        //! The part of the message around the first matching word.
+        QString snippet;
+};
+
+//! Full-text index of the stored messages.
+//!
+//! Message bodies are split into lower case words & every word keeps the list of the
+//! messages that contain it, along with the positions it appears at. The lists are
+//! sorted by room and then chronologically, so a search can be restricted to a room.
+//! The bodies are kept as well, to build the snippets of the results, along with the
+//! words of each message, to remove it from their lists even if the way messages are
+//! split into words has changed since it was added. Messages are identified by their room and
+//! their key in the messages database (see cache::codec::messageKey). The keys of all
+//! the stored messages, indexed or not, can be looked up by event id.
+//!
+//! The index lives in the environment of the cache & is only accessed through the
+//! transactions of the caller.
+class MessageIndex
+{
+public:
+        //! Open the databases of the index, creating them if needed.
+        void open(lmdb::txn &txn);
+
+        bool contains(lmdb::txn &txn, const std::string &room_id, const std::string &key);
+        //! Index a message. Messages that are already indexed are left untouched.
+        void add(lmdb::txn &txn,
+                 const std::string &room_id,
+                 const std::string &key,
+                 const QString &body);
+        //! Remove a message & its event id.
+        void remove(lmdb::txn &txn, const std::string &room_id, const std::string &key);
+        void removeRoom(lmdb::txn &txn, const std::string &room_id);
+        //! Fill the event ids of the messages indexed before they were kept.
+        void indexEventIds(lmdb::txn &txn);
+        //! Fill the words of the messages indexed before they were kept.
+        void indexWords(lmdb::txn &txn);
+
+        //! Keep the event id of a stored message, even if it has no body to index.
+        void addEvent(lmdb::txn &txn, const std::string &room_id, const std::string &key);
+        //! The key of a stored message in the messages database.
+        bool findEvent(lmdb::txn &txn,
+                       const std::string &room_id,
+                       const std::string &event_id,
+                       std::string &key);
+
+        //! The messages that contain all the words of the query, most recent first.
+        //! Text between double quotes has to appear as a phrase. All the rooms are
+        //! searched unless one is given.
+        std::vector<MessageSearchResult> search(lmdb::txn &txn,
+                                                const QString &query,
+                                                const std::string &room_id,
+                                                std::size_t max_items);
+
+private:
+        struct Token
+        {
+                std::string word;
+                //! Number of words before the token.
+                uint32_t position;
+                //! Location of the token in the body, in characters.
+                int offset;
+        };
+
+        struct Posting
+        {
+                //! The key of the message in the documents database.
+                std::string document;
+                //! Whether the list of positions was cut to fit in the entry.
+                bool truncated = false;
+                std::vector<uint32_t> positions;
+        };
+
+        //! A message that contains the rarest word of a query, while the postings of its
+        //! room are walked backwards.
+        struct Candidate
+        {
+                uint64_t timestamp = 0;
+                std::string document;
+                //! The posting itself, to find it again.
+                std::string posting;
+                //! The start of the postings of the room.
+                std::string prefix;
+
+                bool operator<(const Candidate &other) const
+                {
+                        return std::tie(timestamp, document) <
+                               std::tie(other.timestamp, other.document);
+                }
+        };
+
+        static std::vector<Token> tokenize(const QString &text);
+        //! The entries of a message in the lists of its words.
+        static std::vector<std::pair<std::string, std::string>> postings(
+          const std::string &document,
+          const QString &body);
+        static bool decode(const lmdb::val &value, Posting &posting);
+        //! The words of a message, as stored in the words database.
+        static std::string joinWords(
+          const std::vector<std::pair<std::string, std::string>> &postings);
+        //! Move the cursor to the last posting of the word in the room of the prefix.
+        static bool lastPosting(lmdb::cursor &cursor,
+                                const std::string &word,
+                                const std::string &prefix,
+                                lmdb::val &value);
+        //! Add the posting the cursor is at to the candidates, or the previous readable
+        //! one of the room.
+        static void pushCandidate(lmdb::cursor &cursor,
+                                  const std::string &prefix,
+                                  lmdb::val value,
+                                  std::priority_queue<Candidate> &candidates);
+
+        //! The positions of a word in a message.
+        std::vector<uint32_t> positions(lmdb::txn &txn,
+                                        const std::string &document,
+                                        const std::string &word);
+        //! Whether the message has an entry for every word of the query & contains its
+        //! phrases.
+        bool matches(lmdb::txn &txn,
+                     const std::string &document,
+                     const std::vector<std::vector<std::string>> &phrases);
+        QString snippet(lmdb::txn &txn,
+                        const std::string &document,
+                        const std::vector<std::vector<std::string>> &phrases);
+
+        //! document -> body
+        lmdb::dbi documentsDb_{0};
+        //! document -> words, separated by NULs
+        lmdb::dbi wordsDb_{0};
+        //! word -> sorted postings
+        lmdb::dbi postingsDb_{0};
+        //! room id & event id -> key of the stored message
+        lmdb::dbi eventsDb_{0};
+};
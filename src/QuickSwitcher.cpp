@@ -93,8 +93,14 @@ QuickSwitcher::QuickSwitcher(QWidget *parent)
 
                 QtConcurrent::run([this, query = query.toLower()]() {
                         try {
-                                emit queryResults(
-                                  cache::client()->searchRooms(query.toStdString()));
+                                auto rooms = cache::client()->searchRooms(query.toStdString());
+
+                                // Only the avatars of the rooms that are displayed are decoded.
+                                for (auto &room : rooms)
+                                        room.avatar =
+                                          cache::client()->decodeImage(room.info.avatar_url);
+
+                                emit queryResults(rooms);
                         } catch (const lmdb::error &e) {
                                 qWarning() << "room search failed:" << e.what();
                         }
@@ -87,12 +87,12 @@ RoomList::updateAvatar(const QString &room_id, const QString &url)
         if (url.isEmpty())
                 return;
 
-        QByteArray savedImgData;
+        QImage savedImg;
 
         if (cache::client())
-                savedImgData = cache::client()->image(url);
+                savedImg = cache::client()->decodeImage(url);
 
-        if (savedImgData.isEmpty()) {
+        if (savedImg.isNull()) {
                 mtx::http::ThumbOpts opts;
                 opts.mxc_url = url.toStdString();
                 http::client()->get_thumbnail(
@@ -116,10 +116,7 @@ RoomList::updateAvatar(const QString &room_id, const QString &url)
                           emit updateRoomAvatarCb(room_id, pixmap);
                   });
         } else {
-                QPixmap img;
-                img.loadFromData(savedImgData);
-
-                updateRoomAvatar(room_id, img);
+                updateRoomAvatar(room_id, QPixmap::fromImage(savedImg));
         }
 }
 
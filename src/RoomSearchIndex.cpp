@@ -0,0 +1,175 @@
+#include "RoomSearchIndex.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <unordered_set>
+
+#include <QString>
+
+#include "EditDistance.h"
+
+namespace {
+constexpr std::size_t TRIGRAM_SIZE = 3;
+}
+
+std::vector<RoomSearchIndex::Trigram>
+RoomSearchIndex::trigrams(const std::string &s)
+{
+        std::vector<Trigram> result;
+
+        if (s.size() < TRIGRAM_SIZE)
+                return result;
+
+        result.reserve(s.size() - TRIGRAM_SIZE + 1);
+
+        for (std::size_t i = 0; i + TRIGRAM_SIZE <= s.size(); ++i) {
+                result.push_back(static_cast<Trigram>(static_cast<unsigned char>(s[i])) << 16 |
+                                 static_cast<Trigram>(static_cast<unsigned char>(s[i + 1])) << 8 |
+                                 static_cast<Trigram>(static_cast<unsigned char>(s[i + 2])));
+        }
+
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+
+        return result;
+}
+
+void
+RoomSearchIndex::insert(const std::string &room_id, const std::string &name)
+{
+        const auto id    = ids::intern(room_id);
+        const auto lower = QString::fromStdString(name).toLower().toStdString();
+
+        std::unique_lock<std::shared_timed_mutex> lock(mtx_);
+
+        auto it = names_.find(id);
+        if (it != names_.end()) {
+                if (it->second == lower)
+                        return;
+
+                removeTrigrams(id, it->second);
+                it->second = lower;
+        } else {
+                names_.emplace(id, lower);
+        }
+
+        for (const auto trigram : trigrams(lower))
+                rooms_[trigram].push_back(id);
+}
+
+void
+RoomSearchIndex::remove(const std::string &room_id)
+{
+        const auto id = ids::find(room_id);
+        if (id == ids::None)
+                return;
+
+        std::unique_lock<std::shared_timed_mutex> lock(mtx_);
+
+        auto it = names_.find(id);
+        if (it == names_.end())
+                return;
+
+        removeTrigrams(id, it->second);
+        names_.erase(it);
+}
+
+void
+RoomSearchIndex::removeTrigrams(ids::Id room_id, const std::string &name)
+{
+        for (const auto trigram : trigrams(name)) {
+                auto it = rooms_.find(trigram);
+                if (it == rooms_.end())
+                        continue;
+
+                auto &rooms = it->second;
+                rooms.erase(std::remove(rooms.begin(), rooms.end(), room_id), rooms.end());
+
+                if (rooms.empty())
+                        rooms_.erase(it);
+        }
+}
+
+void
+RoomSearchIndex::clear()
+{
+        std::unique_lock<std::shared_timed_mutex> lock(mtx_);
+
+        names_.clear();
+        rooms_.clear();
+}
+
+std::vector<std::string>
+RoomSearchIndex::search(const std::string &query, std::size_t max_items) const
+{
+        if (max_items == 0)
+                return {};
+
+        std::shared_lock<std::shared_timed_mutex> lock(mtx_);
+
+        struct Match
+        {
+                int score;
+                ids::Id room_id;
+                const std::string *name;
+
+                bool operator<(const Match &other) const
+                {
+                        return score != other.score ? score < other.score
+                                                    : *name < *other.name;
+                }
+        };
+
+        const utils::EditDistance distance(query);
+
+        // The best matches so far, in order.
+        std::vector<Match> matches;
+        matches.reserve(max_items + 1);
+
+        const auto score = [&distance, &matches, max_items](ids::Id room_id,
+                                                            const std::string &name) {
+                // Rooms with the same score as the worst match might still sort before it.
+                const int cutoff = matches.size() < max_items ? std::numeric_limits<int>::max()
+                                                              : matches.back().score + 1;
+
+                const Match match{distance(name, cutoff), room_id, &name};
+                if (match.score >= cutoff)
+                        return;
+
+                matches.insert(std::upper_bound(matches.begin(), matches.end(), match), match);
+
+                if (matches.size() > max_items)
+                        matches.pop_back();
+        };
+
+        std::unordered_set<ids::Id> candidates;
+        for (const auto trigram : trigrams(query)) {
+                auto it = rooms_.find(trigram);
+                if (it != rooms_.end())
+                        candidates.insert(it->second.begin(), it->second.end());
+        }
+
+        for (const auto room_id : candidates)
+                score(room_id, names_.at(room_id));
+
+        // Every edit changes at most three of the trigrams of the query, so a name that
+        // shares none of them is at least ceil((size - 2) / 3) away from it. Queries
+        // shorter than a trigram have to be compared with every room.
+        const int minDistance = query.size() / TRIGRAM_SIZE;
+
+        if (matches.size() < max_items || matches.back().score >= minDistance) {
+                for (const auto &room : names_) {
+                        if (candidates.count(room.first) == 0)
+                                score(room.first, room.second);
+                }
+        }
+
+        std::vector<std::string> results;
+        results.reserve(matches.size());
+
+        for (const auto &match : matches)
+                results.emplace_back(ids::toStdString(match.room_id));
+
+        return results;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "InternedIds.h"
+
+//! In-memory index of the names of the joined rooms, used to search for a room.
+//!
+//! Names are kept in lower case, along with the trigrams they contain. A query is
+//! compared with the rooms that share a trigram with it first. The other rooms are
+//! only compared with it if their distance to the query could still be low enough
+//! to make it into the results, so the ranking is the same as comparing every room.
+//! Thread-safe.
+class RoomSearchIndex
+{
+public:
+        //! Add a room or update its name.
+        void insert(const std::string &room_id, const std::string &name);
+        void remove(const std::string &room_id);
+        void clear();
+
+        //! The ids of the rooms with the names closest to the query, best match first.
+        //! The query is expected to be in lower case.
+        std::vector<std::string> search(const std::string &query, std::size_t max_items) const;
+
+private:
+        using Trigram = uint32_t;
+
+        static std::vector<Trigram> trigrams(const std::string &s);
+
+        void removeTrigrams(ids::Id room_id, const std::string &name);
+
+        mutable std::shared_timed_mutex mtx_;
+        //! Lower case names by room.
+        std::unordered_map<ids::Id, std::string> names_;
+        //! The rooms whose name contains each trigram.
+        std::unordered_map<Trigram, std::vector<ids::Id>> rooms_;
+};
@@ -121,8 +121,8 @@ RoomItem::RoomItem(QWidget *parent, const RoomSearchResult &res)
         topLayout_->addWidget(avatar_);
         topLayout_->addWidget(roomName_, 1);
 
-        if (!res.img.isNull())
-                avatar_->setImage(res.img);
+        if (!res.avatar.isNull())
+                avatar_->setImage(res.avatar);
 }
 
 void
@@ -137,8 +137,8 @@ RoomItem::updateItem(const RoomSearchResult &result)
 
         roomName_->setText(name);
 
-        if (!result.img.isNull())
-                avatar_->setImage(result.img);
+        if (!result.avatar.isNull())
+                avatar_->setImage(result.avatar);
         else
                 avatar_->setLetter(utils::firstChar(name));
 }
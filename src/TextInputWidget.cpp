@@ -458,10 +458,21 @@ TextInputWidget::TextInputWidget(QWidget *parent)
                 if (q.isEmpty() || !cache::client())
                         return;
 
-                QtConcurrent::run([this, q = q.toLower().toStdString()]() {
+                // Only the results of the latest query are shown.
+                if (userSearchCancelled_)
+                        *userSearchCancelled_ = true;
+
+                auto cancelled       = std::make_shared<std::atomic<bool>>(false);
+                userSearchCancelled_ = cancelled;
+                const auto room_id   = ChatPage::instance()->currentRoom().toStdString();
+
+                QtConcurrent::run([this, cancelled, room_id, q = q.toLower().toStdString()]() {
                         try {
-                                emit input_->resultsRetrieved(cache::client()->searchUsers(
-                                  ChatPage::instance()->currentRoom().toStdString(), q));
+                                auto results =
+                                  cache::client()->searchUsers(room_id, q, 5, cancelled.get());
+
+                                if (!*cancelled)
+                                        emit input_->resultsRetrieved(results);
                         } catch (const lmdb::error &e) {
                                 std::cout << e.what() << '\n';
                         }
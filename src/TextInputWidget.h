@@ -17,9 +17,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <deque>
 #include <iterator>
 #include <map>
+#include <memory>
 
 #include <QApplication>
 #include <QDebug>
@@ -179,5 +181,8 @@ private:
         FlatButton *sendMessageBtn_;
         emoji::PickButton *emojiBtn_;
 
+        //! Set to cancel the member search in progress.
+        std::shared_ptr<std::atomic<bool>> userSearchCancelled_;
+
         QColor borderColor_;
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Cache.h"
+#include "EditDistance.h"
 #include "RoomInfoListItem.h"
 #include "timeline/widgets/AudioItem.h"
 #include "timeline/widgets/FileItem.h"
@@ -184,10 +185,6 @@ message_body(const mtx::events::collections::TimelineEvents &event)
         return QString::fromStdString(mpark::get<T>(event).content.body);
 }
 
-//! Calculate the Levenshtein distance between two strings with character skipping.
-int
-levenshtein_distance(const std::string &s1, const std::string &s2);
-
 QPixmap
 scaleImageToPixmap(const QImage &img, int size);
 
@@ -0,0 +1,69 @@
+#include "WorkQueue.h"
+
+#include "Logging.h"
+
+WorkQueue::WorkQueue(std::size_t capacity)
+  : capacity_{capacity}
+  , worker_{&WorkQueue::run, this}
+{}
+
+WorkQueue::~WorkQueue()
+{
+        {
+                std::unique_lock<std::mutex> lock(mtx_);
+                stopped_ = true;
+                jobs_.clear();
+        }
+
+        cv_.notify_one();
+        worker_.join();
+}
+
+void
+WorkQueue::push(std::function<void()> job)
+{
+        {
+                std::unique_lock<std::mutex> lock(mtx_);
+                jobs_.emplace_back(std::move(job));
+        }
+
+        cv_.notify_one();
+}
+
+bool
+WorkQueue::hasCapacity()
+{
+        std::unique_lock<std::mutex> lock(mtx_);
+        return jobs_.size() < capacity_;
+}
+
+void
+WorkQueue::clear()
+{
+        std::unique_lock<std::mutex> lock(mtx_);
+        jobs_.clear();
+}
+
+void
+WorkQueue::run()
+{
+        for (;;) {
+                std::function<void()> job;
+                {
+                        std::unique_lock<std::mutex> lock(mtx_);
+                        cv_.wait(lock, [this]() { return stopped_ || !jobs_.empty(); });
+
+                        if (stopped_)
+                                return;
+
+                        job = std::move(jobs_.front());
+                        jobs_.pop_front();
+                }
+
+                try {
+                        job();
+                } catch (const std::exception &e) {
+                        nhlog::ui()->critical("unhandled exception in queued job: {}", e.what());
+                }
+        }
+}
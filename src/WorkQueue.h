@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//! Runs jobs on a dedicated thread, one at a time & in the order they were queued.
+//!
+//! The queue itself never drops or blocks on a job. Producers are expected to
+//! check hasCapacity() and hold off until the worker catches up.
+class WorkQueue
+{
+public:
+        explicit WorkQueue(std::size_t capacity);
+        ~WorkQueue();
+
+        WorkQueue(const WorkQueue &) = delete;
+        WorkQueue &operator=(const WorkQueue &) = delete;
+
+        void push(std::function<void()> job);
+        //! Whether the number of jobs waiting to run is below the capacity.
+        bool hasCapacity();
+        //! Drop the jobs that haven't started yet.
+        void clear();
+
+private:
+        void run();
+
+        const std::size_t capacity_;
+
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        std::deque<std::function<void()>> jobs_;
+        bool stopped_ = false;
+
+        std::thread worker_;
+};
@@ -1,144 +1,334 @@
-#include <QListWidgetItem>
+#include <algorithm>
+
+#include <QApplication>
+#include <QDesktopWidget>
+#include <QLabel>
+#include <QListView>
 #include <QPainter>
 #include <QStyleOption>
 #include <QVBoxLayout>
+#include <QtConcurrent>
 
 #include "dialogs/MemberList.h"
 
 #include "AvatarProvider.h"
-#include "Cache.h"
-#include "ChatPage.h"
 #include "Config.h"
+#include "Logging.h"
 #include "Utils.h"
-#include "ui/Avatar.h"
-#include "ui/FlatButton.h"
+#include "ui/Theme.h"
 
 using namespace dialogs;
 
-MemberItem::MemberItem(const RoomMember &member, QWidget *parent)
-  : QWidget(parent)
+namespace {
+constexpr int AVATAR_SIZE = 44;
+//! Space between the avatar & the text of a row.
+constexpr int AVATAR_SPACING = 8;
+
+//! Number of members fetched at once.
+constexpr std::size_t PAGE_SIZE = 100;
+//! Number of decoded avatars kept around.
+constexpr int MAX_AVATARS = 500;
+
+QImage
+scaleAvatar(const QImage &image, int size)
+{
+        return image.scaled(size, size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
+}
+
+MemberListModel::MemberListModel(const QString &room_id, int avatarSize, QObject *parent)
+  : QAbstractListModel(parent)
+  , room_id_{room_id}
+  , avatarSize_{avatarSize}
+  , avatars_{MAX_AVATARS}
 {
-        topLayout_ = new QHBoxLayout(this);
-        topLayout_->setMargin(0);
+        orderWatcher_ = new QFutureWatcher<MemberOrder>(this);
+        connect(
+          orderWatcher_, &QFutureWatcher<MemberOrder>::finished, this, &MemberListModel::setOrder);
 
-        textLayout_ = new QVBoxLayout;
-        textLayout_->setMargin(0);
-        textLayout_->setSpacing(0);
+        avatarsWatcher_ = new QFutureWatcher<std::vector<QImage>>(this);
+        connect(avatarsWatcher_, &QFutureWatcher<std::vector<QImage>>::finished, this, [this]() {
+                addAvatars(avatarsWatcher_->result());
+        });
 
-        avatar_ = new Avatar(this);
-        avatar_->setSize(44);
-        avatar_->setLetter(utils::firstChar(member.display_name));
+        fetchMore(QModelIndex());
+}
 
-        if (!member.avatar.isNull())
-                avatar_->setImage(member.avatar);
-        else
-                AvatarProvider::resolve(ChatPage::instance()->currentRoom(),
-                                        member.user_id,
-                                        this,
-                                        [this](const QImage &img) { avatar_->setImage(img); });
+int
+MemberListModel::rowCount(const QModelIndex &parent) const
+{
+        if (parent.isValid())
+                return 0;
 
-        QFont nameFont, idFont;
-        nameFont.setWeight(65);
-        nameFont.setPixelSize(conf::receipts::font + 1);
-        idFont.setWeight(50);
-        idFont.setPixelSize(conf::receipts::font);
+        return static_cast<int>(rows_);
+}
+
+QVariant
+MemberListModel::data(const QModelIndex &index, int role) const
+{
+        if (!index.isValid() || index.row() >= rowCount())
+                return QVariant();
 
-        userName_ = new QLabel(member.display_name, this);
-        userName_->setFont(nameFont);
+        const auto &member = order_->at(index.row());
 
-        userId_ = new QLabel(member.user_id, this);
-        userId_->setFont(idFont);
+        switch (role) {
+        case Qt::DisplayRole:
+                return member.display_name;
+        case UserIdRole:
+                return member.user_id;
+        case AvatarRole: {
+                if (member.avatar_url.isEmpty())
+                        return QImage();
 
-        textLayout_->addWidget(userName_);
-        textLayout_->addWidget(userId_);
+                if (auto image = avatars_.object(member.avatar_url))
+                        return *image;
 
-        topLayout_->addWidget(avatar_);
-        topLayout_->addLayout(textLayout_, 1);
+                requestAvatar(member);
+                return QImage();
+        }
+        default:
+                return QVariant();
+        }
 }
 
-MemberList::MemberList(const QString &room_id, QWidget *parent)
-  : QFrame(parent)
-  , room_id_{room_id}
+bool
+MemberListModel::canFetchMore(const QModelIndex &parent) const
 {
-        setMaximumSize(420, 380);
-        setAttribute(Qt::WA_DeleteOnClose, true);
+        if (parent.isValid())
+                return false;
 
-        auto layout = new QVBoxLayout(this);
-        layout->setSpacing(30);
-        layout->setMargin(20);
+        return order_ ? rows_ < order_->size() : !orderWatcher_->isRunning();
+}
 
-        list_ = new QListWidget;
-        list_->setFrameStyle(QFrame::NoFrame);
-        list_->setSelectionMode(QAbstractItemView::NoSelection);
-        list_->setAttribute(Qt::WA_MacShowFocusRect, 0);
-        list_->setSpacing(5);
+void
+MemberListModel::fetchMore(const QModelIndex &parent)
+{
+        if (!canFetchMore(parent))
+                return;
 
-        QFont font;
-        font.setPixelSize(conf::headerFontSize);
+        if (!order_) {
+                orderWatcher_->setFuture(
+                  QtConcurrent::run([room_id = room_id_.toStdString()]() -> MemberOrder {
+                          try {
+                                  return cache::client()->memberOrder(room_id);
+                          } catch (const lmdb::error &e) {
+                                  nhlog::db()->warn("failed to retrieve members of {}: {}",
+                                                    room_id,
+                                                    e.what());
+                                  return std::make_shared<const std::vector<RoomMember>>();
+                          }
+                  }));
+                return;
+        }
 
-        topLabel_ = new QLabel(tr("Room members"), this);
-        topLabel_->setAlignment(Qt::AlignCenter);
-        topLabel_->setFont(font);
+        const auto count = std::min(PAGE_SIZE, order_->size() - rows_);
 
-        layout->addWidget(topLabel_);
-        layout->addWidget(list_);
+        beginInsertRows(QModelIndex(), rowCount(), rowCount() + static_cast<int>(count) - 1);
+        rows_ += count;
+        endInsertRows();
+}
+
+void
+MemberListModel::setOrder()
+{
+        order_ = orderWatcher_->result();
 
-        list_->clear();
+        fetchMore(QModelIndex());
+}
 
-        // Add button at the bottom.
-        moreBtn_  = new FlatButton(tr("SHOW MORE"), this);
-        auto item = new QListWidgetItem;
-        item->setSizeHint(moreBtn_->minimumSizeHint());
-        item->setFlags(Qt::NoItemFlags);
-        item->setTextAlignment(Qt::AlignCenter);
-        list_->insertItem(0, item);
-        list_->setItemWidget(item, moreBtn_);
+void
+MemberListModel::requestAvatar(const RoomMember &member) const
+{
+        if (loadingAvatars_.contains(member.avatar_url))
+                return;
 
-        connect(moreBtn_, &FlatButton::clicked, this, [this]() {
-                const size_t numMembers = list_->count() - 1;
+        loadingAvatars_.insert(member.avatar_url);
+        pendingAvatars_.push_back(member);
 
-                if (numMembers > 0)
-                        addUsers(cache::client()->getMembers(room_id_.toStdString(), numMembers));
-        });
+        decodeAvatars();
+}
+
+void
+MemberListModel::decodeAvatars() const
+{
+        if (avatarsWatcher_->isRunning() || pendingAvatars_.empty())
+                return;
+
+        decodingAvatars_.clear();
+        std::swap(decodingAvatars_, pendingAvatars_);
+
+        std::vector<QString> urls;
+        for (const auto &member : decodingAvatars_)
+                urls.push_back(member.avatar_url);
+
+        avatarsWatcher_->setFuture(QtConcurrent::run([urls, size = avatarSize_]() {
+                std::vector<QImage> images;
+                images.reserve(urls.size());
+
+                for (const auto &url : urls) {
+                        auto image = cache::client()->decodeImage(url);
+
+                        if (!image.isNull())
+                                image = scaleAvatar(image, size);
 
-        try {
-                addUsers(cache::client()->getMembers(room_id_.toStdString()));
-        } catch (const lmdb::error &e) {
-                qCritical() << e.what();
+                        images.emplace_back(std::move(image));
+                }
+
+                return images;
+        }));
+}
+
+void
+MemberListModel::addAvatars(const std::vector<QImage> &images)
+{
+        for (std::size_t i = 0; i < images.size() && i < decodingAvatars_.size(); ++i) {
+                const auto &member = decodingAvatars_.at(i);
+
+                if (!images.at(i).isNull()) {
+                        avatars_.insert(member.avatar_url, new QImage(images.at(i)));
+                        loadingAvatars_.remove(member.avatar_url);
+                        continue;
+                }
+
+                // The avatar isn't stored yet.
+                AvatarProvider::resolve(
+                  room_id_,
+                  member.user_id,
+                  this,
+                  [this, url = member.avatar_url](const QImage &image) {
+                          setAvatar(url, scaleAvatar(image, avatarSize_));
+                  });
         }
+
+        decodingAvatars_.clear();
+
+        if (!images.empty() && rowCount() > 0)
+                emit dataChanged(index(0), index(rowCount() - 1), {AvatarRole});
+
+        decodeAvatars();
 }
 
 void
-MemberList::moveButtonToBottom()
+MemberListModel::setAvatar(const QString &url, const QImage &image)
+{
+        avatars_.insert(url, new QImage(image));
+        loadingAvatars_.remove(url);
+
+        if (rowCount() > 0)
+                emit dataChanged(index(0), index(rowCount() - 1), {AvatarRole});
+}
+
+MemberItemDelegate::MemberItemDelegate(QObject *parent)
+  : QStyledItemDelegate(parent)
 {
-        auto item = new QListWidgetItem(list_);
-        item->setSizeHint(moreBtn_->minimumSizeHint());
-        item->setFlags(Qt::NoItemFlags);
-        item->setTextAlignment(Qt::AlignCenter);
-        list_->setItemWidget(item, moreBtn_);
-        list_->addItem(item);
+        nameFont_.setWeight(65);
+        nameFont_.setPixelSize(conf::receipts::font + 1);
+        idFont_.setWeight(50);
+        idFont_.setPixelSize(conf::receipts::font);
+        letterFont_.setPointSizeF(AVATAR_SIZE * ui::FontSize / 40.0);
 }
 
 void
-MemberList::addUsers(const std::vector<RoomMember> &members)
+MemberItemDelegate::paint(QPainter *painter,
+                          const QStyleOptionViewItem &option,
+                          const QModelIndex &index) const
 {
-        if (members.size() == 0) {
-                moreBtn_->hide();
+        const auto name   = index.data(Qt::DisplayRole).toString();
+        const auto userId = index.data(MemberListModel::UserIdRole).toString();
+        const auto avatar = index.data(MemberListModel::AvatarRole).value<QImage>();
+
+        painter->save();
+        painter->setRenderHint(QPainter::Antialiasing);
+
+        const QRect avatarRect(option.rect.x(),
+                               option.rect.y() + (option.rect.height() - AVATAR_SIZE) / 2,
+                               AVATAR_SIZE,
+                               AVATAR_SIZE);
+
+        if (!avatar.isNull()) {
+                QPainterPath path;
+                path.addEllipse(avatarRect);
+
+                painter->setClipPath(path);
+                painter->drawImage(avatarRect, avatar);
+                painter->setClipping(false);
         } else {
-                moreBtn_->show();
+                painter->setPen(Qt::NoPen);
+                painter->setBrush(QColor("white"));
+                painter->drawEllipse(avatarRect);
+
+                painter->setPen(QColor("black"));
+                painter->setFont(letterFont_);
+                painter->drawText(avatarRect, Qt::AlignCenter, utils::firstChar(name));
         }
 
-        for (const auto &member : members) {
-                auto user = new MemberItem(member, this);
-                auto item = new QListWidgetItem;
+        const int textX     = avatarRect.right() + AVATAR_SPACING;
+        const int textWidth = std::max(0, option.rect.right() - textX);
 
-                item->setSizeHint(user->minimumSizeHint());
-                item->setFlags(Qt::NoItemFlags);
-                item->setTextAlignment(Qt::AlignCenter);
+        const QFontMetrics nameMetrics(nameFont_);
+        const QFontMetrics idMetrics(idFont_);
 
-                list_->insertItem(list_->count() - 1, item);
-                list_->setItemWidget(item, user);
-        }
+        int textY =
+          option.rect.y() + (option.rect.height() - nameMetrics.height() - idMetrics.height()) / 2;
+
+        painter->setPen(option.palette.color(QPalette::Text));
+
+        painter->setFont(nameFont_);
+        painter->drawText(QRect(textX, textY, textWidth, nameMetrics.height()),
+                          Qt::AlignLeft | Qt::AlignVCenter,
+                          nameMetrics.elidedText(name, Qt::ElideRight, textWidth));
+
+        textY += nameMetrics.height();
+
+        painter->setFont(idFont_);
+        painter->drawText(QRect(textX, textY, textWidth, idMetrics.height()),
+                          Qt::AlignLeft | Qt::AlignVCenter,
+                          idMetrics.elidedText(userId, Qt::ElideRight, textWidth));
+
+        painter->restore();
+}
+
+QSize
+MemberItemDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &) const
+{
+        return QSize(option.rect.width(), AVATAR_SIZE + 2);
+}
+
+MemberList::MemberList(const QString &room_id, QWidget *parent)
+  : QFrame(parent)
+{
+        setMaximumSize(420, 380);
+        setAttribute(Qt::WA_DeleteOnClose, true);
+
+        auto layout = new QVBoxLayout(this);
+        layout->setSpacing(30);
+        layout->setMargin(20);
+
+        const int avatarPixels =
+          AVATAR_SIZE * QApplication::desktop()->screen()->devicePixelRatio();
+
+        model_ = new MemberListModel(room_id, avatarPixels, this);
+
+        // All the rows have the same height, so the view doesn't have to ask
+        // the delegate for the size of every member.
+        list_ = new QListView(this);
+        list_->setFrameStyle(QFrame::NoFrame);
+        list_->setSelectionMode(QAbstractItemView::NoSelection);
+        list_->setAttribute(Qt::WA_MacShowFocusRect, 0);
+        list_->setSpacing(5);
+        list_->setUniformItemSizes(true);
+        list_->setItemDelegate(new MemberItemDelegate(list_));
+        list_->setModel(model_);
+
+        QFont font;
+        font.setPixelSize(conf::headerFontSize);
+
+        topLabel_ = new QLabel(tr("Room members"), this);
+        topLabel_->setAlignment(Qt::AlignCenter);
+        topLabel_->setFont(font);
+
+        layout->addWidget(topLabel_);
+        layout->addWidget(list_);
 }
 
 void
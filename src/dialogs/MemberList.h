@@ -1,36 +1,90 @@
 #pragma once
 
+#include <QAbstractListModel>
+#include <QCache>
 #include <QFrame>
-#include <QListWidget>
+#include <QFutureWatcher>
+#include <QImage>
+#include <QSet>
+#include <QStyledItemDelegate>
 
-class Avatar;
-class FlatButton;
-class QHBoxLayout;
-class QLabel;
-class QVBoxLayout;
-
-struct RoomMember;
+#include "Cache.h"
 
-template<class T>
-class QSharedPointer;
+class QLabel;
+class QListView;
 
 namespace dialogs {
 
-class MemberItem : public QWidget
+//! Members of a room, in the order of Cache::getMembers.
+//!
+//! The order is retrieved once in the background & kept by the model, so later syncs
+//! don't shift the rows. Rows are added a page at a time as the view scrolls down.
+//! The avatars are only decoded for the rows that are painted, also in the background.
+class MemberListModel : public QAbstractListModel
 {
         Q_OBJECT
 
 public:
-        MemberItem(const RoomMember &member, QWidget *parent);
+        enum Roles
+        {
+                UserIdRole = Qt::UserRole,
+                //! The avatar scaled to the size it's displayed at, null until it's loaded.
+                AvatarRole,
+        };
+
+        MemberListModel(const QString &room_id, int avatarSize, QObject *parent = nullptr);
+
+        int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+        QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+        bool canFetchMore(const QModelIndex &parent) const override;
+        void fetchMore(const QModelIndex &parent) override;
 
 private:
-        QHBoxLayout *topLayout_;
-        QVBoxLayout *textLayout_;
+        using MemberOrder = std::shared_ptr<const std::vector<RoomMember>>;
+
+        void setOrder();
+        void addAvatars(const std::vector<QImage> &images);
+        //! Queue the avatar of a member for decoding, unless it's already loading.
+        void requestAvatar(const RoomMember &member) const;
+        void decodeAvatars() const;
+        void setAvatar(const QString &url, const QImage &image);
+
+        QString room_id_;
+        //! Null until it's retrieved.
+        MemberOrder order_;
+        //! Number of members of the order that are shown.
+        std::size_t rows_ = 0;
+        QFutureWatcher<MemberOrder> *orderWatcher_;
+
+        //! Size of the avatars in pixels.
+        int avatarSize_;
+        mutable QCache<QString, QImage> avatars_;
+        //! Urls of the avatars that are being decoded or downloaded.
+        mutable QSet<QString> loadingAvatars_;
+        //! Members whose avatar is waiting for the next batch & the ones in the current one.
+        mutable std::vector<RoomMember> pendingAvatars_;
+        mutable std::vector<RoomMember> decodingAvatars_;
+        QFutureWatcher<std::vector<QImage>> *avatarsWatcher_;
+};
+
+//! Paints the rows of the member list, so no widgets are created for them.
+class MemberItemDelegate : public QStyledItemDelegate
+{
+        Q_OBJECT
+
+public:
+        explicit MemberItemDelegate(QObject *parent = nullptr);
 
-        Avatar *avatar_;
+        void paint(QPainter *painter,
+                   const QStyleOptionViewItem &option,
+                   const QModelIndex &index) const override;
+        QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
 
-        QLabel *userName_;
-        QLabel *userId_;
+private:
+        QFont nameFont_;
+        QFont idFont_;
+        QFont letterFont_;
 };
 
 class MemberList : public QFrame
@@ -39,23 +93,12 @@ class MemberList : public QFrame
 public:
         MemberList(const QString &room_id, QWidget *parent = nullptr);
 
-public slots:
-        void addUsers(const std::vector<RoomMember> &users);
-
 protected:
         void paintEvent(QPaintEvent *event) override;
-        void hideEvent(QHideEvent *event) override
-        {
-                list_->clear();
-                QFrame::hideEvent(event);
-        }
 
 private:
-        void moveButtonToBottom();
-
-        QString room_id_;
         QLabel *topLabel_;
-        QListWidget *list_;
-        FlatButton *moreBtn_;
+        QListView *list_;
+        MemberListModel *model_;
 };
 } // dialogs
@@ -16,6 +16,7 @@
  */
 
 #include <QByteArray>
+#include <QSet>
 
 #include "emoji/Provider.h"
 
@@ -1395,3 +1396,27 @@ const std::vector<Emoji> Provider::flags = {
   Emoji{QString::fromUtf8("\xf0\x9f\x87\xbf\xf0\x9f\x87\xb2"), ":flag_zm:"},
   Emoji{QString::fromUtf8("\xf0\x9f\x87\xbf\xf0\x9f\x87\xbc"), ":flag_zw:"},
 };
+
+bool
+Provider::isEmoji(uint codepoint)
+{
+        // The keycaps start with an ASCII digit, which shouldn't be treated as an emoji.
+        if (codepoint < 0x80)
+                return false;
+
+        static const QSet<uint> codepoints = []() {
+                QSet<uint> result;
+
+                for (const auto category :
+                     {&people, &nature, &food, &activity, &travel, &objects, &symbols, &flags}) {
+                        for (const auto &emoji : *category) {
+                                for (const auto code : emoji.unicode.toUcs4())
+                                        result.insert(code);
+                        }
+                }
+
+                return result;
+        }();
+
+        return codepoints.contains(codepoint);
+}
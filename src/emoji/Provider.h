@@ -41,5 +41,8 @@ public:
         static const std::vector<Emoji> objects;
         static const std::vector<Emoji> symbols;
         static const std::vector<Emoji> flags;
+
+        //! Whether the code point is part of one of the emoji above.
+        static bool isEmoji(uint codepoint);
 };
 } // namespace emoji
@@ -0,0 +1,16 @@
+#pragma once
+
+//! The delivery status of a message.
+enum class StatusIndicatorState
+{
+        //! The encrypted message was received by the server.
+        Encrypted,
+        //! The plaintext message was received by the server.
+        Received,
+        //! At least one of the participants has read the message.
+        Read,
+        //! The client sent the message. Not yet received.
+        Sent,
+        //! When the message is loaded from cache or backfill.
+        Empty,
+};
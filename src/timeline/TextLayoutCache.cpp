@@ -0,0 +1,41 @@
+#include "timeline/TextLayoutCache.h"
+
+#include <algorithm>
+
+#include <QTextDocument>
+#include <QTextOption>
+#include <QtMath>
+
+int
+TextLayoutCache::height(const QString &event_id,
+                        const QString &html,
+                        const QFont &font,
+                        int width)
+{
+        const int textWidth = std::max(WIDTH_STEP, width - width % WIDTH_STEP);
+
+        // Local echoes don't have an id yet, so they are laid out every time.
+        const auto key = QString("%1 %2 %3").arg(event_id).arg(textWidth).arg(font.key());
+        if (!event_id.isEmpty()) {
+                if (auto cached = heights_.object(key))
+                        return *cached;
+        }
+
+        // Same settings as the TextLabel of the messages.
+        QTextOption option;
+        option.setWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
+
+        QTextDocument doc;
+        doc.setDefaultFont(font);
+        doc.setDefaultTextOption(option);
+        doc.setDocumentMargin(0);
+        doc.setHtml(html);
+        doc.setTextWidth(textWidth);
+
+        const int height = qCeil(doc.size().height());
+
+        if (!event_id.isEmpty())
+                heights_.insert(key, new int(height));
+
+        return height;
+}
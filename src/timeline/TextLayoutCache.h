@@ -0,0 +1,24 @@
+#pragma once
+
+#include <QCache>
+#include <QFont>
+#include <QString>
+
+//! Heights of message bodies laid out at a given width.
+//!
+//! Laying out rich text is expensive, so the results are kept to size the timeline
+//! rows that don't have a widget, e.g after the window has been resized.
+class TextLayoutCache
+{
+public:
+        //! Height of the given HTML when it's wrapped at the given width.
+        int height(const QString &event_id, const QString &html, const QFont &font, int width);
+        void clear() { heights_.clear(); }
+
+private:
+        //! Widths are rounded down to a multiple of this, so small resizes reuse the layouts.
+        static constexpr int WIDTH_STEP  = 8;
+        static constexpr int MAX_ENTRIES = 4096;
+
+        QCache<QString, int> heights_{MAX_ENTRIES};
+};
@@ -0,0 +1,247 @@
+#include "timeline/TimelineDelegate.h"
+
+#include <algorithm>
+
+#include <QAbstractItemView>
+#include <QEvent>
+#include <QVBoxLayout>
+
+#include "Config.h"
+#include "ui/InfoMessage.h"
+
+#include "timeline/widgets/AudioItem.h"
+#include "timeline/widgets/FileItem.h"
+#include "timeline/widgets/ImageItem.h"
+#include "timeline/widgets/VideoItem.h"
+
+namespace {
+//! Rough size of the widgets that don't have a fixed height.
+constexpr int ESTIMATED_INFO_HEIGHT  = 60;
+constexpr int ESTIMATED_MEDIA_HEIGHT = 200;
+}
+
+TimelineDelegate::TimelineDelegate(const QString &room_id,
+                                   TimelineModel *model,
+                                   QAbstractItemView *view)
+  : QStyledItemDelegate(view)
+  , room_id_{room_id}
+  , model_{model}
+  , view_{view}
+{}
+
+QWidget *
+TimelineDelegate::createEditor(QWidget *parent,
+                               const QStyleOptionViewItem &,
+                               const QModelIndex &index) const
+{
+        const auto &row = model_->at(index.row());
+
+        QWidget *content = nullptr;
+        if (row.kind == TimelineRow::Kind::Info)
+                content = new InfoMessage(row.info, parent);
+        else
+                content = createItem(row, parent);
+
+        // The view only stores rows for events it knows how to display.
+        if (!content)
+                content = new QWidget(parent);
+
+        QWidget *editor = content;
+
+        if (row.showDate) {
+                editor = new QWidget(parent);
+
+                auto layout = new QVBoxLayout(editor);
+                layout->setMargin(0);
+                layout->setSpacing(0);
+                layout->addWidget(new DateSeparator(row.timestamp, editor));
+                layout->addWidget(content);
+        }
+
+        editors_[editor] = index;
+
+        return editor;
+}
+
+TimelineItem *
+TimelineDelegate::createItem(const TimelineRow &row, QWidget *parent) const
+{
+        using namespace mtx::events;
+
+        using AudioEvent  = RoomEvent<msg::Audio>;
+        using EmoteEvent  = RoomEvent<msg::Emote>;
+        using FileEvent   = RoomEvent<msg::File>;
+        using ImageEvent  = RoomEvent<msg::Image>;
+        using NoticeEvent = RoomEvent<msg::Notice>;
+        using TextEvent   = RoomEvent<msg::Text>;
+        using VideoEvent  = RoomEvent<msg::Video>;
+
+        const auto &event = row.event;
+
+        TimelineItem *item = nullptr;
+
+        if (mpark::holds_alternative<AudioEvent>(event)) {
+                item = createItem<AudioEvent, AudioItem>(
+                  mpark::get<AudioEvent>(event), row.withSender, parent);
+        } else if (mpark::holds_alternative<EmoteEvent>(event)) {
+                item = createItem<EmoteEvent>(
+                  mpark::get<EmoteEvent>(event), row.body, row.withSender, parent);
+        } else if (mpark::holds_alternative<FileEvent>(event)) {
+                item = createItem<FileEvent, FileItem>(
+                  mpark::get<FileEvent>(event), row.withSender, parent);
+        } else if (mpark::holds_alternative<ImageEvent>(event)) {
+                item = createItem<ImageEvent, ImageItem>(
+                  mpark::get<ImageEvent>(event), row.withSender, parent);
+        } else if (mpark::holds_alternative<NoticeEvent>(event)) {
+                item = createItem<NoticeEvent>(
+                  mpark::get<NoticeEvent>(event), row.body, row.withSender, parent);
+        } else if (mpark::holds_alternative<TextEvent>(event)) {
+                item = createItem<TextEvent>(
+                  mpark::get<TextEvent>(event), row.body, row.withSender, parent);
+        } else if (mpark::holds_alternative<VideoEvent>(event)) {
+                item = createItem<VideoEvent, VideoItem>(
+                  mpark::get<VideoEvent>(event), row.withSender, parent);
+        } else if (mpark::holds_alternative<Sticker>(event)) {
+                item = createItem<Sticker, StickerItem>(
+                  mpark::get<Sticker>(event), row.withSender, parent);
+        }
+
+        if (!item)
+                return nullptr;
+
+        item->setStatus(row.status);
+
+        if (row.missingKeys)
+                item->addKeyRequestAction();
+
+        return item;
+}
+
+void
+TimelineDelegate::destroyEditor(QWidget *editor, const QModelIndex &index) const
+{
+        editors_.remove(editor);
+
+        QStyledItemDelegate::destroyEditor(editor, index);
+}
+
+void
+TimelineDelegate::updateEditorGeometry(QWidget *editor,
+                                       const QStyleOptionViewItem &option,
+                                       const QModelIndex &) const
+{
+        editor->setGeometry(option.rect);
+}
+
+void
+TimelineDelegate::paint(QPainter *, const QStyleOptionViewItem &, const QModelIndex &) const
+{
+        // Every visible row is covered by its widget.
+}
+
+QSize
+TimelineDelegate::sizeHint(const QStyleOptionViewItem &, const QModelIndex &index) const
+{
+        const auto &row = model_->at(index.row());
+        const int width = view_->viewport()->width();
+
+        int height = row.height;
+        if (height <= 0)
+                height = estimateHeight(row, width);
+        else if (row.bodyWidth > 0 && row.viewWidth != width)
+                height = rewrapHeight(row, width);
+
+        return QSize(width, height);
+}
+
+int
+TimelineDelegate::rewrapHeight(const TimelineRow &row, int width) const
+{
+        const auto html     = TimelineItem::bodyHtml(row.body);
+        const int bodyWidth = std::max(1, row.bodyWidth + width - row.viewWidth);
+
+        return row.height - layouts_.height(row.event_id, html, bodyFont_, row.bodyWidth) +
+               layouts_.height(row.event_id, html, bodyFont_, bodyWidth);
+}
+
+int
+TimelineDelegate::estimateHeight(const TimelineRow &row, int width) const
+{
+        int height = row.showDate ? ESTIMATED_INFO_HEIGHT : 0;
+
+        if (row.kind == TimelineRow::Kind::Info)
+                return height + ESTIMATED_INFO_HEIGHT;
+
+        using namespace mtx::events;
+
+        const auto &event = row.event;
+        if (mpark::holds_alternative<RoomEvent<msg::Image>>(event) ||
+            mpark::holds_alternative<RoomEvent<msg::Video>>(event) ||
+            mpark::holds_alternative<Sticker>(event))
+                height += ESTIMATED_MEDIA_HEIGHT;
+        else if (!row.body.isEmpty() && bodyMargin_ >= 0)
+                height += layouts_.height(row.event_id,
+                                          TimelineItem::bodyHtml(row.body),
+                                          bodyFont_,
+                                          std::max(1, width - bodyMargin_));
+        else
+                height += QFontMetrics(view_->font()).lineSpacing();
+
+        if (row.withSender)
+                height += conf::timeline::avatarSize + conf::timeline::msgAvatarTopMargin;
+        else
+                height += conf::timeline::msgTopMargin;
+
+        return height;
+}
+
+TimelineItem *
+TimelineDelegate::timelineItem(QWidget *editor)
+{
+        if (!editor)
+                return nullptr;
+
+        if (auto item = qobject_cast<TimelineItem *>(editor))
+                return item;
+
+        return editor->findChild<TimelineItem *>();
+}
+
+bool
+TimelineDelegate::eventFilter(QObject *obj, QEvent *event)
+{
+        // Text is wrapped and media are loaded after the widget is created,
+        // so the row is resized every time the widget asks for a new layout.
+        if (event->type() == QEvent::LayoutRequest) {
+                auto editor = qobject_cast<QWidget *>(obj);
+                auto index  = editors_.value(editor);
+
+                if (index.isValid()) {
+                        // Apply the layout first, so the body has its final width.
+                        if (editor->layout())
+                                editor->layout()->activate();
+
+                        auto label = editor->findChild<TextLabel *>();
+
+                        const int height    = editor->sizeHint().height();
+                        const int width     = editor->width();
+                        const int bodyWidth = label ? label->width() : 0;
+
+                        if (label) {
+                                bodyFont_   = label->font();
+                                bodyMargin_ = width - bodyWidth;
+                        }
+
+                        const auto &row    = model_->at(index.row());
+                        const bool changed = height != row.height || width != row.viewWidth ||
+                                             bodyWidth != row.bodyWidth;
+
+                        if (height > 0 && changed) {
+                                model_->setLayout(index.row(), height, width, bodyWidth);
+                                emit sizeHintChanged(index);
+                        }
+                }
+        }
+
+        return QStyledItemDelegate::eventFilter(obj, event);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <QHash>
+#include <QPersistentModelIndex>
+#include <QStyledItemDelegate>
+
+#include "timeline/TextLayoutCache.h"
+#include "timeline/TimelineItem.h"
+#include "timeline/TimelineModel.h"
+
+class QAbstractItemView;
+
+//! Builds the widgets of the timeline rows.
+//!
+//! The view asks for a row's widget only while the row is on screen, so the
+//! number of live widgets depends on the height of the window and not on the
+//! length of the history. The height of every row is remembered after its
+//! widget has been laid out, so rows keep their size once the widget is gone.
+class TimelineDelegate : public QStyledItemDelegate
+{
+        Q_OBJECT
+
+public:
+        TimelineDelegate(const QString &room_id, TimelineModel *model, QAbstractItemView *view);
+
+        QWidget *createEditor(QWidget *parent,
+                              const QStyleOptionViewItem &option,
+                              const QModelIndex &index) const override;
+        void destroyEditor(QWidget *editor, const QModelIndex &index) const override;
+        void setEditorData(QWidget *, const QModelIndex &) const override {}
+        void setModelData(QWidget *, QAbstractItemModel *, const QModelIndex &) const override {}
+        void updateEditorGeometry(QWidget *editor,
+                                  const QStyleOptionViewItem &option,
+                                  const QModelIndex &index) const override;
+
+        void paint(QPainter *painter,
+                   const QStyleOptionViewItem &option,
+                   const QModelIndex &index) const override;
+        QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+        //! The TimelineItem shown by the widget of a row, if there is one.
+        static TimelineItem *timelineItem(QWidget *editor);
+
+protected:
+        bool eventFilter(QObject *obj, QEvent *event) override;
+
+private:
+        TimelineItem *createItem(const TimelineRow &row, QWidget *parent) const;
+
+        // For events with custom display widgets.
+        template<class Event, class Widget>
+        TimelineItem *createItem(const Event &event, bool withSender, QWidget *parent) const;
+
+        // For events without custom display widgets.
+        template<class Event>
+        TimelineItem *createItem(const Event &event,
+                                 const QString &body,
+                                 bool withSender,
+                                 QWidget *parent) const;
+
+        //! Guess the height of a row that hasn't been laid out yet.
+        int estimateHeight(const TimelineRow &row, int width) const;
+        //! Height of a row that was laid out at a different width. Only the body of
+        //! the message is wrapped differently, the rest of the row keeps its size.
+        int rewrapHeight(const TimelineRow &row, int width) const;
+
+        QString room_id_;
+        TimelineModel *model_;
+        QAbstractItemView *view_;
+
+        //! The rows of the widgets that are currently alive.
+        mutable QHash<QWidget *, QPersistentModelIndex> editors_;
+
+        mutable TextLayoutCache layouts_;
+        //! Font & horizontal margin of the message bodies, taken from the last
+        //! widget that was laid out. The margin is -1 until then.
+        QFont bodyFont_;
+        int bodyMargin_ = -1;
+};
+
+template<class Event>
+TimelineItem *
+TimelineDelegate::createItem(const Event &event,
+                             const QString &body,
+                             bool withSender,
+                             QWidget *parent) const
+{
+        return new TimelineItem(event, body, withSender, room_id_, parent);
+}
+
+template<class Event, class Widget>
+TimelineItem *
+TimelineDelegate::createItem(const Event &event, bool withSender, QWidget *parent) const
+{
+        auto eventWidget = new Widget(event);
+        return new TimelineItem(eventWidget, event, withSender, room_id_, parent);
+}
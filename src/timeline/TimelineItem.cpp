@@ -25,6 +25,7 @@
 #include "Logging.h"
 #include "MainWindow.h"
 #include "Olm.h"
+#include "emoji/Provider.h"
 #include "ui/Avatar.h"
 #include "ui/Painter.h"
 
@@ -150,27 +151,25 @@ TimelineItem::init()
                         ChatPage::instance()->showReadReceipts(event_id_);
         });
 
-        connect(this, &TimelineItem::eventRedacted, this, [this](const QString &event_id) {
-                emit ChatPage::instance()->removeTimelineEvent(room_id_, event_id);
-        });
-        connect(this, &TimelineItem::redactionFailed, this, [](const QString &msg) {
-                emit ChatPage::instance()->showNotification(msg);
-        });
         connect(redactMsg_, &QAction::triggered, this, [this]() {
-                if (!event_id_.isEmpty())
-                        http::client()->redact_event(
-                          room_id_.toStdString(),
-                          event_id_.toStdString(),
-                          [this](const mtx::responses::EventId &, mtx::http::RequestErr err) {
-                                  if (err) {
-                                          emit redactionFailed(tr("Message redaction failed: %1")
-                                                                 .arg(QString::fromStdString(
-                                                                   err->matrix_error.error)));
-                                          return;
-                                  }
-
-                                  emit eventRedacted(event_id_);
-                          });
+                if (event_id_.isEmpty())
+                        return;
+
+                // The widget might be gone by the time the response arrives.
+                http::client()->redact_event(
+                  room_id_.toStdString(),
+                  event_id_.toStdString(),
+                  [room_id = room_id_, event_id = event_id_](const mtx::responses::EventId &,
+                                                             mtx::http::RequestErr err) {
+                          if (err) {
+                                  emit ChatPage::instance()->showNotification(
+                                    tr("Message redaction failed: %1")
+                                      .arg(QString::fromStdString(err->matrix_error.error)));
+                                  return;
+                          }
+
+                          emit ChatPage::instance()->removeTimelineEvent(room_id, event_id);
+                  });
         });
 
         connect(markAsRead_, &QAction::triggered, this, [this]() { sendReadReceipt(); });
@@ -224,9 +223,7 @@ TimelineItem::TimelineItem(mtx::events::MessageType ty,
                   "You: ", userid, body, utils::descriptiveTime(timestamp), timestamp};
         }
 
-        body = body.toHtmlEscaped();
-        body.replace(conf::strings::url_regex, conf::strings::url_html);
-        body.replace("\n", "<br/>");
+        body = formatText(body);
         generateTimestamp(timestamp);
 
         if (withSender) {
@@ -374,6 +371,7 @@ TimelineItem::TimelineItem(VideoItem *video,
  * Used to display remote notice messages.
  */
 TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Notice> &event,
+                           const QString &body,
                            bool with_sender,
                            const QString &room_id,
                            QWidget *parent)
@@ -388,7 +386,6 @@ TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Notice
         event_id_            = QString::fromStdString(event.event_id);
         const auto sender    = QString::fromStdString(event.sender);
         const auto timestamp = QDateTime::fromMSecsSinceEpoch(event.origin_server_ts);
-        auto body            = QString::fromStdString(event.content.body).trimmed().toHtmlEscaped();
 
         descriptionMsg_ = {Cache::displayName(room_id_, sender),
                            sender,
@@ -398,10 +395,6 @@ TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Notice
 
         generateTimestamp(timestamp);
 
-        body.replace(conf::strings::url_regex, conf::strings::url_html);
-        body.replace("\n", "<br/>");
-        body = "<i>" + body + "</i>";
-
         if (with_sender) {
                 auto displayName = Cache::displayName(room_id_, sender);
 
@@ -422,6 +415,7 @@ TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Notice
  * Used to display remote emote messages.
  */
 TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Emote> &event,
+                           const QString &body,
                            bool with_sender,
                            const QString &room_id,
                            QWidget *parent)
@@ -436,17 +430,17 @@ TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Emote>
         event_id_         = QString::fromStdString(event.event_id);
         const auto sender = QString::fromStdString(event.sender);
 
-        auto body        = QString::fromStdString(event.content.body).trimmed();
+        auto text        = QString::fromStdString(event.content.body).trimmed();
         auto timestamp   = QDateTime::fromMSecsSinceEpoch(event.origin_server_ts);
         auto displayName = Cache::displayName(room_id_, sender);
-        auto emoteMsg    = QString("* %1 %2").arg(displayName).arg(body);
+        auto emoteMsg    = QString("* %1 %2").arg(displayName).arg(text);
 
         descriptionMsg_ = {"", sender, emoteMsg, utils::descriptiveTime(timestamp), timestamp};
 
         generateTimestamp(timestamp);
-        emoteMsg = emoteMsg.toHtmlEscaped();
-        emoteMsg.replace(conf::strings::url_regex, conf::strings::url_html);
-        emoteMsg.replace("\n", "<br/>");
+
+        // The body is already formatted, only the name of the sender is added.
+        emoteMsg = QString("* %1 %2").arg(displayName.toHtmlEscaped(), body);
 
         if (with_sender) {
                 generateBody(sender, displayName, emoteMsg);
@@ -466,6 +460,7 @@ TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Emote>
  * Used to display remote text messages.
  */
 TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Text> &event,
+                           const QString &body,
                            bool with_sender,
                            const QString &room_id,
                            QWidget *parent)
@@ -480,23 +475,19 @@ TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Text>
         event_id_         = QString::fromStdString(event.event_id);
         const auto sender = QString::fromStdString(event.sender);
 
-        auto body        = QString::fromStdString(event.content.body).trimmed();
+        auto text        = QString::fromStdString(event.content.body).trimmed();
         auto timestamp   = QDateTime::fromMSecsSinceEpoch(event.origin_server_ts);
         auto displayName = Cache::displayName(room_id_, sender);
 
         QSettings settings;
         descriptionMsg_ = {sender == settings.value("auth/user_id") ? "You" : displayName,
                            sender,
-                           QString(": %1").arg(body),
+                           QString(": %1").arg(text),
                            utils::descriptiveTime(timestamp),
                            timestamp};
 
         generateTimestamp(timestamp);
 
-        body = body.toHtmlEscaped();
-        body.replace(conf::strings::url_regex, conf::strings::url_html);
-        body.replace("\n", "<br/>");
-
         if (with_sender) {
                 generateBody(sender, displayName, body);
                 setupAvatarLayout(displayName);
@@ -511,6 +502,35 @@ TimelineItem::TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Text>
         adjustMessageLayout();
 }
 
+QString
+TimelineItem::formatBody(const mtx::events::RoomEvent<mtx::events::msg::Notice> &event)
+{
+        return "<i>" + formatText(QString::fromStdString(event.content.body).trimmed()) + "</i>";
+}
+
+QString
+TimelineItem::formatBody(const mtx::events::RoomEvent<mtx::events::msg::Text> &event)
+{
+        return formatText(QString::fromStdString(event.content.body).trimmed());
+}
+
+QString
+TimelineItem::formatBody(const mtx::events::RoomEvent<mtx::events::msg::Emote> &event)
+{
+        return formatText(QString::fromStdString(event.content.body).trimmed());
+}
+
+QString
+TimelineItem::formatText(const QString &text)
+{
+        auto body = text.toHtmlEscaped();
+
+        body.replace(conf::strings::url_regex, conf::strings::url_html);
+        body.replace("\n", "<br/>");
+
+        return replaceEmoji(body);
+}
+
 void
 TimelineItem::markSent()
 {
@@ -552,9 +572,7 @@ TimelineItem::generateBody(const QString &body)
         if (body.isEmpty())
                 return;
 
-        QString content("<span>%1</span>");
-
-        body_ = new TextLabel(content.arg(replaceEmoji(body)), this);
+        body_ = new TextLabel(bodyHtml(body), this);
         body_->setFont(font_);
         body_->setTextInteractionFlags(Qt::TextSelectableByMouse | Qt::TextBrowserInteraction);
 }
@@ -626,21 +644,49 @@ TimelineItem::generateTimestamp(const QDateTime &time)
 QString
 TimelineItem::replaceEmoji(const QString &body)
 {
-        QString fmtBody = "";
+        static const QString emojiStart =
+          QString("<span style=\"font-family: Emoji One; font-size: %1px\">").arg(conf::emojiSize);
+        static const QString emojiEnd("</span>");
+
+        QString fmtBody;
+        fmtBody.reserve(body.size() + emojiStart.size() + emojiEnd.size());
 
-        QVector<uint> utf32_string = body.toUcs4();
+        bool inTag   = false;
+        bool inEmoji = false;
 
-        for (auto &code : utf32_string) {
-                // TODO: Be more precise here.
-                if (code > 9000)
-                        fmtBody += QString("<span style=\"font-family: Emoji "
-                                           "One; font-size: %1px\">")
-                                     .arg(conf::emojiSize) +
-                                   QString::fromUcs4(&code, 1) + "</span>";
-                else
-                        fmtBody += QString::fromUcs4(&code, 1);
+        for (int i = 0; i < body.size();) {
+                const QChar c = body.at(i);
+
+                uint code  = c.unicode();
+                int length = 1;
+
+                if (c.isHighSurrogate() && i + 1 < body.size() && body.at(i + 1).isLowSurrogate()) {
+                        code   = QChar::surrogateToUcs4(c, body.at(i + 1));
+                        length = 2;
+                }
+
+                // The markup (e.g links) is copied as it is.
+                if (c == '<')
+                        inTag = true;
+
+                const bool isEmoji = !inTag && emoji::Provider::isEmoji(code);
+
+                if (c == '>')
+                        inTag = false;
+
+                // Consecutive emoji share the same span.
+                if (isEmoji != inEmoji) {
+                        fmtBody += isEmoji ? emojiStart : emojiEnd;
+                        inEmoji = isEmoji;
+                }
+
+                fmtBody.append(body.constData() + i, length);
+                i += length;
         }
 
+        if (inEmoji)
+                fmtBody += emojiEnd;
+
         return fmtBody;
 }
 
@@ -763,15 +809,15 @@ TimelineItem::addAvatar()
 void
 TimelineItem::sendReadReceipt() const
 {
-        if (!event_id_.isEmpty())
-                http::client()->read_event(room_id_.toStdString(),
-                                           event_id_.toStdString(),
-                                           [this](mtx::http::RequestErr err) {
-                                                   if (err) {
-                                                           nhlog::net()->warn(
-                                                             "failed to read_event ({}, {})",
-                                                             room_id_.toStdString(),
-                                                             event_id_.toStdString());
-                                                   }
-                                           });
+        if (event_id_.isEmpty())
+                return;
+
+        const auto room_id  = room_id_.toStdString();
+        const auto event_id = event_id_.toStdString();
+
+        http::client()->read_event(
+          room_id, event_id, [room_id, event_id](mtx::http::RequestErr err) {
+                  if (err)
+                          nhlog::net()->warn("failed to read_event ({}, {})", room_id, event_id);
+          });
 }
@@ -36,6 +36,7 @@
 
 #include "Cache.h"
 #include "MatrixClient.h"
+#include "timeline/StatusIndicatorState.h"
 
 class ImageItem;
 class StickerItem;
@@ -44,20 +45,6 @@ class VideoItem;
 class FileItem;
 class Avatar;
 
-enum class StatusIndicatorState
-{
-        //! The encrypted message was received by the server.
-        Encrypted,
-        //! The plaintext message was received by the server.
-        Received,
-        //! At least one of the participants has read the message.
-        Read,
-        //! The client sent the message. Not yet received.
-        Sent,
-        //! When the message is loaded from cache or backfill.
-        Empty,
-};
-
 //!
 //! Used to notify the user about the status of a message.
 //!
@@ -165,14 +152,17 @@ class TimelineItem : public QWidget
         Q_OBJECT
 public:
         TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Notice> &e,
+                     const QString &body,
                      bool with_sender,
                      const QString &room_id,
                      QWidget *parent = 0);
         TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Text> &e,
+                     const QString &body,
                      bool with_sender,
                      const QString &room_id,
                      QWidget *parent = 0);
         TimelineItem(const mtx::events::RoomEvent<mtx::events::msg::Emote> &e,
+                     const QString &body,
                      bool with_sender,
                      const QString &room_id,
                      QWidget *parent = 0);
@@ -233,6 +223,23 @@ public:
                      const QString &room_id,
                      QWidget *parent);
 
+        //! The HTML of a message's body, given to the constructors above. It doesn't
+        //! depend on any widget, so it can be prepared outside of the GUI thread.
+        static QString formatBody(const mtx::events::RoomEvent<mtx::events::msg::Notice> &e);
+        static QString formatBody(const mtx::events::RoomEvent<mtx::events::msg::Text> &e);
+        static QString formatBody(const mtx::events::RoomEvent<mtx::events::msg::Emote> &e);
+        //! The HTML shown by the label of a formatted body.
+        static QString bodyHtml(const QString &body)
+        {
+                return QString("<span>%1</span>").arg(body);
+        }
+        //! Events displayed with a custom widget don't have a text body.
+        template<class Event>
+        static QString formatBody(const Event &)
+        {
+                return QString();
+        }
+
         void setUserAvatar(const QImage &pixmap);
         DescInfo descriptionMessage() const { return descriptionMsg_; }
         QString eventId() const { return event_id_; }
@@ -240,6 +247,8 @@ public:
         void markReceived(bool isEncrypted);
         void markRead();
         void markSent();
+        //! Display the given state without notifying the server.
+        void setStatus(StatusIndicatorState state) { statusIndicator_->setState(state); }
         bool isReceived() { return isReceived_; };
         void setRoomId(QString room_id) { room_id_ = room_id; }
         void sendReadReceipt() const;
@@ -248,10 +257,6 @@ public:
         void addAvatar();
         void addKeyRequestAction();
 
-signals:
-        void eventRedacted(const QString &event_id);
-        void redactionFailed(const QString &msg);
-
 protected:
         void paintEvent(QPaintEvent *event) override;
         void contextMenuEvent(QContextMenuEvent *event) override;
@@ -286,7 +291,10 @@ private:
         //! has been acknowledged by the server.
         bool isReceived_ = false;
 
-        QString replaceEmoji(const QString &body);
+        //! Escape plain text & turn its links, line breaks & emoji into HTML.
+        static QString formatText(const QString &text);
+        //! Show the emoji of the HTML with the emoji font.
+        static QString replaceEmoji(const QString &body);
         QString event_id_;
         QString room_id_;
 
@@ -0,0 +1,280 @@
+#include "timeline/TimelineModel.h"
+
+#include <algorithm>
+
+TimelineModel::TimelineModel(QObject *parent)
+  : QAbstractListModel(parent)
+{}
+
+int
+TimelineModel::rowCount(const QModelIndex &parent) const
+{
+        if (parent.isValid())
+                return 0;
+
+        return static_cast<int>(rows_.size());
+}
+
+QVariant
+TimelineModel::data(const QModelIndex &index, int role) const
+{
+        if (!index.isValid() || index.row() >= rowCount())
+                return QVariant();
+
+        const auto &row = rows_.at(index.row());
+
+        switch (role) {
+        case Qt::DisplayRole:
+                return row.kind == TimelineRow::Kind::Info ? row.info : row.sender;
+        case EventIdRole:
+                return row.event_id;
+        case SenderRole:
+                return row.sender;
+        case TimestampRole:
+                return row.timestamp;
+        case StatusRole:
+                return static_cast<int>(row.status);
+        default:
+                return QVariant();
+        }
+}
+
+std::vector<TimelineRow>
+TimelineModel::indexRows(std::vector<TimelineRow> rows, bool atFront)
+{
+        std::vector<TimelineRow> unknown;
+        unknown.reserve(rows.size());
+
+        for (auto &row : rows) {
+                if (!row.event_id.isEmpty()) {
+                        if (eventKeys_.contains(row.event_id))
+                                continue;
+
+                        // Reserve the id, the key is set below.
+                        eventKeys_.insert(row.event_id, 0);
+                }
+
+                unknown.emplace_back(std::move(row));
+        }
+
+        const auto assignKey = [this](TimelineRow &row, qint64 key) {
+                row.key = key;
+
+                if (!row.event_id.isEmpty())
+                        eventKeys_.insert(row.event_id, key);
+                if (!row.txn_id.empty())
+                        txnKeys_[row.txn_id] = key;
+        };
+
+        // New rows at the front get decreasing keys, starting from the one closest to
+        // the existing rows.
+        if (atFront) {
+                for (auto it = unknown.rbegin(); it != unknown.rend(); ++it)
+                        assignKey(*it, --firstKey_);
+        } else {
+                for (auto &row : unknown)
+                        assignKey(row, ++lastKey_);
+        }
+
+        return unknown;
+}
+
+int
+TimelineModel::rowOf(qint64 key) const
+{
+        if (rows_.empty())
+                return -1;
+
+        // Until a row is removed from the middle, the keys are contiguous and the
+        // position can be computed directly.
+        const auto guess = key - rows_.front().key;
+        if (guess >= 0 && guess < rowCount() && rows_.at(guess).key == key)
+                return static_cast<int>(guess);
+
+        auto it = std::lower_bound(
+          rows_.cbegin(), rows_.cend(), key, [](const TimelineRow &row, qint64 value) {
+                  return row.key < value;
+          });
+
+        if (it == rows_.cend() || it->key != key)
+                return -1;
+
+        return static_cast<int>(std::distance(rows_.cbegin(), it));
+}
+
+void
+TimelineModel::append(std::vector<TimelineRow> rows)
+{
+        rows = indexRows(std::move(rows), false);
+
+        if (rows.empty())
+                return;
+
+        const int first = rowCount();
+        const int last  = first + static_cast<int>(rows.size()) - 1;
+
+        beginInsertRows(QModelIndex(), first, last);
+        for (auto &row : rows)
+                rows_.emplace_back(std::move(row));
+
+        for (int i = first; i <= last; ++i)
+                updateGrouping(i);
+        endInsertRows();
+}
+
+void
+TimelineModel::prepend(std::vector<TimelineRow> rows)
+{
+        rows = indexRows(std::move(rows), true);
+
+        if (rows.empty())
+                return;
+
+        const int count = static_cast<int>(rows.size());
+
+        beginInsertRows(QModelIndex(), 0, count - 1);
+        for (auto it = rows.rbegin(); it != rows.rend(); ++it)
+                rows_.emplace_front(std::move(*it));
+
+        for (int i = 0; i < count; ++i)
+                updateGrouping(i);
+        endInsertRows();
+
+        // The previously first row might need an avatar or a date separator now.
+        if (count < rowCount() && updateGrouping(count))
+                emit dataChanged(index(count), index(count));
+}
+
+void
+TimelineModel::remove(int row)
+{
+        if (row < 0 || row >= rowCount())
+                return;
+
+        const auto &removed = rows_.at(row);
+
+        beginRemoveRows(QModelIndex(), row, row);
+        eventKeys_.remove(removed.event_id);
+        txnKeys_.erase(removed.txn_id);
+        rows_.erase(rows_.begin() + row);
+        endRemoveRows();
+
+        if (row < rowCount() && updateGrouping(row))
+                emit dataChanged(index(row), index(row));
+}
+
+void
+TimelineModel::clear()
+{
+        beginResetModel();
+        rows_.clear();
+        eventKeys_.clear();
+        txnKeys_.clear();
+        firstKey_ = 0;
+        lastKey_  = -1;
+        endResetModel();
+}
+
+int
+TimelineModel::indexOf(const QString &event_id) const
+{
+        auto it = eventKeys_.constFind(event_id);
+
+        return it == eventKeys_.constEnd() ? -1 : rowOf(it.value());
+}
+
+int
+TimelineModel::indexOfTxn(const std::string &txn_id) const
+{
+        auto it = txnKeys_.find(txn_id);
+
+        return it == txnKeys_.end() ? -1 : rowOf(it->second);
+}
+
+int
+TimelineModel::lastMessage() const
+{
+        for (int i = rowCount() - 1; i >= 0; --i) {
+                if (rows_.at(i).kind == TimelineRow::Kind::Message)
+                        return i;
+        }
+
+        return -1;
+}
+
+void
+TimelineModel::setEventId(int row, const QString &event_id)
+{
+        if (row < 0 || row >= rowCount())
+                return;
+
+        auto &current = rows_.at(row);
+        eventKeys_.remove(current.event_id);
+        current.event_id = event_id;
+        eventKeys_.insert(event_id, current.key);
+
+        emit dataChanged(index(row), index(row), {EventIdRole});
+}
+
+void
+TimelineModel::setStatus(int row, StatusIndicatorState status)
+{
+        if (row < 0 || row >= rowCount() || rows_.at(row).status == status)
+                return;
+
+        rows_.at(row).status = status;
+
+        emit dataChanged(index(row), index(row), {StatusRole});
+}
+
+void
+TimelineModel::setLayout(int row, int height, int viewWidth, int bodyWidth)
+{
+        auto &current = rows_.at(row);
+
+        current.height    = height;
+        current.viewWidth = viewWidth;
+        current.bodyWidth = bodyWidth;
+}
+
+bool
+TimelineModel::updateGrouping(int row)
+{
+        auto &current = rows_.at(row);
+
+        bool withSender = true;
+        bool showDate   = false;
+
+        if (row > 0) {
+                const auto &previous = rows_.at(row - 1);
+
+                showDate = previous.timestamp.daysTo(current.timestamp) != 0;
+
+                // Messages after a notice always show their sender.
+                withSender = previous.kind == TimelineRow::Kind::Info ||
+                             previous.sender != current.sender ||
+                             isDateDifference(previous.timestamp, current.timestamp);
+        }
+
+        if (current.withSender == withSender && current.showDate == showDate)
+                return false;
+
+        current.withSender = withSender;
+        current.showDate   = showDate;
+        current.height     = 0;
+
+        return true;
+}
+
+bool
+TimelineModel::isDateDifference(const QDateTime &first, const QDateTime &second) const
+{
+        // Check if the dates are in a different day.
+        if (std::abs(first.daysTo(second)) != 0)
+                return true;
+
+        const uint64_t diffInSeconds   = std::abs(first.msecsTo(second)) / 1000;
+        constexpr uint64_t fifteenMins = 15 * 60;
+
+        return diffInSeconds > fifteenMins;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QHash>
+
+#include <mtx/events/collections.hpp>
+
+#include "timeline/StatusIndicatorState.h"
+
+//! A single entry of the timeline.
+//!
+//! Rows hold the data needed to build the widget of an event, never the widget
+//! itself. Widgets are only created for the rows currently on screen.
+struct TimelineRow
+{
+        enum class Kind
+        {
+                //! A message rendered through a TimelineItem.
+                Message,
+                //! A notice about the room (e.g encryption was enabled).
+                Info,
+        };
+
+        Kind kind = Kind::Message;
+
+        //! The event to render. For encrypted events this is the decrypted one.
+        mtx::events::collections::TimelineEvents event;
+        QString event_id;
+        //! The transaction id of a local echo that hasn't been confirmed by sync.
+        std::string txn_id;
+        QString sender;
+        QDateTime timestamp;
+        //! The text of an Info row.
+        QString info;
+        //! The formatted body of a text message.
+        QString body;
+
+        //! Whether the sender's avatar & name are shown.
+        bool withSender = true;
+        //! Whether a date separator precedes the row.
+        bool showDate = false;
+        //! Whether the event couldn't be decrypted.
+        bool missingKeys = false;
+        StatusIndicatorState status = StatusIndicatorState::Empty;
+
+        //! Identifies the row in the indexes of the model. Keys increase from the
+        //! first row to the last one.
+        qint64 key = 0;
+
+        //! Height of the row's widget the last time it was laid out, 0 if unknown.
+        int height = 0;
+        //! Width of the row's widget & of its message body at that time.
+        //! The body width is 0 if the row doesn't display any text.
+        int viewWidth = 0;
+        int bodyWidth = 0;
+
+        bool isReceived() const
+        {
+                return status == StatusIndicatorState::Received ||
+                       status == StatusIndicatorState::Encrypted ||
+                       status == StatusIndicatorState::Read;
+        }
+};
+
+//! The events of a room, in the order they are displayed.
+class TimelineModel : public QAbstractListModel
+{
+        Q_OBJECT
+
+public:
+        enum Roles
+        {
+                EventIdRole = Qt::UserRole,
+                SenderRole,
+                TimestampRole,
+                StatusRole,
+        };
+
+        explicit TimelineModel(QObject *parent = nullptr);
+
+        int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+        QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+        const TimelineRow &at(int row) const { return rows_.at(row); }
+
+        //! Add rows after the last one. Rows with an already known event id are skipped.
+        void append(std::vector<TimelineRow> rows);
+        //! Add rows before the first one. Rows with an already known event id are skipped.
+        void prepend(std::vector<TimelineRow> rows);
+        void remove(int row);
+        void clear();
+
+        bool contains(const QString &event_id) const { return eventKeys_.contains(event_id); }
+        //! Position of the event with the given id, -1 if there is none.
+        int indexOf(const QString &event_id) const;
+        //! Position of the local echo with the given transaction id, -1 if there is none.
+        int indexOfTxn(const std::string &txn_id) const;
+        //! The last row that displays a message, -1 if there is none.
+        int lastMessage() const;
+
+        void setEventId(int row, const QString &event_id);
+        void setStatus(int row, StatusIndicatorState status);
+        void setLayout(int row, int height, int viewWidth, int bodyWidth);
+
+private:
+        //! Give the rows their keys & add them to the indexes, skipping the known events.
+        //! The keys are taken from the given end of the timeline.
+        std::vector<TimelineRow> indexRows(std::vector<TimelineRow> rows, bool atFront);
+        //! Position of the row with the given key, -1 if there is none.
+        int rowOf(qint64 key) const;
+        //! Decide whether the given row shows its sender & a date separator,
+        //! based on the row before it. Returns true if any of them changed.
+        bool updateGrouping(int row);
+        bool isDateDifference(const QDateTime &first, const QDateTime &second) const;
+
+        std::deque<TimelineRow> rows_;
+        //! The keys of the rows by event id & by the transaction id of local echoes.
+        QHash<QString, qint64> eventKeys_;
+        std::unordered_map<std::string, qint64> txnKeys_;
+        //! The last keys given at each end of the timeline.
+        qint64 firstKey_ = 0;
+        qint64 lastKey_  = -1;
+};
@@ -21,6 +21,7 @@
 #include <QtConcurrent>
 
 #include "Cache.h"
+#include "CacheCodec.h"
 #include "ChatPage.h"
 #include "Config.h"
 #include "Logging.h"
@@ -28,34 +29,16 @@
 #include "UserSettingsPage.h"
 #include "Utils.h"
 #include "ui/FloatingButton.h"
-#include "ui/InfoMessage.h"
 
+#include "timeline/TimelineDelegate.h"
 #include "timeline/TimelineView.h"
-#include "timeline/widgets/AudioItem.h"
-#include "timeline/widgets/FileItem.h"
-#include "timeline/widgets/ImageItem.h"
-#include "timeline/widgets/VideoItem.h"
 
 using TimelineEvent = mtx::events::collections::TimelineEvents;
 
-//! Maximum number of widgets to keep in the timeline layout.
-constexpr int MAX_RETAINED_WIDGETS = 100;
-constexpr int MIN_SCROLLBAR_HANDLE = 60;
-
-//! Retrieve the timestamp of the event represented by the given widget.
-QDateTime
-getDate(QWidget *widget)
-{
-        auto item = qobject_cast<TimelineItem *>(widget);
-        if (item)
-                return item->descriptionMessage().datetime;
-
-        auto infoMsg = qobject_cast<InfoMessage *>(widget);
-        if (infoMsg)
-                return infoMsg->datetime();
-
-        return QDateTime();
-}
+//! Maximum number of events to keep in the timeline while it's hidden.
+constexpr int MAX_RETAINED_EVENTS = 500;
+//! Number of messages read from the cache for every page of history.
+constexpr std::size_t STORED_MESSAGES_PAGE = 30;
 
 TimelineView::TimelineView(const mtx::responses::Timeline &timeline,
                            const QString &room_id,
@@ -80,28 +63,21 @@ TimelineView::sliderRangeChanged(int min, int max)
 {
         Q_UNUSED(min);
 
-        if (!scroll_area_->verticalScrollBar()->isVisible()) {
-                scroll_area_->verticalScrollBar()->setValue(max);
-                return;
+        auto scrollbar = list_->verticalScrollBar();
+
+        // Keep the view at the bottom if it was there before the rows changed,
+        // e.g when a new message is added.
+        if (!scrollbar->isVisible() || atBottom_) {
+                scrollbar->setValue(max);
+        } else if (anchor_.isValid()) {
+                // Otherwise keep the first visible row in place, e.g when older messages
+                // are added at the top or the rows above are resized.
+                const int diff = list_->visualRect(anchor_).top() - anchorOffset_;
+                scrollbar->setValue(scrollbar->value() + diff);
         }
 
-        // If the scrollbar is close to the bottom and a new message
-        // is added we move the scrollbar.
-        if (max - scroll_area_->verticalScrollBar()->value() < SCROLL_BAR_GAP) {
-                scroll_area_->verticalScrollBar()->setValue(max);
-                return;
-        }
-
-        int currentHeight = scroll_widget_->size().height();
-        int diff          = currentHeight - oldHeight_;
-        int newPosition   = oldPosition_ + diff;
-
-        // Keep the scroll bar to the bottom if it hasn't been activated yet.
-        if (oldPosition_ == 0 && !scroll_area_->verticalScrollBar()->isVisible())
-                newPosition = max;
-
-        if (lastMessageDirection_ == TimelineDirection::Top)
-                scroll_area_->verticalScrollBar()->setValue(newPosition);
+        // More rows might fit on the screen after the layout.
+        QTimer::singleShot(0, this, &TimelineView::updateVisibleRows);
 }
 
 void
@@ -124,12 +100,12 @@ TimelineView::fetchHistory()
 void
 TimelineView::scrollDown()
 {
-        int current = scroll_area_->verticalScrollBar()->value();
-        int max     = scroll_area_->verticalScrollBar()->maximum();
+        int current = list_->verticalScrollBar()->value();
+        int max     = list_->verticalScrollBar()->maximum();
 
         // The first time we enter the room move the scroll bar to the bottom.
         if (!isInitialized) {
-                scroll_area_->verticalScrollBar()->setValue(max);
+                list_->verticalScrollBar()->setValue(max);
                 isInitialized = true;
                 return;
         }
@@ -137,13 +113,17 @@ TimelineView::scrollDown()
         // If the gap is small enough move the scroll bar down. e.g when a new
         // message appears.
         if (max - current < SCROLL_BAR_GAP)
-                scroll_area_->verticalScrollBar()->setValue(max);
+                list_->verticalScrollBar()->setValue(max);
 }
 
 void
 TimelineView::sliderMoved(int position)
 {
-        if (!scroll_area_->verticalScrollBar()->isVisible())
+        atBottom_ = list_->verticalScrollBar()->maximum() - position < SCROLL_BAR_GAP;
+        saveScrollAnchor();
+        updateVisibleRows();
+
+        if (!list_->verticalScrollBar()->isVisible())
                 return;
 
         toggleScrollDownButton();
@@ -183,7 +163,7 @@ TimelineView::addBackwardsEvents(const mtx::responses::Messages &msgs)
         // The RoomList message preview will be updated only if this
         // is the first batch of messages received through /messages
         // i.e there are no other messages currently present.
-        if (!topMessages_.empty() && scroll_layout_->count() == 1)
+        if (!topMessages_.empty() && model_->rowCount() == 0)
                 notifyForLastEvent(findFirstViewableEvent(topMessages_));
 
         if (isVisible()) {
@@ -191,19 +171,54 @@ TimelineView::addBackwardsEvents(const mtx::responses::Messages &msgs)
 
                 // Free up space for new messages.
                 topMessages_.clear();
-
-                // Send a read receipt for the last event.
-                if (isActiveWindow())
-                        readLastEvent();
         }
 
         prev_batch_token_       = QString::fromStdString(msgs.end);
         isPaginationInProgress_ = false;
 }
 
-QWidget *
-TimelineView::parseMessageEvent(const mtx::events::collections::TimelineEvents &event,
-                                TimelineDirection direction)
+std::vector<TimelineRow>
+TimelineView::prepareRows(const QString &room_id, const EventBatch &batch)
+{
+        // The widgets of the rows will look up the members of the room.
+        if (cache::client())
+                cache::client()->loadMembers(room_id.toStdString());
+
+        std::vector<TimelineRow> rows;
+        rows.reserve(batch.events.size());
+
+        const auto addRow = [&room_id, &rows](const TimelineEvent &event) {
+                TimelineRow row;
+                if (prepareRow(room_id, event, row))
+                        rows.emplace_back(std::move(row));
+        };
+
+        // The /messages endpoint returns the events in reverse chronological order.
+        if (batch.direction == TimelineDirection::Top)
+                std::for_each(batch.events.rbegin(), batch.events.rend(), addRow);
+        else
+                std::for_each(batch.events.begin(), batch.events.end(), addRow);
+
+        // The cache only has the encrypted events, so their bodies are indexed here.
+        std::vector<mtx::events::collections::TimelineEvents> decrypted;
+        for (const auto &row : rows) {
+                if (row.status == StatusIndicatorState::Encrypted)
+                        decrypted.push_back(row.event);
+        }
+
+        if (!decrypted.empty() && cache::client()) {
+                try {
+                        cache::client()->indexMessages(room_id.toStdString(), decrypted);
+                } catch (const lmdb::error &e) {
+                        nhlog::db()->warn("failed to index decrypted messages: {}", e.what());
+                }
+        }
+
+        return rows;
+}
+
+bool
+TimelineView::prepareRow(const QString &room_id, const TimelineEvent &event, TimelineRow &row)
 {
         using namespace mtx::events;
 
@@ -215,80 +230,91 @@ TimelineView::parseMessageEvent(const mtx::events::collections::TimelineEvents &
         using TextEvent   = RoomEvent<msg::Text>;
         using VideoEvent  = RoomEvent<msg::Video>;
 
-        if (mpark::holds_alternative<RedactionEvent<msg::Redaction>>(event)) {
-                auto redaction_event = mpark::get<RedactionEvent<msg::Redaction>>(event);
-                const auto event_id  = QString::fromStdString(redaction_event.redacts);
-
-                QTimer::singleShot(0, this, [event_id, this]() {
-                        if (eventIds_.contains(event_id))
-                                removeEvent(event_id);
-                });
-
-                return nullptr;
-        } else if (mpark::holds_alternative<StateEvent<state::Encryption>>(event)) {
-                auto msg      = mpark::get<StateEvent<state::Encryption>>(event);
-                auto event_id = QString::fromStdString(msg.event_id);
-
-                if (eventIds_.contains(event_id))
-                        return nullptr;
-
-                auto item = new InfoMessage(tr("Encryption is enabled"), this);
-                item->saveDatetime(QDateTime::fromMSecsSinceEpoch(msg.origin_server_ts));
-                eventIds_[event_id] = item;
-
-                // Force the next message to have avatar by not providing the current username.
-                saveMessageInfo("", msg.origin_server_ts, direction);
+        if (mpark::holds_alternative<StateEvent<state::Encryption>>(event)) {
+                auto msg = mpark::get<StateEvent<state::Encryption>>(event);
 
-                return item;
+                row.kind      = TimelineRow::Kind::Info;
+                row.event     = msg;
+                row.event_id  = QString::fromStdString(msg.event_id);
+                row.timestamp = QDateTime::fromMSecsSinceEpoch(msg.origin_server_ts);
+                row.info      = tr("Encryption is enabled");
         } else if (mpark::holds_alternative<RoomEvent<msg::Audio>>(event)) {
-                auto audio = mpark::get<RoomEvent<msg::Audio>>(event);
-                return processMessageEvent<AudioEvent, AudioItem>(audio, direction);
+                prepareMessageRow<AudioEvent>(mpark::get<AudioEvent>(event), row);
         } else if (mpark::holds_alternative<RoomEvent<msg::Emote>>(event)) {
-                auto emote = mpark::get<RoomEvent<msg::Emote>>(event);
-                return processMessageEvent<EmoteEvent>(emote, direction);
+                prepareMessageRow<EmoteEvent>(mpark::get<EmoteEvent>(event), row);
         } else if (mpark::holds_alternative<RoomEvent<msg::File>>(event)) {
-                auto file = mpark::get<RoomEvent<msg::File>>(event);
-                return processMessageEvent<FileEvent, FileItem>(file, direction);
+                prepareMessageRow<FileEvent>(mpark::get<FileEvent>(event), row);
         } else if (mpark::holds_alternative<RoomEvent<msg::Image>>(event)) {
-                auto image = mpark::get<RoomEvent<msg::Image>>(event);
-                return processMessageEvent<ImageEvent, ImageItem>(image, direction);
+                prepareMessageRow<ImageEvent>(mpark::get<ImageEvent>(event), row);
         } else if (mpark::holds_alternative<RoomEvent<msg::Notice>>(event)) {
-                auto notice = mpark::get<RoomEvent<msg::Notice>>(event);
-                return processMessageEvent<NoticeEvent>(notice, direction);
+                prepareMessageRow<NoticeEvent>(mpark::get<NoticeEvent>(event), row);
         } else if (mpark::holds_alternative<RoomEvent<msg::Text>>(event)) {
-                auto text = mpark::get<RoomEvent<msg::Text>>(event);
-                return processMessageEvent<TextEvent>(text, direction);
+                prepareMessageRow<TextEvent>(mpark::get<TextEvent>(event), row);
         } else if (mpark::holds_alternative<RoomEvent<msg::Video>>(event)) {
-                auto video = mpark::get<RoomEvent<msg::Video>>(event);
-                return processMessageEvent<VideoEvent, VideoItem>(video, direction);
+                prepareMessageRow<VideoEvent>(mpark::get<VideoEvent>(event), row);
         } else if (mpark::holds_alternative<Sticker>(event)) {
-                return processMessageEvent<Sticker, StickerItem>(mpark::get<Sticker>(event),
-                                                                 direction);
+                prepareMessageRow<Sticker>(mpark::get<Sticker>(event), row);
         } else if (mpark::holds_alternative<EncryptedEvent<msg::Encrypted>>(event)) {
-                auto res = parseEncryptedEvent(mpark::get<EncryptedEvent<msg::Encrypted>>(event));
-                auto widget = parseMessageEvent(res.event, direction);
+                auto res = parseEncryptedEvent(
+                  room_id, mpark::get<EncryptedEvent<msg::Encrypted>>(event));
 
-                if (widget == nullptr)
-                        return nullptr;
+                if (!prepareRow(room_id, res.event, row))
+                        return false;
 
-                auto item = qobject_cast<TimelineItem *>(widget);
+                if (res.isDecrypted)
+                        row.status = StatusIndicatorState::Encrypted;
+                else
+                        row.missingKeys = true;
+        } else {
+                return false;
+        }
 
-                if (item && res.isDecrypted)
-                        item->markReceived(true);
-                else if (item && !res.isDecrypted)
-                        item->addKeyRequestAction();
+        return true;
+}
+
+bool
+TimelineView::acceptRow(TimelineRow &row)
+{
+        // Only the local echoes keep their transaction id.
+        std::string txn_id;
+        std::swap(txn_id, row.txn_id);
 
-                return widget;
+        if ((!txn_id.empty() && isPendingMessage(txn_id, row.sender, local_user_)) ||
+            isDuplicate(row.event_id)) {
+                removePendingMessage(txn_id);
+                return false;
         }
 
-        return nullptr;
+        // Our own messages have been received by the server if they came back from it.
+        if (row.sender == local_user_ && row.status == StatusIndicatorState::Empty)
+                row.status = StatusIndicatorState::Received;
+
+        return true;
+}
+
+void
+TimelineView::removeRedactedEvents(const std::vector<TimelineEvent> &events)
+{
+        using RedactionEvent = mtx::events::RedactionEvent<mtx::events::msg::Redaction>;
+
+        for (const auto &event : events) {
+                if (!mpark::holds_alternative<RedactionEvent>(event))
+                        continue;
+
+                const auto event_id =
+                  QString::fromStdString(mpark::get<RedactionEvent>(event).redacts);
+
+                if (model_->contains(event_id))
+                        removeEvent(event_id);
+        }
 }
 
 DecryptionResult
-TimelineView::parseEncryptedEvent(const mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> &e)
+TimelineView::parseEncryptedEvent(const QString &room_id,
+                                  const mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> &e)
 {
         MegolmSessionIndex index;
-        index.room_id    = room_id_.toStdString();
+        index.room_id    = room_id.toStdString();
         index.session_id = e.content.session_id;
         index.sender_key = e.content.sender_key;
 
@@ -364,7 +390,11 @@ void
 TimelineView::displayReadReceipts(std::vector<TimelineEvent> events)
 {
         QtConcurrent::run(
-          [events = std::move(events), room_id = room_id_, local_user = local_user_, this]() {
+          [events     = std::move(events),
+           room_id    = room_id_,
+           local_user = local_user_,
+           token      = workToken_,
+           this]() {
                   std::vector<QString> event_ids;
 
                   for (const auto &e : events) {
@@ -384,74 +414,65 @@ TimelineView::displayReadReceipts(std::vector<TimelineEvent> events)
 void
 TimelineView::renderBottomEvents(const std::vector<TimelineEvent> &events)
 {
-        int counter = 0;
-
-        for (const auto &event : events) {
-                QWidget *item = parseMessageEvent(event, TimelineDirection::Bottom);
-
-                if (item != nullptr) {
-                        addTimelineItem(item, TimelineDirection::Bottom);
-                        counter++;
+        batches_.enqueue({TimelineDirection::Bottom, events});
+        prepareNextBatch();
+}
 
-                        // Prevent blocking of the event-loop
-                        // by calling processEvents every 10 items we render.
-                        if (counter % 4 == 0)
-                                QApplication::processEvents();
-                }
-        }
+void
+TimelineView::renderTopEvents(const std::vector<TimelineEvent> &events)
+{
+        batches_.enqueue({TimelineDirection::Top, events});
+        prepareNextBatch();
+}
 
-        lastMessageDirection_ = TimelineDirection::Bottom;
+void
+TimelineView::prepareNextBatch()
+{
+        if (isPreparingRows_ || batches_.isEmpty())
+                return;
 
-        displayReadReceipts(events);
+        isPreparingRows_ = true;
+        preparedBatch_   = batches_.dequeue();
 
-        QApplication::processEvents();
+        // Decryption & text formatting happen on the thread pool, the GUI thread
+        // only inserts the finished rows.
+        rowsWatcher_->setFuture(QtConcurrent::run(
+          [room_id = room_id_, batch = preparedBatch_]() { return prepareRows(room_id, batch); }));
 }
 
 void
-TimelineView::renderTopEvents(const std::vector<TimelineEvent> &events)
+TimelineView::insertPreparedRows()
 {
-        std::vector<QWidget *> items;
-
-        // Reset the sender of the first message in the timeline
-        // cause we're about to insert a new one.
-        firstSender_.clear();
-        firstMsgTimestamp_ = QDateTime();
+        isPreparingRows_ = false;
 
-        // Parse in reverse order to determine where we should not show sender's name.
-        for (auto it = events.rbegin(); it != events.rend(); ++it) {
-                auto item = parseMessageEvent(*it, TimelineDirection::Top);
-
-                if (item != nullptr)
-                        items.push_back(item);
+        if (preparedBatch_.isDiscarded) {
+                prepareNextBatch();
+                return;
         }
 
-        // Reverse again to render them.
-        std::reverse(items.begin(), items.end());
+        auto prepared = rowsWatcher_->result();
 
-        oldPosition_ = scroll_area_->verticalScrollBar()->value();
-        oldHeight_   = scroll_widget_->size().height();
+        std::vector<TimelineRow> rows;
+        rows.reserve(prepared.size());
 
-        for (const auto &item : items)
-                addTimelineItem(item, TimelineDirection::Top);
+        for (auto &row : prepared) {
+                if (acceptRow(row))
+                        rows.emplace_back(std::move(row));
+        }
 
-        lastMessageDirection_ = TimelineDirection::Top;
+        if (preparedBatch_.direction == TimelineDirection::Top)
+                model_->prepend(std::move(rows));
+        else
+                model_->append(std::move(rows));
 
-        QApplication::processEvents();
+        removeRedactedEvents(preparedBatch_.events);
+        displayReadReceipts(std::move(preparedBatch_.events));
 
-        displayReadReceipts(events);
+        // Send a read receipt for the last event.
+        if (isVisible() && isActiveWindow())
+                readLastEvent();
 
-        // If this batch is the first being rendered (i.e the first and the last
-        // events originate from this batch), set the last sender.
-        if (lastSender_.isEmpty() && !items.empty()) {
-                for (const auto &w : items) {
-                        auto timelineItem = qobject_cast<TimelineItem *>(w);
-                        if (timelineItem) {
-                                saveLastMessageInfo(timelineItem->descriptionMessage().userid,
-                                                    timelineItem->descriptionMessage().datetime);
-                                break;
-                        }
-                }
-        }
+        prepareNextBatch();
 }
 
 void
@@ -475,10 +496,6 @@ TimelineView::addEvents(const mtx::responses::Timeline &timeline)
 
                 // Free up space for new messages.
                 bottomMessages_.clear();
-
-                // Send a read receipt for the last event.
-                if (isActiveWindow())
-                        readLastEvent();
         }
 }
 
@@ -495,37 +512,45 @@ TimelineView::init()
         scrollDownBtn_->hide();
 
         connect(scrollDownBtn_, &QPushButton::clicked, this, [this]() {
-                const int max = scroll_area_->verticalScrollBar()->maximum();
-                scroll_area_->verticalScrollBar()->setValue(max);
+                const int max = list_->verticalScrollBar()->maximum();
+                list_->verticalScrollBar()->setValue(max);
         });
         top_layout_ = new QVBoxLayout(this);
         top_layout_->setSpacing(0);
         top_layout_->setMargin(0);
 
-        scroll_area_ = new QScrollArea(this);
-        scroll_area_->setWidgetResizable(true);
-        scroll_area_->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+        model_ = new TimelineModel(this);
 
-        scrollbar_ = new ScrollBar(scroll_area_);
-        scroll_area_->setVerticalScrollBar(scrollbar_);
+        list_ = new QListView(this);
+        list_->setObjectName("timelinescrollarea");
+        list_->setFrameStyle(QFrame::NoFrame);
+        list_->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+        list_->setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+        list_->setSelectionMode(QAbstractItemView::NoSelection);
+        list_->setEditTriggers(QAbstractItemView::NoEditTriggers);
+        list_->setResizeMode(QListView::Adjust);
+        list_->setViewportMargins(4, 0, 15, 15);
+        list_->setModel(model_);
 
-        scroll_widget_ = new QWidget(this);
+        delegate_ = new TimelineDelegate(room_id_, model_, list_);
+        list_->setItemDelegate(delegate_);
 
-        scroll_layout_ = new QVBoxLayout(scroll_widget_);
-        scroll_layout_->setContentsMargins(4, 0, 15, 15);
-        scroll_layout_->addStretch(1);
-        scroll_layout_->setSpacing(0);
-        scroll_layout_->setObjectName("timelinescrollarea");
+        scrollbar_ = new ScrollBar(list_);
+        list_->setVerticalScrollBar(scrollbar_);
 
-        scroll_area_->setWidget(scroll_widget_);
-
-        top_layout_->addWidget(scroll_area_);
+        top_layout_->addWidget(list_);
 
         setLayout(top_layout_);
 
         paginationTimer_ = new QTimer(this);
         connect(paginationTimer_, &QTimer::timeout, this, &TimelineView::fetchHistory);
 
+        rowsWatcher_ = new QFutureWatcher<std::vector<TimelineRow>>(this);
+        connect(rowsWatcher_,
+                &QFutureWatcher<std::vector<TimelineRow>>::finished,
+                this,
+                &TimelineView::insertPreparedRows);
+
         connect(this, &TimelineView::messagesRetrieved, this, &TimelineView::addBackwardsEvents);
 
         connect(this, &TimelineView::messageFailed, this, &TimelineView::handleFailedMessage);
@@ -534,25 +559,26 @@ TimelineView::init()
         connect(
           this, &TimelineView::markReadEvents, this, [this](const std::vector<QString> &event_ids) {
                   for (const auto &event : event_ids) {
-                          if (eventIds_.contains(event)) {
-                                  auto widget = eventIds_[event];
-                                  if (!widget)
-                                          return;
+                          const int row = model_->indexOf(event);
 
-                                  auto item = qobject_cast<TimelineItem *>(widget);
-                                  if (!item)
-                                          return;
-
-                                  item->markRead();
-                          }
+                          if (row != -1 &&
+                              model_->at(row).status != StatusIndicatorState::Encrypted)
+                                  model_->setStatus(row, StatusIndicatorState::Read);
                   }
           });
 
-        connect(scroll_area_->verticalScrollBar(),
+        connect(model_, &TimelineModel::dataChanged, this, &TimelineView::refreshRows);
+        // Rows are created after the view has been laid out with their new content.
+        connect(model_,
+                &TimelineModel::rowsInserted,
+                this,
+                [this]() { QTimer::singleShot(0, this, &TimelineView::updateVisibleRows); });
+
+        connect(list_->verticalScrollBar(),
                 SIGNAL(valueChanged(int)),
                 this,
                 SLOT(sliderMoved(int)));
-        connect(scroll_area_->verticalScrollBar(),
+        connect(list_->verticalScrollBar(),
                 SIGNAL(rangeChanged(int, int)),
                 this,
                 SLOT(sliderRangeChanged(int, int)));
@@ -561,12 +587,18 @@ TimelineView::init()
 void
 TimelineView::getMessages()
 {
+        // Older messages are read from the cache until the stored history runs out.
+        if (!isStoredHistoryExhausted_ && getStoredMessages())
+                return;
+
         mtx::http::MessagesOpts opts;
         opts.room_id = room_id_.toStdString();
         opts.from    = prev_batch_token_.toStdString();
 
         http::client()->messages(
-          opts, [this, opts](const mtx::responses::Messages &res, mtx::http::RequestErr err) {
+          opts,
+          [this, opts, token = workToken_](const mtx::responses::Messages &res,
+                                           mtx::http::RequestErr err) {
                   if (err) {
                           nhlog::net()->error("failed to call /messages ({}): {} - {}",
                                               opts.room_id,
@@ -579,72 +611,36 @@ TimelineView::getMessages()
           });
 }
 
-void
-TimelineView::updateLastSender(const QString &user_id, TimelineDirection direction)
-{
-        if (direction == TimelineDirection::Bottom)
-                lastSender_ = user_id;
-        else
-                firstSender_ = user_id;
-}
-
 bool
-TimelineView::isSenderRendered(const QString &user_id,
-                               uint64_t origin_server_ts,
-                               TimelineDirection direction)
-{
-        if (direction == TimelineDirection::Bottom) {
-                return (lastSender_ != user_id) ||
-                       isDateDifference(lastMsgTimestamp_,
-                                        QDateTime::fromMSecsSinceEpoch(origin_server_ts));
-        } else {
-                return (firstSender_ != user_id) ||
-                       isDateDifference(firstMsgTimestamp_,
-                                        QDateTime::fromMSecsSinceEpoch(origin_server_ts));
-        }
-}
-
-void
-TimelineView::addTimelineItem(QWidget *item, TimelineDirection direction)
+TimelineView::getStoredMessages()
 {
-        const auto newDate = getDate(item);
-
-        if (direction == TimelineDirection::Bottom) {
-                const auto lastItemPosition = scroll_layout_->count() - 1;
-                const auto lastItem         = scroll_layout_->itemAt(lastItemPosition)->widget();
+        mtx::responses::Messages msgs;
 
-                if (lastItem) {
-                        const auto oldDate = getDate(lastItem);
-
-                        if (oldDate.daysTo(newDate) != 0) {
-                                auto separator = new DateSeparator(newDate, this);
-
-                                if (separator)
-                                        scroll_layout_->addWidget(separator);
-                        }
-                }
-
-                pushTimelineItem(item);
-        } else {
-                // The first item (position 0) is a stretch widget that pushes
-                // the widgets to the bottom of the page.
-                if (scroll_layout_->count() > 1) {
-                        const auto firstItem = scroll_layout_->itemAt(1)->widget();
+        try {
+                msgs = cache::client()->getMessagesBefore(
+                  room_id_.toStdString(), oldestStoredKey_, STORED_MESSAGES_PAGE);
+        } catch (const lmdb::error &e) {
+                nhlog::db()->warn("failed to read stored messages ({}): {}",
+                                  room_id_.toStdString(),
+                                  e.what());
+        } catch (const json::exception &e) {
+                nhlog::db()->warn("failed to parse stored messages ({}): {}",
+                                  room_id_.toStdString(),
+                                  e.what());
+        }
 
-                        if (firstItem) {
-                                const auto oldDate = getDate(firstItem);
+        if (msgs.chunk.empty()) {
+                isStoredHistoryExhausted_ = true;
+                return false;
+        }
 
-                                if (newDate.daysTo(oldDate) != 0) {
-                                        auto separator = new DateSeparator(oldDate);
+        const auto &oldest = msgs.chunk.back();
+        oldestStoredKey_ =
+          cache::codec::messageKey(utils::event_timestamp(oldest), utils::event_id(oldest));
 
-                                        if (separator)
-                                                scroll_layout_->insertWidget(1, separator);
-                                }
-                        }
-                }
+        emit messagesRetrieved(msgs);
 
-                scroll_layout_->insertWidget(1, item);
-        }
+        return true;
 }
 
 void
@@ -655,20 +651,22 @@ TimelineView::updatePendingMessage(const std::string &txn_id, const QString &eve
             pending_msgs_.head().txn_id == txn_id) { // We haven't received it yet
                 auto msg     = pending_msgs_.dequeue();
                 msg.event_id = event_id;
+                queued_txns_.erase(txn_id);
+
+                const int row = model_->indexOfTxn(txn_id);
 
-                if (msg.widget) {
-                        msg.widget->setEventId(event_id);
-                        eventIds_[event_id] = msg.widget;
+                if (row != -1) {
+                        model_->setEventId(row, event_id);
 
                         // If the response comes after we have received the event from sync
-                        // we've already marked the widget as received.
-                        if (!msg.widget->isReceived()) {
-                                msg.widget->markReceived(msg.is_encrypted);
+                        // we've already marked the message as received.
+                        if (!model_->at(row).isReceived()) {
+                                markReceived(row, msg.is_encrypted);
                                 cache::client()->addPendingReceipt(room_id_, event_id);
-                                pending_sent_msgs_.append(msg);
+                                pending_sent_msgs_.emplace(txn_id, msg);
                         }
                 } else {
-                        nhlog::ui()->warn("[{}] received message response for invalid widget",
+                        nhlog::ui()->warn("[{}] received message response for unknown message",
                                           txn_id);
                 }
         }
@@ -679,41 +677,41 @@ TimelineView::updatePendingMessage(const std::string &txn_id, const QString &eve
 void
 TimelineView::addUserMessage(mtx::events::MessageType ty, const QString &body)
 {
-        auto with_sender = (lastSender_ != local_user_) || isDateDifference(lastMsgTimestamp_);
-
-        TimelineItem *view_item =
-          new TimelineItem(ty, local_user_, body, with_sender, room_id_, scroll_widget_);
-
         PendingMessage message;
         message.ty     = ty;
         message.txn_id = http::client()->generate_txn_id();
         message.body   = body;
-        message.widget = view_item;
 
         try {
                 message.is_encrypted = cache::client()->isRoomEncrypted(room_id_.toStdString());
         } catch (const lmdb::error &e) {
                 nhlog::db()->critical("failed to check encryption status of room {}", e.what());
-                view_item->deleteLater();
 
                 // TODO: Send a notification to the user.
 
                 return;
         }
 
-        addTimelineItem(view_item);
+        std::vector<TimelineRow> rows;
+
+        if (ty == mtx::events::MessageType::Emote)
+                rows.emplace_back(
+                  localEcho(toRoomMessage<mtx::events::msg::Emote>(message), message.txn_id));
+        else
+                rows.emplace_back(
+                  localEcho(toRoomMessage<mtx::events::msg::Text>(message), message.txn_id));
 
-        lastMessageDirection_ = TimelineDirection::Bottom;
+        model_->append(std::move(rows));
 
-        saveLastMessageInfo(local_user_, QDateTime::currentDateTime());
         handleNewUserMessage(message);
 }
 
 void
 TimelineView::handleNewUserMessage(PendingMessage msg)
 {
+        queued_txns_.emplace(msg.txn_id, msg.is_encrypted);
         pending_msgs_.enqueue(msg);
-        if (pending_msgs_.size() == 1 && pending_sent_msgs_.isEmpty())
+        if (pending_msgs_.size() == 1 && pending_sent_msgs_.empty())
                 sendNextPendingMessage();
 }
 
@@ -729,8 +727,7 @@ TimelineView::sendNextPendingMessage()
 
         nhlog::ui()->info("[{}] sending next queued message", m.txn_id);
 
-        if (m.widget)
-                m.widget->markSent();
+        model_->setStatus(model_->indexOfTxn(m.txn_id), StatusIndicatorState::Sent);
 
         if (m.is_encrypted) {
                 nhlog::ui()->info("[{}] sending encrypted event", m.txn_id);
@@ -825,13 +822,12 @@ TimelineView::sendNextPendingMessage()
 void
 TimelineView::notifyForLastEvent()
 {
-        auto lastItem          = scroll_layout_->itemAt(scroll_layout_->count() - 1);
-        auto *lastTimelineItem = qobject_cast<TimelineItem *>(lastItem->widget());
+        const int row = model_->lastMessage();
 
-        if (lastTimelineItem)
-                emit updateLastTimelineMessage(room_id_, lastTimelineItem->descriptionMessage());
+        if (row != -1)
+                notifyForLastEvent(model_->at(row).event);
         else
-                nhlog::ui()->warn("cast to TimelineView failed: {}", room_id_.toStdString());
+                nhlog::ui()->warn("no message to preview: {}", room_id_.toStdString());
 }
 
 void
@@ -851,10 +847,7 @@ TimelineView::isPendingMessage(const std::string &txn_id,
         if (sender != local_userid)
                 return false;
 
-        auto match_txnid = [txn_id](const auto &msg) -> bool { return msg.txn_id == txn_id; };
-
-        return std::any_of(pending_msgs_.cbegin(), pending_msgs_.cend(), match_txnid) ||
-               std::any_of(pending_sent_msgs_.cbegin(), pending_sent_msgs_.cend(), match_txnid);
+        return queued_txns_.count(txn_id) != 0 || pending_sent_msgs_.count(txn_id) != 0;
 }
 
 void
@@ -863,33 +856,41 @@ TimelineView::removePendingMessage(const std::string &txn_id)
         if (txn_id.empty())
                 return;
 
-        for (auto it = pending_sent_msgs_.begin(); it != pending_sent_msgs_.end(); ++it) {
-                if (it->txn_id == txn_id) {
-                        int index = std::distance(pending_sent_msgs_.begin(), it);
-                        pending_sent_msgs_.removeAt(index);
-
-                        if (pending_sent_msgs_.isEmpty())
-                                sendNextPendingMessage();
+        if (pending_sent_msgs_.erase(txn_id) != 0) {
+                if (pending_sent_msgs_.empty())
+                        sendNextPendingMessage();
 
-                        nhlog::ui()->info("[{}] removed message with sync", txn_id);
-                }
+                nhlog::ui()->info("[{}] removed message with sync", txn_id);
         }
-        for (auto it = pending_msgs_.begin(); it != pending_msgs_.end(); ++it) {
-                if (it->txn_id == txn_id) {
-                        if (it->widget) {
-                                it->widget->markReceived(it->is_encrypted);
-
-                                // TODO: update when a solution for encrypted messages is available.
-                                if (!it->is_encrypted)
-                                        cache::client()->addPendingReceipt(room_id_, it->event_id);
-                        }
 
-                        nhlog::ui()->info("[{}] received sync before message response", txn_id);
-                        return;
+        auto queued = queued_txns_.find(txn_id);
+        if (queued != queued_txns_.end()) {
+                const bool isEncrypted = queued->second;
+                const int row          = model_->indexOfTxn(txn_id);
+
+                if (row != -1) {
+                        markReceived(row, isEncrypted);
+
+                        // TODO: update when a solution for encrypted messages is available.
+                        if (!isEncrypted)
+                                cache::client()->addPendingReceipt(room_id_,
+                                                                   model_->at(row).event_id);
                 }
+
+                nhlog::ui()->info("[{}] received sync before message response", txn_id);
         }
 }
 
+void
+TimelineView::markReceived(int row, bool isEncrypted)
+{
+        model_->setStatus(row,
+                          isEncrypted ? StatusIndicatorState::Encrypted
+                                      : StatusIndicatorState::Received);
+
+        sendReadReceipt(model_->at(row).event_id);
+}
+
 void
 TimelineView::handleFailedMessage(const std::string &txn_id)
 {
@@ -913,35 +914,36 @@ TimelineView::readLastEvent() const
         if (!ChatPage::instance()->userSettings()->isReadReceiptsEnabled())
                 return;
 
-        const auto eventId = getLastEventId();
-
-        if (!eventId.isEmpty())
-                http::client()->read_event(room_id_.toStdString(),
-                                           eventId.toStdString(),
-                                           [this, eventId](mtx::http::RequestErr err) {
-                                                   if (err) {
-                                                           nhlog::net()->warn(
-                                                             "failed to read event ({}, {})",
-                                                             room_id_.toStdString(),
-                                                             eventId.toStdString());
-                                                   }
-                                           });
+        sendReadReceipt(getLastEventId());
 }
 
-QString
-TimelineView::getLastEventId() const
+void
+TimelineView::sendReadReceipt(const QString &event_id) const
 {
-        auto index = scroll_layout_->count();
+        if (event_id.isEmpty())
+                return;
 
-        // Search backwards for the first event that has a valid event id.
-        while (index > 0) {
-                --index;
+        http::client()->read_event(room_id_.toStdString(),
+                                   event_id.toStdString(),
+                                   [room_id = room_id_, event_id](mtx::http::RequestErr err) {
+                                           if (err) {
+                                                   nhlog::net()->warn(
+                                                     "failed to read event ({}, {})",
+                                                     room_id.toStdString(),
+                                                     event_id.toStdString());
+                                           }
+                                   });
+}
 
-                auto lastItem          = scroll_layout_->itemAt(index);
-                auto *lastTimelineItem = qobject_cast<TimelineItem *>(lastItem->widget());
+QString
+TimelineView::getLastEventId() const
+{
+        // Search backwards for the first message that has a valid event id.
+        for (int row = model_->rowCount() - 1; row >= 0; --row) {
+                const auto &current = model_->at(row);
 
-                if (lastTimelineItem && !lastTimelineItem->eventId().isEmpty())
-                        return lastTimelineItem->eventId();
+                if (current.kind == TimelineRow::Kind::Message && !current.event_id.isEmpty())
+                        return current.event_id;
         }
 
         return QString("");
@@ -966,21 +968,35 @@ TimelineView::showEvent(QShowEvent *event)
         readLastEvent();
 
         QWidget::showEvent(event);
+
+        QTimer::singleShot(0, this, &TimelineView::updateVisibleRows);
 }
 
 void
 TimelineView::hideEvent(QHideEvent *event)
 {
-        const auto handleHeight = scroll_area_->verticalScrollBar()->sizeHint().height();
-        const auto widgetsNum   = scroll_layout_->count();
+        // Hidden timelines don't need any widgets.
+        for (const auto &index : openRows_) {
+                if (index.isValid())
+                        list_->closePersistentEditor(index);
+        }
+        openRows_.clear();
 
-        // Remove widgets from the timeline to reduce the memory footprint.
-        if (handleHeight < MIN_SCROLLBAR_HANDLE && widgetsNum > MAX_RETAINED_WIDGETS)
+        // Drop the events of long timelines to reduce the memory footprint.
+        if (model_->rowCount() > MAX_RETAINED_EVENTS)
                 clearTimeline();
 
         QWidget::hideEvent(event);
 }
 
+void
+TimelineView::resizeEvent(QResizeEvent *event)
+{
+        QWidget::resizeEvent(event);
+
+        QTimer::singleShot(0, this, &TimelineView::updateVisibleRows);
+}
+
 bool
 TimelineView::event(QEvent *event)
 {
@@ -993,32 +1009,33 @@ TimelineView::event(QEvent *event)
 void
 TimelineView::clearTimeline()
 {
-        // Delete all widgets.
-        QLayoutItem *item;
-        while ((item = scroll_layout_->takeAt(0)) != nullptr) {
-                delete item->widget();
-                delete item;
-        }
+        openRows_.clear();
+        anchor_ = QPersistentModelIndex();
+
+        // Delete all rows along with their widgets.
+        model_->clear();
 
         // The next call to /messages will be without a prev token.
         prev_batch_token_.clear();
-        eventIds_.clear();
+        oldestStoredKey_.clear();
+        isStoredHistoryExhausted_ = false;
 
         // Clear queues with pending messages to be rendered.
         bottomMessages_.clear();
         topMessages_.clear();
 
-        firstSender_.clear();
-        lastSender_.clear();
+        // The rows that are still being prepared belong to the old timeline.
+        batches_.clear();
+        preparedBatch_.isDiscarded = true;
 
-        scroll_layout_->addStretch(1);
+        atBottom_ = true;
 }
 
 void
 TimelineView::toggleScrollDownButton()
 {
-        const int maxScroll     = scroll_area_->verticalScrollBar()->maximum();
-        const int currentScroll = scroll_area_->verticalScrollBar()->value();
+        const int maxScroll     = list_->verticalScrollBar()->maximum();
+        const int currentScroll = list_->verticalScrollBar()->value();
 
         if (maxScroll - currentScroll > SCROLL_BAR_GAP) {
                 scrollDownBtn_->show();
@@ -1029,80 +1046,101 @@ TimelineView::toggleScrollDownButton()
 }
 
 void
-TimelineView::removeEvent(const QString &event_id)
+TimelineView::saveScrollAnchor()
 {
-        if (!eventIds_.contains(event_id)) {
-                nhlog::ui()->warn("cannot remove widget with unknown event_id: {}",
-                                  event_id.toStdString());
+        anchor_ = list_->indexAt(QPoint(list_->viewport()->width() / 2, 0));
+
+        if (anchor_.isValid())
+                anchorOffset_ = list_->visualRect(anchor_).top();
+}
+
+void
+TimelineView::updateVisibleRows()
+{
+        const int count = model_->rowCount();
+        if (count == 0 || !isVisible())
                 return;
-        }
 
-        auto removedItem = eventIds_[event_id];
+        const int center = list_->viewport()->width() / 2;
+        const auto first = list_->indexAt(QPoint(center, 0));
+        const auto last  = list_->indexAt(QPoint(center, list_->viewport()->height() - 1));
 
-        // Find the next and the previous widgets in the timeline
-        auto prevWidget = relativeWidget(removedItem, -1);
-        auto nextWidget = relativeWidget(removedItem, 1);
+        const int top    = first.isValid() ? first.row() : 0;
+        const int bottom = last.isValid() ? last.row() : count - 1;
 
-        // See if they are timeline items
-        auto prevItem = qobject_cast<TimelineItem *>(prevWidget);
-        auto nextItem = qobject_cast<TimelineItem *>(nextWidget);
+        const int from = std::max(0, top - ROW_MARGIN);
+        const int to   = std::min(count - 1, bottom + ROW_MARGIN);
 
-        // ... or a date separator
-        auto prevLabel = qobject_cast<DateSeparator *>(prevWidget);
+        // Destroy the widgets that scrolled out of the window.
+        auto it = openRows_.begin();
+        while (it != openRows_.end()) {
+                if (it->isValid() && it->row() >= from && it->row() <= to) {
+                        ++it;
+                        continue;
+                }
 
-        // If it's a TimelineItem add an avatar.
-        if (prevItem) {
-                prevItem->addAvatar();
-        }
+                if (it->isValid())
+                        list_->closePersistentEditor(*it);
 
-        if (nextItem) {
-                nextItem->addAvatar();
-        } else if (prevLabel) {
-                // If there's no chat message after this, and we have a label before us, delete the
-                // label.
-                prevLabel->deleteLater();
+                it = openRows_.erase(it);
         }
 
-        // If we deleted the last item in the timeline...
-        if (!nextItem && prevItem)
-                saveLastMessageInfo(prevItem->descriptionMessage().userid,
-                                    prevItem->descriptionMessage().datetime);
-
-        // If we deleted the first item in the timeline...
-        if (!prevItem && nextItem)
-                saveFirstMessageInfo(nextItem->descriptionMessage().userid,
-                                     nextItem->descriptionMessage().datetime);
-
-        // If we deleted the only item in the timeline...
-        if (!prevItem && !nextItem) {
-                firstSender_.clear();
-                firstMsgTimestamp_ = QDateTime();
-                lastSender_.clear();
-                lastMsgTimestamp_ = QDateTime();
-        }
+        for (int row = from; row <= to; ++row) {
+                const auto index = model_->index(row);
 
-        // Finally remove the event.
-        removedItem->deleteLater();
-        eventIds_.remove(event_id);
+                if (list_->indexWidget(index))
+                        continue;
 
-        // Update the room list with a view of the last message after
-        // all events have been processed.
-        QTimer::singleShot(0, this, [this]() { notifyForLastEvent(); });
+                list_->openPersistentEditor(index);
+                openRows_.emplace_back(index);
+        }
 }
 
-QWidget *
-TimelineView::relativeWidget(QWidget *item, int dt) const
+void
+TimelineView::refreshRows(const QModelIndex &topLeft,
+                          const QModelIndex &bottomRight,
+                          const QVector<int> &roles)
 {
-        int pos = scroll_layout_->indexOf(item);
+        for (int row = topLeft.row(); row <= bottomRight.row(); ++row) {
+                const auto index = model_->index(row);
+                auto widget      = list_->indexWidget(index);
+
+                if (!widget)
+                        continue;
+
+                // The id & the status of an event don't change the size of its row.
+                if (roles.contains(TimelineModel::EventIdRole) ||
+                    roles.contains(TimelineModel::StatusRole)) {
+                        if (auto item = TimelineDelegate::timelineItem(widget)) {
+                                item->setEventId(model_->at(row).event_id);
+                                item->setStatus(model_->at(row).status);
+                        }
+
+                        continue;
+                }
+
+                list_->closePersistentEditor(index);
+                list_->openPersistentEditor(index);
+        }
+}
 
-        if (pos == -1)
-                return nullptr;
+void
+TimelineView::removeEvent(const QString &event_id)
+{
+        const int row = model_->indexOf(event_id);
 
-        pos = pos + dt;
+        if (row == -1) {
+                nhlog::ui()->warn("cannot remove widget with unknown event_id: {}",
+                                  event_id.toStdString());
+                return;
+        }
 
-        bool isOutOfBounds = (pos <= 0 || pos > scroll_layout_->count() - 1);
+        // The next row gets an avatar or loses its date separator if needed.
+        model_->remove(row);
 
-        return isOutOfBounds ? nullptr : scroll_layout_->itemAt(pos)->widget();
+        // Update the room list with a view of the last message after
+        // all events have been processed.
+        QTimer::singleShot(0, this, [this]() { notifyForLastEvent(); });
 }
 
 TimelineEvent
@@ -1126,32 +1164,6 @@ TimelineView::findLastViewableEvent(const std::vector<TimelineEvent> &events)
         return (it == std::rend(events)) ? events.back() : *it;
 }
 
-void
-TimelineView::saveMessageInfo(const QString &sender,
-                              uint64_t origin_server_ts,
-                              TimelineDirection direction)
-{
-        updateLastSender(sender, direction);
-
-        if (direction == TimelineDirection::Bottom)
-                lastMsgTimestamp_ = QDateTime::fromMSecsSinceEpoch(origin_server_ts);
-        else
-                firstMsgTimestamp_ = QDateTime::fromMSecsSinceEpoch(origin_server_ts);
-}
-
-bool
-TimelineView::isDateDifference(const QDateTime &first, const QDateTime &second) const
-{
-        // Check if the dates are in a different day.
-        if (std::abs(first.daysTo(second)) != 0)
-                return true;
-
-        const uint64_t diffInSeconds   = std::abs(first.msecsTo(second)) / 1000;
-        constexpr uint64_t fifteenMins = 15 * 60;
-
-        return diffInSeconds > fifteenMins;
-}
-
 void
 TimelineView::sendRoomMessageHandler(const std::string &txn_id,
                                      const mtx::responses::EventId &res,
@@ -1324,7 +1336,7 @@ TimelineView::prepareEncryptedMessage(const PendingMessage &msg)
                 nhlog::ui()->info("retrieved {} members for {}", members.size(), room_id);
 
                 auto keeper = std::make_shared<StateKeeper>(
-                  [megolm_payload, room_id, doc, txn_id = msg.txn_id, this]() {
+                  [megolm_payload, room_id, doc, txn_id = msg.txn_id, token = workToken_, this]() {
                           try {
                                   auto data = olm::encrypt_group_message(
                                     room_id, http::client()->device_id(), doc.dump());
@@ -1352,7 +1364,7 @@ TimelineView::prepareEncryptedMessage(const PendingMessage &msg)
 
                 http::client()->query_keys(
                   req,
-                  [keeper = std::move(keeper), megolm_payload, this](
+                  [keeper = std::move(keeper), megolm_payload, token = workToken_, this](
                     const mtx::responses::QueryKeys &res, mtx::http::RequestErr err) {
                           if (err) {
                                   nhlog::net()->warn("failed to query device keys: {} {}",
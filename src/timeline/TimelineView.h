@@ -18,19 +18,27 @@
 #pragma once
 
 #include <QApplication>
+#include <QFileInfo>
+#include <QFutureWatcher>
 #include <QLayout>
 #include <QList>
+#include <QListView>
+#include <QPersistentModelIndex>
 #include <QQueue>
-#include <QScrollArea>
 #include <QStyle>
 #include <QStyleOption>
 #include <QTimer>
 
+#include <memory>
+#include <unordered_map>
+
 #include <mtx/events.hpp>
 #include <mtx/responses/messages.hpp>
 
+#include "InternedIds.h"
 #include "MatrixClient.h"
 #include "timeline/TimelineItem.h"
+#include "timeline/TimelineModel.h"
 #include "ui/ScrollBar.h"
 
 class StateKeeper
@@ -57,6 +65,21 @@ struct DecryptionResult
 class FloatingButton;
 struct DescInfo;
 
+enum class TimelineDirection
+{
+        Top,
+        Bottom,
+};
+
+//! Events waiting to be added to one end of the timeline.
+struct EventBatch
+{
+        TimelineDirection direction = TimelineDirection::Bottom;
+        std::vector<utils::TimelineEvent> events;
+        //! Set when the timeline was cleared while the rows were prepared.
+        bool isDiscarded = false;
+};
+
 // Contains info about a message shown in the history view
 // but not yet confirmed by the homeserver through sync.
 struct PendingMessage
@@ -68,7 +91,6 @@ struct PendingMessage
         QString mime;
         uint64_t media_size;
         QString event_id;
-        TimelineItem *widget;
         QSize dimensions;
         bool is_encrypted = false;
 };
@@ -101,12 +123,7 @@ template<>
 mtx::events::msg::Video
 toRoomMessage<mtx::events::msg::Video>(const PendingMessage &m);
 
-// In which place new TimelineItems should be inserted.
-enum class TimelineDirection
-{
-        Top,
-        Bottom,
-};
+class TimelineDelegate;
 
 class TimelineView : public QWidget
 {
@@ -122,7 +139,7 @@ public:
         void addEvents(const mtx::responses::Timeline &timeline);
         void addUserMessage(mtx::events::MessageType ty, const QString &msg);
 
-        template<class Widget, mtx::events::MessageType MsgType>
+        template<class Content, mtx::events::MessageType MsgType>
         void addUserMessage(const QString &url,
                             const QString &filename,
                             const QString &mime,
@@ -135,6 +152,17 @@ public:
         void removeEvent(const QString &event_id);
         void setPrevBatchToken(const QString &token) { prev_batch_token_ = token; }
 
+        //! Whether there are messages being sent, history being fetched or background
+        //! work that refers to the view.
+        bool isBusy() const
+        {
+                return isPaginationInProgress_ || !pending_msgs_.isEmpty() ||
+                       !pending_sent_msgs_.empty() || workToken_.use_count() > 1;
+        }
+
+        static mtx::events::collections::TimelineEvents findLastViewableEvent(
+          const std::vector<mtx::events::collections::TimelineEvents> &events);
+
 public slots:
         void sliderRangeChanged(int min, int max);
         void sliderMoved(int position);
@@ -144,12 +172,20 @@ public slots:
         void addBackwardsEvents(const mtx::responses::Messages &msgs);
 
         // Whether or not the initial batch has been loaded.
-        bool hasLoaded() { return scroll_layout_->count() > 1 || isTimelineFinished; }
+        bool hasLoaded() { return model_->rowCount() > 0 || isTimelineFinished; }
 
         void handleFailedMessage(const std::string &txn_id);
 
 private slots:
         void sendNextPendingMessage();
+        //! Add the rows of the batch that has just been prepared.
+        void insertPreparedRows();
+        //! Create the widgets of the rows on screen & destroy the rest.
+        void updateVisibleRows();
+        //! Rebuild or update the widgets of the rows that changed.
+        void refreshRows(const QModelIndex &topLeft,
+                         const QModelIndex &bottomRight,
+                         const QVector<int> &roles);
 
 signals:
         void updateLastTimelineMessage(const QString &user, const DescInfo &info);
@@ -162,17 +198,17 @@ protected:
         void paintEvent(QPaintEvent *event) override;
         void showEvent(QShowEvent *event) override;
         void hideEvent(QHideEvent *event) override;
+        void resizeEvent(QResizeEvent *event) override;
         bool event(QEvent *event) override;
 
 private:
         using TimelineEvent = mtx::events::collections::TimelineEvents;
 
-        //! Mark our own widgets as read if they have more than one receipt.
+        //! Mark our own messages as read if they have more than one receipt.
         void displayReadReceipts(std::vector<TimelineEvent> events);
 
-        QWidget *relativeWidget(QWidget *item, int dt) const;
-
-        DecryptionResult parseEncryptedEvent(
+        static DecryptionResult parseEncryptedEvent(
+          const QString &room_id,
           const mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> &e);
 
         void handleClaimedKeys(std::shared_ptr<StateKeeper> keeper,
@@ -190,102 +226,71 @@ private:
 
         //! Call the /messages endpoint to fill the timeline.
         void getMessages();
-        //! HACK: Fixing layout flickering when adding to the bottom
-        //! of the timeline.
-        void pushTimelineItem(QWidget *item)
-        {
-                item->hide();
-                scroll_layout_->addWidget(item);
-                QTimer::singleShot(0, this, [item]() { item->show(); });
-        };
+        //! Fill the timeline with the messages stored in the cache before the oldest
+        //! one we have. Returns false if there aren't any.
+        bool getStoredMessages();
 
         //! Decides whether or not to show or hide the scroll down button.
         void toggleScrollDownButton();
+        //! Remember the position of the first visible row, so it stays in place
+        //! when the rows above it are resized.
+        void saveScrollAnchor();
         void init();
-        void addTimelineItem(QWidget *item,
-                             TimelineDirection direction = TimelineDirection::Bottom);
-        void updateLastSender(const QString &user_id, TimelineDirection direction);
         void notifyForLastEvent();
         void notifyForLastEvent(const TimelineEvent &event);
-        //! Keep track of the sender and the timestamp of the current message.
-        void saveLastMessageInfo(const QString &sender, const QDateTime &datetime)
-        {
-                lastSender_       = sender;
-                lastMsgTimestamp_ = datetime;
-        }
-        void saveFirstMessageInfo(const QString &sender, const QDateTime &datetime)
-        {
-                firstSender_       = sender;
-                firstMsgTimestamp_ = datetime;
-        }
-        //! Keep track of the sender and the timestamp of the current message.
-        void saveMessageInfo(const QString &sender,
-                             uint64_t origin_server_ts,
-                             TimelineDirection direction);
 
         TimelineEvent findFirstViewableEvent(const std::vector<TimelineEvent> &events);
-        TimelineEvent findLastViewableEvent(const std::vector<TimelineEvent> &events);
 
         //! Mark the last event as read.
         void readLastEvent() const;
+        void sendReadReceipt(const QString &event_id) const;
         //! Whether or not the scrollbar is visible (non-zero height).
-        bool isScrollbarActivated() { return scroll_area_->verticalScrollBar()->value() != 0; }
+        bool isScrollbarActivated() { return list_->verticalScrollBar()->value() != 0; }
         //! Retrieve the event id of the last item.
         QString getLastEventId() const;
 
-        template<class Event, class Widget>
-        TimelineItem *processMessageEvent(const Event &event, TimelineDirection direction);
-
-        // TODO: Remove this eventually.
+        //! Turn a batch of events into rows, in display order. It runs on the
+        //! thread pool so it only uses its arguments, never the view.
+        static std::vector<TimelineRow> prepareRows(const QString &room_id,
+                                                    const EventBatch &batch);
+        // Return false if the event shouldn't be displayed.
+        static bool prepareRow(const QString &room_id,
+                               const TimelineEvent &event,
+                               TimelineRow &row);
         template<class Event>
-        TimelineItem *processMessageEvent(const Event &event, TimelineDirection direction);
+        static void prepareMessageRow(const Event &event, TimelineRow &row);
 
-        // For events with custom display widgets.
-        template<class Event, class Widget>
-        TimelineItem *createTimelineItem(const Event &event, bool withSender);
+        //! Start preparing the next queued batch, unless one is being prepared.
+        void prepareNextBatch();
+        //! The checks on a prepared row that depend on the current timeline.
+        //! Return false if the row shouldn't be added.
+        bool acceptRow(TimelineRow &row);
+        void removeRedactedEvents(const std::vector<TimelineEvent> &events);
 
-        // For events without custom display widgets.
-        // TODO: All events should have custom widgets.
-        template<class Event>
-        TimelineItem *createTimelineItem(const Event &event, bool withSender);
-
-        // Used to determine whether or not we should prefix a message with the
-        // sender's name.
-        bool isSenderRendered(const QString &user_id,
-                              uint64_t origin_server_ts,
-                              TimelineDirection direction);
+        //! A row showing one of our messages before the server has received it.
+        template<class Content>
+        TimelineRow localEcho(const Content &content, const std::string &txn_id) const;
 
         bool isPendingMessage(const std::string &txn_id,
                               const QString &sender,
                               const QString &userid);
         void removePendingMessage(const std::string &txn_id);
+        //! Show that the server received the local echo at the given row.
+        void markReceived(int row, bool isEncrypted);
 
-        bool isDuplicate(const QString &event_id) { return eventIds_.contains(event_id); }
+        bool isDuplicate(const QString &event_id) { return model_->contains(event_id); }
 
         void handleNewUserMessage(PendingMessage msg);
-        bool isDateDifference(const QDateTime &first,
-                              const QDateTime &second = QDateTime::currentDateTime()) const;
-
-        // Return nullptr if the event couldn't be parsed.
-        QWidget *parseMessageEvent(const mtx::events::collections::TimelineEvents &event,
-                                   TimelineDirection direction);
 
-        //! Store the event id associated with the given widget.
-        void saveEventId(QWidget *widget);
-        //! Remove all widgets from the timeline layout.
+        //! Remove all rows from the timeline.
         void clearTimeline();
 
         QVBoxLayout *top_layout_;
-        QVBoxLayout *scroll_layout_;
 
-        QScrollArea *scroll_area_;
+        QListView *list_;
         ScrollBar *scrollbar_;
-        QWidget *scroll_widget_;
-
-        QString firstSender_;
-        QDateTime firstMsgTimestamp_;
-        QString lastSender_;
-        QDateTime lastMsgTimestamp_;
+        TimelineModel *model_;
+        TimelineDelegate *delegate_;
 
         QString room_id_;
         QString prev_batch_token_;
@@ -298,20 +303,28 @@ private:
         bool isTimelineFinished = false;
         bool isInitialSync      = true;
 
+        //! Key of the oldest message read from the cache.
+        std::string oldestStoredKey_;
+        //! Whether the older messages have to be fetched from the server.
+        bool isStoredHistoryExhausted_ = false;
+
         const int SCROLL_BAR_GAP = 200;
+        //! Rows outside of the window that keep their widgets, on each side.
+        const int ROW_MARGIN = 5;
 
         QTimer *paginationTimer_;
 
-        int scroll_height_       = 0;
-        int previous_max_height_ = 0;
+        //! Whether the view was scrolled to the bottom before the last layout.
+        bool atBottom_ = true;
+        //! The first visible row & its offset from the top of the viewport.
+        QPersistentModelIndex anchor_;
+        int anchorOffset_ = 0;
 
-        int oldPosition_;
-        int oldHeight_;
+        //! The rows that currently have a widget.
+        std::vector<QPersistentModelIndex> openRows_;
 
         FloatingButton *scrollDownBtn_;
 
-        TimelineDirection lastMessageDirection_;
-
         //! Messages received by sync not added to the timeline.
         std::vector<TimelineEvent> bottomMessages_;
         //! Messages received by /messages not added to the timeline.
@@ -322,13 +335,26 @@ private:
         //! Render the given timeline events to the top of the timeline.
         void renderTopEvents(const std::vector<TimelineEvent> &events);
 
-        // The events currently rendered. Used for duplicate detection.
-        QMap<QString, QWidget *> eventIds_;
+        //! Batches of events waiting to be prepared, in the order they arrived.
+        //! They are prepared one at a time, so the rows are added in that order.
+        QQueue<EventBatch> batches_;
+        EventBatch preparedBatch_;
+        bool isPreparingRows_ = false;
+        QFutureWatcher<std::vector<TimelineRow>> *rowsWatcher_;
+
+        //! Messages waiting to be sent, in order.
         QQueue<PendingMessage> pending_msgs_;
-        QList<PendingMessage> pending_sent_msgs_;
+        //! Whether each message of pending_msgs_ is encrypted, by transaction id.
+        std::unordered_map<std::string, bool> queued_txns_;
+        //! Messages sent to the server that haven't come back through sync yet.
+        std::unordered_map<std::string, PendingMessage> pending_sent_msgs_;
+
+        //! Copied into the background tasks & http callbacks that use the view, which
+        //! keeps it from being evicted until they are done.
+        std::shared_ptr<bool> workToken_ = std::make_shared<bool>(true);
 };
 
-template<class Widget, mtx::events::MessageType MsgType>
+template<class Content, mtx::events::MessageType MsgType>
 void
 TimelineView::addUserMessage(const QString &url,
                              const QString &filename,
@@ -336,20 +362,7 @@ TimelineView::addUserMessage(const QString &url,
                              uint64_t size,
                              const QSize &dimensions)
 {
-        auto with_sender = (lastSender_ != local_user_) || isDateDifference(lastMsgTimestamp_);
-        auto trimmed     = QFileInfo{filename}.fileName(); // Trim file path.
-
-        auto widget = new Widget(url, trimmed, size, this);
-
-        TimelineItem *view_item =
-          new TimelineItem(widget, local_user_, with_sender, room_id_, scroll_widget_);
-
-        addTimelineItem(view_item);
-
-        lastMessageDirection_ = TimelineDirection::Bottom;
-
-        // Keep track of the sender and the timestamp of the current message.
-        saveLastMessageInfo(local_user_, QDateTime::currentDateTime());
+        auto trimmed = QFileInfo{filename}.fileName(); // Trim file path.
 
         PendingMessage message;
         message.ty         = MsgType;
@@ -358,76 +371,48 @@ TimelineView::addUserMessage(const QString &url,
         message.filename   = trimmed;
         message.mime       = mime;
         message.media_size = size;
-        message.widget     = view_item;
         message.dimensions = dimensions;
 
-        handleNewUserMessage(message);
-}
-
-template<class Event>
-TimelineItem *
-TimelineView::createTimelineItem(const Event &event, bool withSender)
-{
-        TimelineItem *item = new TimelineItem(event, withSender, room_id_, scroll_widget_);
-        return item;
-}
-
-template<class Event, class Widget>
-TimelineItem *
-TimelineView::createTimelineItem(const Event &event, bool withSender)
-{
-        auto eventWidget = new Widget(event);
-        auto item = new TimelineItem(eventWidget, event, withSender, room_id_, scroll_widget_);
+        std::vector<TimelineRow> rows;
+        rows.emplace_back(localEcho(toRoomMessage<Content>(message), message.txn_id));
+        model_->append(std::move(rows));
 
-        return item;
+        handleNewUserMessage(message);
 }
 
-template<class Event>
-TimelineItem *
-TimelineView::processMessageEvent(const Event &event, TimelineDirection direction)
+template<class Content>
+TimelineRow
+TimelineView::localEcho(const Content &content, const std::string &txn_id) const
 {
-        const auto event_id = QString::fromStdString(event.event_id);
-        const auto sender   = QString::fromStdString(event.sender);
-
-        const auto txn_id = event.unsigned_data.transaction_id;
-        if ((!txn_id.empty() && isPendingMessage(txn_id, sender, local_user_)) ||
-            isDuplicate(event_id)) {
-                removePendingMessage(txn_id);
-                return nullptr;
-        }
-
-        auto with_sender = isSenderRendered(sender, event.origin_server_ts, direction);
+        const auto now = QDateTime::currentDateTime();
 
-        saveMessageInfo(sender, event.origin_server_ts, direction);
+        mtx::events::RoomEvent<Content> event;
+        event.sender           = local_user_.toStdString();
+        event.origin_server_ts = now.toMSecsSinceEpoch();
+        event.content          = content;
 
-        auto item = createTimelineItem<Event>(event, with_sender);
+        TimelineRow row;
+        row.event     = event;
+        row.txn_id    = txn_id;
+        row.sender    = local_user_;
+        row.timestamp = now;
+        row.body      = TimelineItem::formatBody(event);
 
-        eventIds_[event_id] = item;
-
-        return item;
+        return row;
 }
 
-template<class Event, class Widget>
-TimelineItem *
-TimelineView::processMessageEvent(const Event &event, TimelineDirection direction)
+template<class Event>
+void
+TimelineView::prepareMessageRow(const Event &event, TimelineRow &row)
 {
-        const auto event_id = QString::fromStdString(event.event_id);
-        const auto sender   = QString::fromStdString(event.sender);
-
-        const auto txn_id = event.unsigned_data.transaction_id;
-        if ((!txn_id.empty() && isPendingMessage(txn_id, sender, local_user_)) ||
-            isDuplicate(event_id)) {
-                removePendingMessage(txn_id);
-                return nullptr;
-        }
-
-        auto with_sender = isSenderRendered(sender, event.origin_server_ts, direction);
-
-        saveMessageInfo(sender, event.origin_server_ts, direction);
-
-        auto item = createTimelineItem<Event, Widget>(event, with_sender);
+        row.event     = event;
+        row.event_id  = QString::fromStdString(event.event_id);
+        row.timestamp = QDateTime::fromMSecsSinceEpoch(event.origin_server_ts);
+        row.body      = TimelineItem::formatBody(event);
 
-        eventIds_[event_id] = item;
+        // All the rows of a sender share the same string.
+        row.sender = ids::toQString(ids::intern(event.sender));
 
-        return item;
+        // Used to match our own messages with their local echo.
+        row.txn_id = event.unsigned_data.transaction_id;
 }
@@ -20,20 +20,37 @@
 #include <QApplication>
 #include <QFileInfo>
 #include <QSettings>
+#include <QTimer>
 
 #include "Cache.h"
 #include "Logging.h"
+#include "Utils.h"
 #include "timeline/TimelineView.h"
 #include "timeline/TimelineViewManager.h"
-#include "timeline/widgets/AudioItem.h"
-#include "timeline/widgets/FileItem.h"
-#include "timeline/widgets/ImageItem.h"
-#include "timeline/widgets/VideoItem.h"
+
+//! Views that haven't been shown for this long are destroyed.
+constexpr int VIEW_IDLE_TIMEOUT_MS = 10 * 60 * 1000;
+constexpr int EVICTION_INTERVAL_MS = 60 * 1000;
+//! Maximum number of events kept for a room without a view.
+constexpr size_t MAX_BUFFERED_EVENTS = 50;
 
 TimelineViewManager::TimelineViewManager(QWidget *parent)
   : QStackedWidget(parent)
 {
         setStyleSheet("border: none;");
+
+        evictionTimer_ = new QTimer(this);
+        connect(evictionTimer_, &QTimer::timeout, this, &TimelineViewManager::evictIdleViews);
+        evictionTimer_->start(EVICTION_INTERVAL_MS);
+}
+
+void
+TimelineViewManager::clearAll()
+{
+        active_room_.clear();
+        views_.clear();
+        lastShown_.clear();
+        buffers_.clear();
 }
 
 void
@@ -50,20 +67,17 @@ TimelineViewManager::updateReadReceipts(const QString &room_id,
 void
 TimelineViewManager::removeTimelineEvent(const QString &room_id, const QString &event_id)
 {
-        auto view = views_[room_id];
-
-        if (view)
-                view->removeEvent(event_id);
+        if (timelineViewExists(room_id))
+                views_[room_id]->removeEvent(event_id);
 }
 
 void
 TimelineViewManager::queueTextMessage(const QString &msg)
 {
-        if (active_room_.isEmpty())
+        if (!timelineViewExists(active_room_))
                 return;
 
-        auto room_id = active_room_;
-        auto view    = views_[room_id];
+        auto view = views_[active_room_];
 
         view->addUserMessage(mtx::events::MessageType::Text, msg);
 }
@@ -71,11 +85,10 @@ TimelineViewManager::queueTextMessage(const QString &msg)
 void
 TimelineViewManager::queueEmoteMessage(const QString &msg)
 {
-        if (active_room_.isEmpty())
+        if (!timelineViewExists(active_room_))
                 return;
 
-        auto room_id = active_room_;
-        auto view    = views_[room_id];
+        auto view = views_[active_room_];
 
         view->addUserMessage(mtx::events::MessageType::Emote, msg);
 }
@@ -95,7 +108,7 @@ TimelineViewManager::queueImageMessage(const QString &roomid,
 
         auto view = views_[roomid];
 
-        view->addUserMessage<ImageItem, mtx::events::MessageType::Image>(
+        view->addUserMessage<mtx::events::msg::Image, mtx::events::MessageType::Image>(
           url, filename, mime, size, dimensions);
 }
 
@@ -113,7 +126,8 @@ TimelineViewManager::queueFileMessage(const QString &roomid,
 
         auto view = views_[roomid];
 
-        view->addUserMessage<FileItem, mtx::events::MessageType::File>(url, filename, mime, size);
+        view->addUserMessage<mtx::events::msg::File, mtx::events::MessageType::File>(
+          url, filename, mime, size);
 }
 
 void
@@ -130,7 +144,8 @@ TimelineViewManager::queueAudioMessage(const QString &roomid,
 
         auto view = views_[roomid];
 
-        view->addUserMessage<AudioItem, mtx::events::MessageType::Audio>(url, filename, mime, size);
+        view->addUserMessage<mtx::events::msg::Audio, mtx::events::MessageType::Audio>(
+          url, filename, mime, size);
 }
 
 void
@@ -147,14 +162,15 @@ TimelineViewManager::queueVideoMessage(const QString &roomid,
 
         auto view = views_[roomid];
 
-        view->addUserMessage<VideoItem, mtx::events::MessageType::Video>(url, filename, mime, size);
+        view->addUserMessage<mtx::events::msg::Video, mtx::events::MessageType::Video>(
+          url, filename, mime, size);
 }
 
 void
 TimelineViewManager::initialize(const mtx::responses::Rooms &rooms)
 {
         for (auto it = rooms.join.cbegin(); it != rooms.join.cend(); ++it) {
-                addRoom(it->second, QString::fromStdString(it->first));
+                addRoom(QString::fromStdString(it->first));
         }
 
         sync(rooms);
@@ -164,20 +180,10 @@ void
 TimelineViewManager::initWithMessages(const std::map<QString, mtx::responses::Timeline> &msgs)
 {
         for (auto it = msgs.cbegin(); it != msgs.cend(); ++it) {
-                if (timelineViewExists(it->first))
-                        return;
-
-                // Create a history view with the room events.
-                TimelineView *view = new TimelineView(it->second, it->first);
-                views_.emplace(it->first, QSharedPointer<TimelineView>(view));
-
-                connect(view,
-                        &TimelineView::updateLastTimelineMessage,
-                        this,
-                        &TimelineViewManager::updateRoomsLastMessage);
+                if (roomExists(it->first))
+                        continue;
 
-                // Add the view in the widget stack.
-                addWidget(view);
+                buffers_.emplace(it->first, it->second);
         }
 }
 
@@ -189,41 +195,64 @@ TimelineViewManager::initialize(const std::vector<std::string> &rooms)
 }
 
 void
-TimelineViewManager::addRoom(const mtx::responses::JoinedRoom &room, const QString &room_id)
+TimelineViewManager::addRoom(const QString &room_id)
 {
-        if (timelineViewExists(room_id))
+        if (roomExists(room_id))
                 return;
 
+        // The view is created when the room is opened for the first time.
+        buffers_.emplace(room_id, mtx::responses::Timeline());
+}
+
+QSharedPointer<TimelineView>
+TimelineViewManager::createView(const QString &room_id)
+{
+        mtx::responses::Timeline timeline;
+
+        auto buffer = buffers_.find(room_id);
+        if (buffer != buffers_.end()) {
+                timeline = std::move(buffer->second);
+                buffers_.erase(buffer);
+        }
+
         // Create a history view with the room events.
-        TimelineView *view = new TimelineView(room.timeline, room_id);
-        views_.emplace(room_id, QSharedPointer<TimelineView>(view));
+        auto view = QSharedPointer<TimelineView>(new TimelineView(timeline, room_id));
+        views_.emplace(room_id, view);
 
-        connect(view,
+        connect(view.data(),
                 &TimelineView::updateLastTimelineMessage,
                 this,
                 &TimelineViewManager::updateRoomsLastMessage);
 
         // Add the view in the widget stack.
-        addWidget(view);
+        addWidget(view.data());
+
+        return view;
 }
 
 void
-TimelineViewManager::addRoom(const QString &room_id)
+TimelineViewManager::bufferEvents(const QString &room_id, const mtx::responses::Timeline &timeline)
 {
-        if (timelineViewExists(room_id))
+        if (timeline.events.empty())
                 return;
 
-        // Create a history view without any events.
-        TimelineView *view = new TimelineView(room_id);
-        views_.emplace(room_id, QSharedPointer<TimelineView>(view));
+        auto &buffer = buffers_[room_id];
 
-        connect(view,
-                &TimelineView::updateLastTimelineMessage,
-                this,
-                &TimelineViewManager::updateRoomsLastMessage);
+        // The buffered events must be contiguous with the pagination token, so
+        // we start over from the new batch if there is a gap or too many events.
+        if (buffer.events.empty() || timeline.limited ||
+            buffer.events.size() + timeline.events.size() > MAX_BUFFERED_EVENTS) {
+                buffer = timeline;
+        } else {
+                buffer.events.insert(
+                  buffer.events.end(), timeline.events.cbegin(), timeline.events.cend());
+        }
 
-        // Add the view in the widget stack.
-        addWidget(view);
+        auto descInfo = utils::getMessageDescription(
+          TimelineView::findLastViewableEvent(timeline.events), utils::localUser(), room_id);
+
+        if (!descInfo.timestamp.isEmpty())
+                emit updateRoomsLastMessage(room_id, descInfo);
 }
 
 void
@@ -232,29 +261,34 @@ TimelineViewManager::sync(const mtx::responses::Rooms &rooms)
         for (const auto &room : rooms.join) {
                 auto roomid = QString::fromStdString(room.first);
 
-                if (!timelineViewExists(roomid)) {
+                if (!roomExists(roomid)) {
                         nhlog::ui()->warn("ignoring event from unknown room: {}",
                                           roomid.toStdString());
                         continue;
                 }
 
-                auto view = views_.at(roomid);
-
-                view->addEvents(room.second.timeline);
+                if (timelineViewExists(roomid))
+                        views_.at(roomid)->addEvents(room.second.timeline);
+                else
+                        bufferEvents(roomid, room.second.timeline);
         }
 }
 
 void
 TimelineViewManager::setHistoryView(const QString &room_id)
 {
-        if (!timelineViewExists(room_id)) {
+        if (!roomExists(room_id)) {
                 nhlog::ui()->warn("room from RoomList is not present in ViewManager: {}",
                                   room_id.toStdString());
                 return;
         }
 
+        // The view we are leaving starts its idle period now.
+        if (timelineViewExists(active_room_))
+                lastShown_[active_room_].start();
+
         active_room_ = room_id;
-        auto view    = views_.at(room_id);
+        auto view    = timelineViewExists(room_id) ? views_.at(room_id) : createView(room_id);
 
         setCurrentWidget(view.data());
 
@@ -262,6 +296,33 @@ TimelineViewManager::setHistoryView(const QString &room_id)
         view->scrollDown();
 }
 
+void
+TimelineViewManager::evictIdleViews()
+{
+        for (auto it = views_.begin(); it != views_.end();) {
+                const auto &room_id = it->first;
+                const auto shown    = lastShown_.find(room_id);
+
+                const bool isIdle = room_id != active_room_ && shown != lastShown_.end() &&
+                                    shown->second.hasExpired(VIEW_IDLE_TIMEOUT_MS);
+
+                if (!isIdle || it->second->isBusy()) {
+                        ++it;
+                        continue;
+                }
+
+                nhlog::ui()->debug("evicting idle timeline: {}", room_id.toStdString());
+
+                // The next time the room is opened the view will fetch its latest
+                // messages, like the views restored from the cache do.
+                buffers_.emplace(room_id, mtx::responses::Timeline());
+                lastShown_.erase(shown);
+
+                removeWidget(it->second.data());
+                it = views_.erase(it);
+        }
+}
+
 QString
 TimelineViewManager::chooseRandomColor()
 {
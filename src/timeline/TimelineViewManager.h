@@ -17,12 +17,14 @@
 
 #pragma once
 
+#include <QElapsedTimer>
 #include <QSharedPointer>
 #include <QStackedWidget>
 
 #include <mtx.hpp>
 
 class QFile;
+class QTimer;
 
 class RoomInfoListItem;
 class TimelineView;
@@ -41,11 +43,10 @@ public:
         // Empty initialization.
         void initialize(const std::vector<std::string> &rooms);
 
-        void addRoom(const mtx::responses::JoinedRoom &room, const QString &room_id);
         void addRoom(const QString &room_id);
 
         void sync(const mtx::responses::Rooms &rooms);
-        void clearAll() { views_.clear(); }
+        void clearAll();
 
         // Check if all the timelines have been loaded.
         bool hasLoaded() const;
@@ -86,10 +87,32 @@ public slots:
                                const QString &mime,
                                uint64_t dsize);
 
+private slots:
+        //! Destroy the views that haven't been shown for a while.
+        void evictIdleViews();
+
 private:
         //! Check if the given room id is managed by a TimelineView.
         bool timelineViewExists(const QString &id) { return views_.find(id) != views_.end(); }
+        //! Check if the given room id is managed by the ViewManager.
+        bool roomExists(const QString &id)
+        {
+                return timelineViewExists(id) || buffers_.find(id) != buffers_.end();
+        }
+
+        //! Create the view of a room from its buffered events.
+        QSharedPointer<TimelineView> createView(const QString &room_id);
+        //! Keep the new events of a room without a view until it's opened.
+        void bufferEvents(const QString &room_id, const mtx::responses::Timeline &timeline);
 
         QString active_room_;
         std::map<QString, QSharedPointer<TimelineView>> views_;
+        //! Time elapsed since each view was last shown.
+        std::map<QString, QElapsedTimer> lastShown_;
+
+        //! The events received for rooms without a view. Views are only created
+        //! when a room is opened, so most rooms only have an entry here.
+        std::map<QString, mtx::responses::Timeline> buffers_;
+
+        QTimer *evictionTimer_;
 };
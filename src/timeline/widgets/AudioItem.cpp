@@ -50,12 +50,11 @@ AudioItem::init()
         playIcon_.addFile(":/icons/icons/ui/play-sign.png");
         pauseIcon_.addFile(":/icons/icons/ui/pause-symbol.png");
 
-        player_ = new QMediaPlayer;
+        player_ = new QMediaPlayer(this);
         player_->setMedia(QUrl(url_));
         player_->setVolume(100);
         player_->setNotifyInterval(1000);
 
-        connect(this, &AudioItem::fileDownloadedCb, this, &AudioItem::fileDownloaded);
         connect(player_, &QMediaPlayer::stateChanged, this, [this](QMediaPlayer::State state) {
                 if (state == QMediaPlayer::StoppedState) {
                         state_ = AudioState::Play;
@@ -120,28 +119,30 @@ AudioItem::mousePressEvent(QMouseEvent *event)
                 if (filenameToSave_.isEmpty())
                         return;
 
+                const auto url = url_.toString().toStdString();
+
+                // The widget might be gone by the time the download completes.
                 http::client()->download(
-                  url_.toString().toStdString(),
-                  [this](const std::string &data,
-                         const std::string &,
-                         const std::string &,
-                         mtx::http::RequestErr err) {
+                  url,
+                  [filename = filenameToSave_, url](const std::string &data,
+                                                    const std::string &,
+                                                    const std::string &,
+                                                    mtx::http::RequestErr err) {
                           if (err) {
-                                  nhlog::net()->info("failed to retrieve m.audio content: {}",
-                                                     url_.toString().toStdString());
+                                  nhlog::net()->info("failed to retrieve m.audio content: {}", url);
                                   return;
                           }
 
-                          emit fileDownloadedCb(QByteArray(data.data(), data.size()));
+                          saveFile(filename, QByteArray(data.data(), data.size()));
                   });
         }
 }
 
 void
-AudioItem::fileDownloaded(const QByteArray &data)
+AudioItem::saveFile(const QString &filename, const QByteArray &data)
 {
         try {
-                QFile file(filenameToSave_);
+                QFile file(filename);
 
                 if (!file.open(QIODevice::WriteOnly))
                         return;
@@ -69,13 +69,9 @@ protected:
         void resizeEvent(QResizeEvent *event) override;
         void mousePressEvent(QMouseEvent *event) override;
 
-signals:
-        void fileDownloadedCb(const QByteArray &data);
-
-private slots:
-        void fileDownloaded(const QByteArray &data);
-
 private:
+        static void saveFile(const QString &filename, const QByteArray &data);
+
         void init();
 
         enum class AudioState
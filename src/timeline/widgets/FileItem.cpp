@@ -50,8 +50,6 @@ FileItem::init()
         icon_.addFile(":/icons/icons/ui/arrow-pointing-down.png");
 
         setFixedHeight(Height);
-
-        connect(this, &FileItem::fileDownloadedCb, this, &FileItem::fileDownloaded);
 }
 
 FileItem::FileItem(const mtx::events::RoomEvent<mtx::events::msg::File> &event, QWidget *parent)
@@ -110,19 +108,21 @@ FileItem::mousePressEvent(QMouseEvent *event)
                 if (filenameToSave_.isEmpty())
                         return;
 
+                const auto url = url_.toString().toStdString();
+
+                // The widget might be gone by the time the download completes.
                 http::client()->download(
-                  url_.toString().toStdString(),
-                  [this](const std::string &data,
-                         const std::string &,
-                         const std::string &,
-                         mtx::http::RequestErr err) {
+                  url,
+                  [filename = filenameToSave_, url](const std::string &data,
+                                                    const std::string &,
+                                                    const std::string &,
+                                                    mtx::http::RequestErr err) {
                           if (err) {
-                                  nhlog::ui()->warn("failed to retrieve m.file content: {}",
-                                                    url_.toString().toStdString());
+                                  nhlog::ui()->warn("failed to retrieve m.file content: {}", url);
                                   return;
                           }
 
-                          emit fileDownloadedCb(QByteArray(data.data(), data.size()));
+                          saveFile(filename, QByteArray(data.data(), data.size()));
                   });
         } else {
                 openUrl();
@@ -130,10 +130,10 @@ FileItem::mousePressEvent(QMouseEvent *event)
 }
 
 void
-FileItem::fileDownloaded(const QByteArray &data)
+FileItem::saveFile(const QString &filename, const QByteArray &data)
 {
         try {
-                QFile file(filenameToSave_);
+                QFile file(filename);
 
                 if (!file.open(QIODevice::WriteOnly))
                         return;
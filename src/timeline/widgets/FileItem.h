@@ -52,18 +52,14 @@ public:
         QColor iconColor() const { return iconColor_; }
         QColor backgroundColor() const { return backgroundColor_; }
 
-signals:
-        void fileDownloadedCb(const QByteArray &data);
-
 protected:
         void paintEvent(QPaintEvent *event) override;
         void mousePressEvent(QMouseEvent *event) override;
         void resizeEvent(QResizeEvent *event) override;
 
-private slots:
-        void fileDownloaded(const QByteArray &data);
-
 private:
+        static void saveFile(const QString &filename, const QByteArray &data);
+
         void openUrl();
         void init();
 
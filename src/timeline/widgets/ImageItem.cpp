@@ -22,7 +22,9 @@
 #include <QPainter>
 #include <QPixmap>
 #include <QUuid>
+#include <memory>
 
+#include "Cache.h"
 #include "Config.h"
 #include "ImageItem.h"
 #include "Logging.h"
@@ -33,11 +35,14 @@
 void
 ImageItem::downloadMedia(const QUrl &url)
 {
+        auto proxy = std::make_shared<ImageProxy>();
+        connect(proxy.get(), &ImageProxy::imageDownloaded, this, &ImageItem::setImage);
+
         http::client()->download(url.toString().toStdString(),
-                                 [this, url](const std::string &data,
-                                             const std::string &,
-                                             const std::string &,
-                                             mtx::http::RequestErr err) {
+                                 [proxy = std::move(proxy), url](const std::string &data,
+                                                                 const std::string &,
+                                                                 const std::string &,
+                                                                 mtx::http::RequestErr err) {
                                          if (err) {
                                                  nhlog::net()->warn(
                                                    "failed to retrieve image {}: {} {}",
@@ -47,9 +52,12 @@ ImageItem::downloadMedia(const QUrl &url)
                                                  return;
                                          }
 
+                                         const auto bytes = QByteArray(data.data(), data.size());
+                                         cache::client()->saveImage(url.toString(), bytes);
+
                                          QPixmap img;
-                                         img.loadFromData(QByteArray(data.data(), data.size()));
-                                         emit imageDownloaded(img);
+                                         img.loadFromData(bytes);
+                                         emit proxy->imageDownloaded(img);
                                  });
 }
 
@@ -76,8 +84,12 @@ ImageItem::init()
         setCursor(Qt::PointingHandCursor);
         setAttribute(Qt::WA_Hover, true);
 
-        connect(this, &ImageItem::imageDownloaded, this, &ImageItem::setImage);
-        connect(this, &ImageItem::imageSaved, this, &ImageItem::saveImage);
+        const auto cached = cache::client()->decodeImage(url_.toString());
+        if (!cached.isNull()) {
+                setImage(QPixmap::fromImage(cached));
+                return;
+        }
+
         downloadMedia(url_);
 }
 
@@ -242,10 +254,10 @@ ImageItem::saveAs()
 
         http::client()->download(
           url,
-          [this, filename, url](const std::string &data,
-                                const std::string &,
-                                const std::string &,
-                                mtx::http::RequestErr err) {
+          [filename, url](const std::string &data,
+                          const std::string &,
+                          const std::string &,
+                          mtx::http::RequestErr err) {
                   if (err) {
                           nhlog::net()->warn("failed to retrieve image {}: {} {}",
                                              url,
@@ -254,6 +266,6 @@ ImageItem::saveAs()
                           return;
                   }
 
-                  emit imageSaved(filename, QByteArray(data.data(), data.size()));
+                  saveImage(filename, QByteArray(data.data(), data.size()));
           });
 }
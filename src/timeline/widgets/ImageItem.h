@@ -28,6 +28,15 @@ namespace dialogs {
 class ImageOverlay;
 }
 
+//! Delivers a finished download to an ImageItem, unless the item was destroyed in the meantime.
+class ImageProxy : public QObject
+{
+        Q_OBJECT
+
+signals:
+        void imageDownloaded(const QPixmap &img);
+};
+
 class ImageItem : public QWidget
 {
         Q_OBJECT
@@ -46,11 +55,7 @@ public slots:
         //! Show a save as dialog for the image.
         void saveAs();
         void setImage(const QPixmap &image);
-        void saveImage(const QString &filename, const QByteArray &data);
 
-signals:
-        void imageDownloaded(const QPixmap &img);
-        void imageSaved(const QString &filename, const QByteArray &data);
 
 protected:
         void paintEvent(QPaintEvent *event) override;
@@ -61,6 +66,8 @@ protected:
         bool isInteractive_ = true;
 
 private:
+        static void saveImage(const QString &filename, const QByteArray &data);
+
         void init();
         void openUrl();
         void downloadMedia(const QUrl &url);
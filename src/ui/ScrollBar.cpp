@@ -17,7 +17,7 @@
 
 #include "ScrollBar.h"
 
-ScrollBar::ScrollBar(QScrollArea *area, QWidget *parent)
+ScrollBar::ScrollBar(QAbstractScrollArea *area, QWidget *parent)
   : QScrollBar(parent)
   , area_{area}
 {}
@@ -41,8 +41,9 @@ ScrollBar::paintEvent(QPaintEvent *)
         QRect backgroundArea(Padding, 0, handleWidth_, height());
         p.drawRoundedRect(backgroundArea, roundRadius_, roundRadius_);
 
+        // The scrolled contents are a page taller than the scroll range.
         int areaHeight   = area_->height();
-        int widgetHeight = area_->widget()->height();
+        int widgetHeight = maximum() - minimum() + pageStep();
 
         double visiblePercentage = (double)areaHeight / (double)widgetHeight;
         int handleHeight = std::max(visiblePercentage * areaHeight, (double)minHandleHeight_);
@@ -17,8 +17,8 @@
 
 #pragma once
 
+#include <QAbstractScrollArea>
 #include <QPainter>
-#include <QScrollArea>
 #include <QScrollBar>
 
 class ScrollBar : public QScrollBar
@@ -28,7 +28,7 @@ class ScrollBar : public QScrollBar
         Q_PROPERTY(QColor handleColor READ handleColor WRITE setHandleColor)
 
 public:
-        ScrollBar(QScrollArea *area, QWidget *parent = nullptr);
+        ScrollBar(QAbstractScrollArea *area, QWidget *parent = nullptr);
 
         QColor backgroundColor() const { return bgColor_; }
         void setBackgroundColor(QColor &color) { bgColor_ = color; }
@@ -46,7 +46,7 @@ private:
 
         const int Padding = 4;
 
-        QScrollArea *area_;
+        QAbstractScrollArea *area_;
         QRect handle_;
 
         QColor bgColor_     = QColor(33, 33, 33, 30);
@@ -0,0 +1,120 @@
+// Encodes & decodes records shaped like the room & member infos of the cache.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "CacheCodec.h"
+#include "Check.h"
+
+using namespace cache::codec;
+
+namespace {
+constexpr int RECORDS = 100000;
+constexpr int ROUNDS  = 20;
+
+struct Room
+{
+        std::string name;
+        std::string topic;
+        std::string avatar_url;
+        uint8_t is_invite    = 0;
+        uint8_t join_rule    = 0;
+        uint8_t guest_access = 0;
+        uint16_t member_count = 0;
+};
+
+//! Same layout as cache::codec::encode(const RoomInfo &).
+std::string
+encodeRoom(const Room &room)
+{
+        Writer w;
+        w.reserve(room.name.size() + room.topic.size() + room.avatar_url.size() + 16);
+
+        w.str(room.name);
+        w.str(room.topic);
+        w.str(room.avatar_url);
+        w.u8(room.is_invite);
+        w.u8(room.join_rule);
+        w.u8(room.guest_access);
+        w.u16(room.member_count);
+
+        return w.take();
+}
+
+bool
+decodeRoom(const std::string &record, Room &room)
+{
+        Reader r(record.data(), record.size());
+
+        room.name         = r.str();
+        room.topic        = r.str();
+        room.avatar_url   = r.str();
+        room.is_invite    = r.u8();
+        room.join_rule    = r.u8();
+        room.guest_access = r.u8();
+        room.member_count = r.u16();
+
+        return r.ok() && r.atEnd();
+}
+
+template<class F>
+double
+nanosPerRecord(F f)
+{
+        const auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < ROUNDS; ++round)
+                f();
+        const std::chrono::duration<double, std::nano> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+        return elapsed.count() / ROUNDS / RECORDS;
+}
+}
+
+int
+main()
+{
+        std::vector<Room> rooms(RECORDS);
+        for (int i = 0; i < RECORDS; ++i) {
+                auto &room = rooms[i];
+
+                room.name         = "Room number " + std::to_string(i);
+                room.topic        = "A topic that is longer than the name " + std::to_string(i);
+                room.avatar_url   = "mxc://example.org/" + std::to_string(i * 7919);
+                room.member_count = static_cast<uint16_t>(i);
+        }
+
+        std::vector<std::string> records(RECORDS);
+        const auto encoding = nanosPerRecord([&rooms, &records]() {
+                for (int i = 0; i < RECORDS; ++i)
+                        records[i] = encodeRoom(rooms[i]);
+        });
+
+        std::size_t bytes = 0;
+        for (const auto &record : records)
+                bytes += record.size();
+
+        Room room;
+        const auto decoding = nanosPerRecord([&records, &room]() {
+                for (const auto &record : records)
+                        CHECK(decodeRoom(record, room));
+        });
+
+        std::printf("room record: %.1f bytes, encode %.1f ns, decode %.1f ns\n",
+                    static_cast<double>(bytes) / RECORDS,
+                    encoding,
+                    decoding);
+
+        const auto key  = messageKey(1533254400000, "$1533254400000abcdef:example.org");
+        const auto keys = nanosPerRecord([&key]() {
+                for (int i = 0; i < RECORDS; ++i)
+                        CHECK(messageKey(1533254400000 + i, "$event:example.org").size() >
+                              sizeof(uint64_t));
+        });
+
+        std::printf("message key: %zu bytes, %.1f ns\n", key.size(), keys);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+// Round trips of the binary record fields & the ordering of the cache keys.
+
+#include <string>
+
+#include "CacheCodec.h"
+#include "Check.h"
+
+using namespace cache::codec;
+
+namespace {
+void
+testRoundTrip()
+{
+        Writer w;
+        w.u8(0xab);
+        w.u16(0xbeef);
+        w.u32(0xdeadbeef);
+        w.u64(0x0123456789abcdef);
+        w.str("room name");
+        w.str(std::string("nul\0inside", 10));
+        w.str("");
+
+        const auto record = w.take();
+        CHECK(!isLegacyRecord(record));
+
+        Reader r(record.data(), record.size());
+        CHECK(r.ok());
+        CHECK(r.u8() == 0xab);
+        CHECK(r.u16() == 0xbeef);
+        CHECK(r.u32() == 0xdeadbeef);
+        CHECK(r.u64() == 0x0123456789abcdef);
+        CHECK(r.str() == "room name");
+        CHECK(r.str() == std::string("nul\0inside", 10));
+        CHECK(r.str().empty());
+        CHECK(r.ok());
+        CHECK(r.atEnd());
+}
+
+void
+testInvalidRecords()
+{
+        Writer w;
+        w.str("a long enough string");
+        const auto record = w.take();
+
+        // Every truncation is detected, instead of reading past the end.
+        for (std::size_t size = 1; size < record.size(); ++size) {
+                Reader r(record.data(), size);
+                r.str();
+                CHECK(!r.ok());
+        }
+
+        Reader empty(record.data(), 0);
+        CHECK(!empty.ok());
+
+        auto otherVersion = record;
+        otherVersion[0]   = static_cast<char>(RECORD_VERSION + 1);
+        CHECK(!Reader(otherVersion.data(), otherVersion.size()).ok());
+
+        // Reads after an error return zeroes.
+        Reader r(record.data(), 3);
+        CHECK(r.u64() == 0);
+        CHECK(r.u8() == 0);
+        CHECK(!r.ok());
+
+        CHECK(isLegacyRecord(std::string("{\"name\":\"room\"}")));
+        CHECK(!isLegacyRecord(std::string()));
+}
+
+void
+testKeys()
+{
+        // Big-endian timestamps sort chronologically, whatever the event ids.
+        CHECK(messageKey(0xff, "$b") < messageKey(0x100, "$a"));
+        CHECK(messageKey(1, "$z") < messageKey(uint64_t(1) << 56, "$a"));
+        CHECK(messageKey(42, "$a") < messageKey(42, "$b"));
+        CHECK(messageKey(42, "$a").size() == sizeof(uint64_t) + 2);
+
+        // The receipts of a room are contiguous & start with its prefix.
+        const auto prefix = receiptKeyPrefix("!room:a");
+        CHECK(receiptKey("!room:a", "$event").compare(0, prefix.size(), prefix) == 0);
+        CHECK(receiptKey("!room:a", "$z") < receiptKey("!room:ab", "$a"));
+        CHECK(receiptKey("!room", "$z") < receiptKey("!room:a", "$a"));
+}
+}
+
+int
+main()
+{
+        testRoundTrip();
+        testInvalidRecords();
+        testKeys();
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+//! Abort the test with the location of the failed condition.
+#define CHECK(cond)                                                                        \
+        do {                                                                               \
+                if (!(cond)) {                                                             \
+                        std::fprintf(                                                      \
+                          stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+                        std::exit(EXIT_FAILURE);                                           \
+                }                                                                          \
+        } while (false)
@@ -0,0 +1,68 @@
+// Scores a query against many room names, as the room & member searches do, with &
+// without the cutoff of the worst kept match.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "EditDistance.h"
+
+namespace {
+constexpr int NAMES  = 10000;
+constexpr int ROUNDS = 20;
+
+template<class Score>
+void
+run(const char *name, const std::vector<std::string> &names, Score score)
+{
+        int sum = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < ROUNDS; ++round) {
+                for (const auto &s : names)
+                        sum += score(s);
+        }
+        const std::chrono::duration<double, std::nano> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+        std::printf(
+          "%-24s %7.1f ns per name (checksum %d)\n", name, elapsed.count() / ROUNDS / NAMES, sum);
+}
+}
+
+int
+main()
+{
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<std::size_t> size(5, 40);
+        std::uniform_int_distribution<int> letter('a', 'z');
+
+        std::vector<std::string> names;
+        for (int i = 0; i < NAMES; ++i) {
+                std::string s(size(rng), ' ');
+                for (auto &c : s)
+                        c = static_cast<char>(letter(rng));
+                names.push_back(std::move(s));
+        }
+
+        for (const std::string query : {"nhe", "matrix", "the quick brown fox"}) {
+                std::printf("query \"%s\"\n", query.c_str());
+
+                const utils::EditDistance distance(query);
+
+                run("  levenshtein_distance", names, [&query](const std::string &s) {
+                        return utils::levenshtein_distance(query, s);
+                });
+                run("  EditDistance", names, [&distance](const std::string &s) {
+                        return distance(s);
+                });
+                run("  EditDistance, cutoff 2", names, [&distance](const std::string &s) {
+                        return distance(s, 2);
+                });
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+// Compares the bit-parallel distances with the dynamic programming version, with &
+// without a cutoff.
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "EditDistance.h"
+
+namespace {
+//! Reference implementation: the query has to be matched in full, any prefix of the
+//! string can be skipped for free.
+int
+reference(const std::string &query, const std::string &s)
+{
+        std::vector<int> previous(s.size() + 1, 0), current(s.size() + 1, 0);
+
+        for (std::size_t i = 0; i < query.size(); ++i) {
+                current[0] = i + 1;
+
+                for (std::size_t j = 0; j < s.size(); ++j) {
+                        const int cost = query[i] != s[j];
+                        current[j + 1] =
+                          std::min({previous[j + 1] + 1, current[j] + 1, previous[j] + cost});
+                }
+
+                previous.swap(current);
+        }
+
+        return *std::min_element(previous.begin(), previous.end());
+}
+
+std::string
+randomString(std::mt19937 &rng, std::size_t max_size)
+{
+        // A small alphabet gives many partial matches.
+        std::uniform_int_distribution<std::size_t> size(1, max_size);
+        std::uniform_int_distribution<int> letter('a', 'e');
+
+        std::string s(size(rng), ' ');
+        for (auto &c : s)
+                c = static_cast<char>(letter(rng));
+
+        return s;
+}
+}
+
+int
+main()
+{
+        std::mt19937 rng(42);
+
+        for (int i = 0; i < 20000; ++i) {
+                // Queries longer than 64 bytes use the dynamic programming version.
+                const auto query = randomString(rng, i % 10 == 0 ? 80 : 20);
+                const auto s     = randomString(rng, 40);
+
+                const utils::EditDistance distance(query);
+                const auto expected = query.size() == 1 ? static_cast<int>(s.find(query))
+                                                        : reference(query, s);
+
+                CHECK(distance(s) == expected);
+                CHECK(utils::levenshtein_distance(query, s) == expected);
+
+                // Distances below the cutoff are exact, the others are at least the cutoff.
+                for (int cutoff = 0; cutoff <= 5; ++cutoff) {
+                        const auto result = distance(s, cutoff);
+                        CHECK(expected < cutoff ? result == expected : result >= cutoff);
+                }
+        }
+
+        CHECK(utils::EditDistance("")("abc") == 0);
+        CHECK(utils::EditDistance("abc")("") == -1);
+        CHECK(utils::EditDistance("ace")("xxacxexx") == 1);
+
+        return EXIT_SUCCESS;
+}
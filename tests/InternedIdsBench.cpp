@@ -0,0 +1,76 @@
+// Lookups of interned ids from several threads, as done by the member directory while
+// the sync thread interns new ids.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "InternedIds.h"
+
+namespace {
+constexpr int IDS     = 100000;
+constexpr int LOOKUPS = 2000000;
+
+std::string
+userId(int i)
+{
+        return "@user" + std::to_string(i) + ":example.org";
+}
+}
+
+int
+main()
+{
+        std::vector<std::string> users;
+        for (int i = 0; i < IDS; ++i) {
+                users.push_back(userId(i));
+                ids::intern(users.back());
+        }
+
+        const auto threads = std::max(2u, std::thread::hardware_concurrency());
+
+        int round = 0;
+        for (unsigned readers = 1; readers <= threads; readers *= 2) {
+                std::atomic_bool done{false};
+
+                // New ids keep coming in while the lookups run.
+                round += 1;
+                std::thread writer([&done, round]() {
+                        for (int i = 0; i < IDS && !done; ++i)
+                                ids::intern(userId(round * IDS + i));
+                });
+
+                const auto start = std::chrono::steady_clock::now();
+
+                std::vector<std::thread> workers;
+                for (unsigned r = 0; r < readers; ++r) {
+                        workers.emplace_back([&users, r]() {
+                                for (std::size_t i = 0; i < LOOKUPS; ++i) {
+                                        const auto &user = users[(i * 7919 + r) % IDS];
+                                        CHECK(ids::find(user) != ids::None);
+                                }
+                        });
+                }
+
+                for (auto &worker : workers)
+                        worker.join();
+
+                const std::chrono::duration<double, std::nano> elapsed =
+                  std::chrono::steady_clock::now() - start;
+
+                done = true;
+                writer.join();
+
+                std::printf("%2u readers: %6.1f ns per lookup, %6.1f M lookups/s\n",
+                            readers,
+                            elapsed.count() / LOOKUPS,
+                            readers * LOOKUPS / elapsed.count() * 1000);
+        }
+
+        return EXIT_SUCCESS;
+}
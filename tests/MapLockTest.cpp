@@ -0,0 +1,118 @@
+// Stress test of the re-entrant map lock: threads take nested shared locks in both
+// orders (a transaction inside a snapshot & a snapshot inside a transaction) while
+// another thread keeps resizing the map with a timed exclusive lock.
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "MapLock.h"
+
+namespace {
+constexpr int READERS    = 8;
+constexpr int ITERATIONS = 20000;
+//! Same timeout as the resize of the cache.
+constexpr auto RESIZE_TIMEOUT = std::chrono::seconds(10);
+
+bool
+isLockedElsewhere(std::shared_timed_mutex &mtx)
+{
+        bool locked = false;
+
+        std::thread([&mtx, &locked]() {
+                locked = !mtx.try_lock();
+                if (!locked)
+                        mtx.unlock();
+        }).join();
+
+        return locked;
+}
+
+void
+testNesting()
+{
+        std::shared_timed_mutex mtx;
+
+        CHECK(!MapLock::isHeld(mtx));
+
+        auto outer = std::make_unique<MapLock>(mtx);
+        MapLock inner(mtx);
+
+        CHECK(MapLock::isHeld(mtx));
+        CHECK(isLockedElsewhere(mtx));
+
+        // The outer lock can go first, the inner one still keeps the mutex locked.
+        outer.reset();
+        CHECK(MapLock::isHeld(mtx));
+        CHECK(isLockedElsewhere(mtx));
+
+        MapLock moved = std::move(inner);
+        inner.unlock();
+        CHECK(isLockedElsewhere(mtx));
+
+        moved.unlock();
+        CHECK(!MapLock::isHeld(mtx));
+        CHECK(!isLockedElsewhere(mtx));
+}
+
+void
+testConcurrentResizes()
+{
+        std::shared_timed_mutex mtx;
+        std::atomic_int running{READERS};
+        std::atomic_int resizes{0};
+        std::atomic_int timeouts{0};
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < READERS; ++i) {
+                readers.emplace_back([&mtx, &running, i]() {
+                        for (int n = 0; n < ITERATIONS; ++n) {
+                                auto outer = std::make_unique<MapLock>(mtx);
+                                std::this_thread::yield();
+
+                                MapLock inner(mtx);
+                                CHECK(MapLock::isHeld(mtx));
+
+                                if ((n + i) % 2 == 0)
+                                        outer.reset();
+                        }
+
+                        CHECK(!MapLock::isHeld(mtx));
+                        running -= 1;
+                });
+        }
+
+        std::thread resizer([&]() {
+                while (running > 0) {
+                        std::unique_lock<std::shared_timed_mutex> lock(mtx, std::defer_lock);
+
+                        if (!lock.try_lock_for(RESIZE_TIMEOUT)) {
+                                timeouts += 1;
+                                continue;
+                        }
+
+                        resizes += 1;
+                }
+        });
+
+        for (auto &reader : readers)
+                reader.join();
+        resizer.join();
+
+        CHECK(timeouts == 0);
+        CHECK(resizes > 0);
+}
+}
+
+int
+main()
+{
+        testNesting();
+        testConcurrentResizes();
+
+        return EXIT_SUCCESS;
+}
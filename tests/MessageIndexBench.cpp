@@ -0,0 +1,121 @@
+// Indexes generated messages spread over a few rooms, then times searches across all
+// the rooms & in a single one, and the removal of the oldest messages.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <QStringList>
+#include <QTemporaryDir>
+
+#include "CacheCodec.h"
+#include "Check.h"
+#include "Logging.h"
+#include "MessageIndex.h"
+
+namespace {
+constexpr int MESSAGES = 20000;
+constexpr int ROOMS    = 20;
+constexpr int SEARCHES = 200;
+
+using Clock = std::chrono::steady_clock;
+
+double
+microsSince(Clock::time_point start)
+{
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+std::string
+roomId(int i)
+{
+        return "!room" + std::to_string(i % ROOMS) + ":example.org";
+}
+
+std::string
+keyOf(int i)
+{
+        return cache::codec::messageKey(1533254400000 + i, "$event" + std::to_string(i));
+}
+}
+
+int
+main()
+{
+        QTemporaryDir dir;
+        CHECK(dir.isValid());
+
+        nhlog::init(dir.filePath("bench.log").toStdString());
+
+        auto env = lmdb::env::create();
+        env.set_mapsize(1024 * 1024 * 1024);
+        env.set_max_dbs(8);
+        env.open(dir.path().toStdString().c_str(), MDB_NOTLS | MDB_NOSYNC);
+
+        // Words follow a skewed distribution, so some are common & most are rare.
+        QStringList words;
+        for (int i = 0; i < 5000; ++i)
+                words.append(QString("word%1").arg(i));
+
+        std::mt19937 rng(42);
+        std::geometric_distribution<int> word(0.01);
+        std::uniform_int_distribution<int> length(3, 30);
+
+        MessageIndex index;
+
+        auto start = Clock::now();
+        {
+                auto txn = lmdb::txn::begin(env);
+                index.open(txn);
+
+                for (int i = 0; i < MESSAGES; ++i) {
+                        QStringList body;
+                        for (int n = length(rng); n > 0; --n)
+                                body.append(words.at(std::min(word(rng), words.size() - 1)));
+
+                        index.add(txn, roomId(i), keyOf(i), body.join(' '));
+                }
+
+                txn.commit();
+        }
+        std::printf("add:    %8.1f us per message\n", microsSince(start) / MESSAGES);
+
+        for (const auto query : {"word0", "word3 word7", "\"word1 word2\"", "word400"}) {
+                std::size_t found = 0;
+
+                auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+
+                start = Clock::now();
+                for (int i = 0; i < SEARCHES; ++i)
+                        found += index.search(txn, query, "", 20).size();
+                const auto all = microsSince(start) / SEARCHES;
+
+                start = Clock::now();
+                for (int i = 0; i < SEARCHES; ++i)
+                        found += index.search(txn, query, roomId(i), 20).size();
+                const auto room = microsSince(start) / SEARCHES;
+
+                txn.abort();
+
+                std::printf("search %-16s %8.1f us in all rooms, %8.1f us in a room (%zu)\n",
+                            query,
+                            all,
+                            room,
+                            found);
+        }
+
+        start = Clock::now();
+        {
+                auto txn = lmdb::txn::begin(env);
+
+                for (int i = 0; i < MESSAGES / 2; ++i)
+                        index.remove(txn, roomId(i), keyOf(i));
+
+                txn.commit();
+        }
+        std::printf("remove: %8.1f us per message\n", microsSince(start) / (MESSAGES / 2));
+
+        return EXIT_SUCCESS;
+}
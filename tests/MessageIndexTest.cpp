@@ -0,0 +1,109 @@
+// Adds, searches & removes messages of the full-text index in a temporary LMDB
+// environment.
+
+#include <string>
+#include <vector>
+
+#include <QTemporaryDir>
+
+#include "CacheCodec.h"
+#include "Check.h"
+#include "Logging.h"
+#include "MessageIndex.h"
+
+namespace {
+struct Message
+{
+        std::string room_id;
+        uint64_t timestamp;
+        std::string event_id;
+        QString body;
+};
+
+const std::vector<Message> MESSAGES = {
+  {"!a:example.org", 1000, "$1", "Hello world"},
+  {"!a:example.org", 2000, "$2", "the quick brown fox jumps over the lazy dog"},
+  {"!a:example.org", 3000, "$3", "hello again, WORLD!"},
+  {"!b:example.org", 1500, "$4", "Hello from another room"},
+  {"!b:example.org", 2500, "$5", "a brown quick fox"},
+};
+
+std::string
+keyOf(const Message &message)
+{
+        return cache::codec::messageKey(message.timestamp, message.event_id);
+}
+
+std::vector<std::string>
+eventIds(const std::vector<MessageSearchResult> &results)
+{
+        std::vector<std::string> ids;
+        for (const auto &result : results)
+                ids.push_back(result.event_id);
+
+        return ids;
+}
+}
+
+int
+main()
+{
+        QTemporaryDir dir;
+        CHECK(dir.isValid());
+
+        nhlog::init(dir.filePath("test.log").toStdString());
+
+        auto env = lmdb::env::create();
+        env.set_mapsize(64 * 1024 * 1024);
+        env.set_max_dbs(8);
+        env.open(dir.path().toStdString().c_str(), MDB_NOTLS);
+
+        MessageIndex index;
+
+        auto txn = lmdb::txn::begin(env);
+        index.open(txn);
+
+        for (const auto &message : MESSAGES) {
+                index.add(txn, message.room_id, keyOf(message), message.body);
+                index.addEvent(txn, message.room_id, keyOf(message));
+        }
+
+        // Words are case insensitive & the most recent messages come first.
+        using Ids = std::vector<std::string>;
+        CHECK(eventIds(index.search(txn, "hello", "", 10)) == (Ids{"$3", "$4", "$1"}));
+        CHECK(eventIds(index.search(txn, "HELLO world", "", 10)) == (Ids{"$3", "$1"}));
+        CHECK(eventIds(index.search(txn, "hello", "!b:example.org", 10)) == Ids{"$4"});
+        CHECK(eventIds(index.search(txn, "hello", "", 2)) == (Ids{"$3", "$4"}));
+        CHECK(index.search(txn, "missing", "", 10).empty());
+
+        // Phrases have to appear in order.
+        CHECK(eventIds(index.search(txn, "quick fox", "", 10)) == (Ids{"$5", "$2"}));
+        CHECK(eventIds(index.search(txn, "\"quick brown\"", "", 10)) == Ids{"$2"});
+
+        const auto result = index.search(txn, "lazy", "", 1);
+        CHECK(result.size() == 1);
+        CHECK(result.front().room_id == "!a:example.org");
+        CHECK(result.front().timestamp == 2000);
+        CHECK(result.front().snippet.contains("lazy"));
+
+        // Removed messages leave every list of words.
+        std::string key;
+        CHECK(index.findEvent(txn, "!a:example.org", "$3", key));
+        CHECK(key == keyOf(MESSAGES.at(2)));
+
+        index.remove(txn, "!a:example.org", key);
+        CHECK(!index.contains(txn, "!a:example.org", key));
+        CHECK(!index.findEvent(txn, "!a:example.org", "$3", key));
+        CHECK(eventIds(index.search(txn, "hello", "", 10)) == (Ids{"$4", "$1"}));
+        CHECK(index.search(txn, "again", "", 10).empty());
+
+        index.removeRoom(txn, "!b:example.org");
+        CHECK(eventIds(index.search(txn, "hello", "", 10)) == Ids{"$1"});
+        CHECK(eventIds(index.search(txn, "fox", "", 10)) == Ids{"$2"});
+        CHECK(!index.findEvent(txn, "!b:example.org", "$4", key));
+        CHECK(index.findEvent(txn, "!a:example.org", "$1", key));
+
+        txn.commit();
+
+        return EXIT_SUCCESS;
+}
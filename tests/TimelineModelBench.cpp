@@ -0,0 +1,74 @@
+// Fills the timeline model the way a long scroll back does, one page at a time, then
+// looks up rows by event id as receipts & redactions do.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "Check.h"
+#include "timeline/TimelineModel.h"
+
+namespace {
+constexpr int PAGES     = 400;
+constexpr int PAGE_SIZE = 50;
+constexpr int LOOKUPS   = 1000000;
+
+using Clock = std::chrono::steady_clock;
+
+double
+nanosSince(Clock::time_point start)
+{
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+}
+
+int
+main()
+{
+        const auto start = QDateTime(QDate(2018, 8, 1), QTime(12, 0));
+        const int rows   = PAGES * PAGE_SIZE;
+
+        TimelineModel model;
+
+        auto begin = Clock::now();
+        for (int page = 0; page < PAGES; ++page) {
+                std::vector<TimelineRow> batch(PAGE_SIZE);
+
+                for (int i = 0; i < PAGE_SIZE; ++i) {
+                        const int n = rows - (page + 1) * PAGE_SIZE + i;
+
+                        batch[i].event_id  = QString("$event%1:example.org").arg(n);
+                        batch[i].sender    = QString("@user%1:example.org").arg(n % 7);
+                        batch[i].timestamp = start.addSecs(30 * n);
+                }
+
+                model.prepend(std::move(batch));
+        }
+        std::printf("prepend: %7.1f ns per row\n", nanosSince(begin) / rows);
+
+        std::vector<QString> ids;
+        for (int i = 0; i < rows; i += 97)
+                ids.push_back(QString("$event%1:example.org").arg(i));
+
+        int found = 0;
+
+        begin = Clock::now();
+        for (int i = 0; i < LOOKUPS; ++i)
+                found += model.indexOf(ids[i % ids.size()]) >= 0;
+        std::printf("indexOf: %7.1f ns with contiguous keys\n", nanosSince(begin) / LOOKUPS);
+
+        // Removing rows from the middle turns the lookups into binary searches.
+        for (int i = 0; i < 100; ++i)
+                model.remove(rows / 2);
+
+        begin = Clock::now();
+        for (int i = 0; i < LOOKUPS; ++i)
+                found += model.indexOf(ids[i % ids.size()]) >= 0;
+        std::printf("indexOf: %7.1f ns after removals (%d found)\n",
+                    nanosSince(begin) / LOOKUPS,
+                    found);
+
+        CHECK(found > 0);
+
+        return EXIT_SUCCESS;
+}
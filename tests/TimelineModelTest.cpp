@@ -0,0 +1,92 @@
+// Adds rows at both ends of the timeline model & checks the lookups by event &
+// transaction id and the grouping of the messages by sender.
+
+#include <vector>
+
+#include "Check.h"
+#include "timeline/TimelineModel.h"
+
+namespace {
+const QDateTime START = QDateTime(QDate(2018, 8, 1), QTime(12, 0));
+
+TimelineRow
+makeRow(int i, const QString &sender = "@alice:example.org", int minutes = 0)
+{
+        TimelineRow row;
+        row.event_id  = QString("$%1").arg(i);
+        row.sender    = sender;
+        row.timestamp = START.addSecs(60 * (i + minutes));
+
+        return row;
+}
+}
+
+int
+main()
+{
+        TimelineModel model;
+
+        model.append({makeRow(10), makeRow(11), makeRow(12, "@bob:example.org")});
+        model.prepend({makeRow(8), makeRow(9)});
+        CHECK(model.rowCount() == 5);
+
+        for (int i = 0; i < model.rowCount(); ++i) {
+                CHECK(model.at(i).event_id == QString("$%1").arg(8 + i));
+                CHECK(model.indexOf(model.at(i).event_id) == i);
+        }
+
+        // Known events are skipped at both ends.
+        model.append({makeRow(12), makeRow(13)});
+        model.prepend({makeRow(7), makeRow(8)});
+        CHECK(model.rowCount() == 7);
+        CHECK(model.indexOf("$7") == 0);
+        CHECK(model.indexOf("$13") == 6);
+        CHECK(model.indexOf("$missing") == -1);
+
+        // Consecutive messages of a sender only show it once.
+        CHECK(model.at(0).withSender);
+        CHECK(!model.at(1).withSender);
+        CHECK(model.at(5).withSender);
+        CHECK(model.at(6).withSender);
+
+        // A gap of more than 15 minutes shows the sender again, a new day the date.
+        model.append({makeRow(14, "@bob:example.org", 20), makeRow(15, "@bob:example.org", 2000)});
+        CHECK(model.at(7).withSender);
+        CHECK(!model.at(7).showDate);
+        CHECK(model.at(8).showDate);
+
+        // Local echoes are found by transaction id until sync gives them an event id.
+        auto echo     = makeRow(16);
+        echo.event_id = QString();
+        echo.txn_id   = "txn1";
+        model.append({echo});
+
+        const auto row = model.indexOfTxn("txn1");
+        CHECK(row == 9);
+        model.setEventId(row, "$16");
+        CHECK(model.indexOf("$16") == row);
+
+        model.setStatus(row, StatusIndicatorState::Received);
+        CHECK(model.at(row).isReceived());
+
+        // Lookups still work once the keys aren't contiguous anymore.
+        model.remove(3);
+        CHECK(model.indexOf("$10") == -1);
+        CHECK(model.indexOf("$11") == 3);
+        CHECK(model.indexOf("$16") == 8);
+        CHECK(model.indexOfTxn("txn1") == 8);
+
+        // The row after the removed one is grouped again.
+        model.remove(0);
+        CHECK(model.at(0).event_id == "$8");
+        CHECK(model.at(0).withSender);
+
+        CHECK(model.lastMessage() == model.rowCount() - 1);
+
+        model.clear();
+        CHECK(model.rowCount() == 0);
+        CHECK(model.indexOf("$8") == -1);
+        CHECK(model.lastMessage() == -1);
+
+        return EXIT_SUCCESS;
+}